@@ -0,0 +1,85 @@
+#include "mcugdx.h"
+
+#define TAG "Audio bench"
+#define SAMPLE_RATE 44100
+#define BLOCK_FRAMES 1024
+#define WARMUP_BLOCKS 4
+#define MEASURE_BLOCKS 32
+#define MAX_WORKERS 3
+
+static const uint32_t voice_counts[] = {1, 2, 4, 8, 16, 32};
+
+// Mixes MEASURE_BLOCKS blocks and returns the average time per block in microseconds
+static double measure(int32_t *frames) {
+	for (int i = 0; i < WARMUP_BLOCKS; i++) mcugdx_audio_mix(frames, BLOCK_FRAMES, MCUGDX_STEREO);
+	double start = mcugdx_time();
+	for (int i = 0; i < MEASURE_BLOCKS; i++) mcugdx_audio_mix(frames, BLOCK_FRAMES, MCUGDX_STEREO);
+	return (mcugdx_time() - start) * 1000000.0 / MEASURE_BLOCKS;
+}
+
+int mcugdx_main() {
+	mcugdx_init();
+	mcugdx_rofs_init();
+
+	// Without an output device, only the mix calls below run and nothing else
+	// competes for the audio lock or advances the voices
+	mcugdx_audio_config_t audio_config = {
+			.sample_rate = SAMPLE_RATE,
+			.channels = MCUGDX_STEREO,
+			.no_output = true};
+	if (!mcugdx_audio_init(&audio_config)) {
+		mcugdx_loge(TAG, "Failed to initialize audio");
+		return 0;
+	}
+
+	mcugdx_sound_t *qoa = mcugdx_sound_load("synth.qoa", &mcugdx_rofs, MCUGDX_PRELOADED, MCUGDX_MEM_EXTERNAL);
+	if (!qoa) {
+		mcugdx_loge(TAG, "Failed to load sound");
+		return 0;
+	}
+
+	mcugdx_synth_params_t params;
+	mcugdx_synth_params_init(&params);
+	params.wave = MCUGDX_SYNTH_SAW;
+	params.sustain = 10;
+	params.vibrato_depth = 0.5f;
+	params.vibrato_speed = 6;
+	mcugdx_sound_t *synth = mcugdx_synth_create(&params, MCUGDX_MEM_INTERNAL);
+	if (!synth) {
+		mcugdx_loge(TAG, "Failed to create synth");
+		return 0;
+	}
+
+	int32_t *frames = mcugdx_mem_alloc(BLOCK_FRAMES * MCUGDX_STEREO * sizeof(int32_t), MCUGDX_MEM_INTERNAL);
+	double block_us = BLOCK_FRAMES * 1000000.0 / SAMPLE_RATE;
+	mcugdx_log(TAG, "Block of %i frames, %f us of audio, every other voice is a preloaded QOA, the rest synths", BLOCK_FRAMES, block_us);
+
+	double single_core[sizeof(voice_counts) / sizeof(voice_counts[0])];
+	for (uint32_t workers = 0; workers <= MAX_WORKERS; workers++) {
+		if (!mcugdx_audio_set_mix_workers(workers)) {
+			mcugdx_loge(TAG, "Failed to start %li mix workers", workers);
+			break;
+		}
+
+		for (uint32_t i = 0; i < sizeof(voice_counts) / sizeof(voice_counts[0]); i++) {
+			mcugdx_sound_id_t ids[32];
+			for (uint32_t v = 0; v < voice_counts[i]; v++) {
+				ids[v] = mcugdx_sound_play(v % 2 ? synth : qoa, 128, (uint8_t) (v * 8), MCUGDX_LOOP);
+			}
+
+			double us = measure(frames);
+			if (workers == 0) single_core[i] = us;
+			mcugdx_log(TAG, "workers: %li, voices: %li, %f us/block, %f%% of realtime, speedup %fx",
+					   workers, voice_counts[i], us, us / block_us * 100, single_core[i] / us);
+
+			for (uint32_t v = 0; v < voice_counts[i]; v++) mcugdx_sound_stop(ids[v]);
+		}
+	}
+
+	mcugdx_audio_set_mix_workers(0);
+	mcugdx_mem_free(frames);
+	mcugdx_sound_unload(synth);
+	mcugdx_sound_unload(qoa);
+	mcugdx_mem_print();
+	return 0;
+}
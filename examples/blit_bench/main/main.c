@@ -0,0 +1,134 @@
+#include "mcugdx.h"
+#include <string.h>
+
+#define TAG "Blit bench"
+#define PIXELS_PER_RUN (1 << 22)
+#define COLOR_KEY 0
+
+static const uint32_t sizes[] = {8, 16, 32, 64, 128};
+static const uint32_t key_percentages[] = {0, 25, 50, 75, 100};
+
+static uint32_t random_state = 0x12345678;
+
+static uint32_t next_random(void) {
+	uint32_t x = random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return random_state = x;
+}
+
+// Square sprite where roughly key_percentage percent of the pixels are the
+// color key. Scattered sprites key random pixels, so the branches in the kernels
+// can't be predicted. Otherwise each row has one opaque run in the center, like
+// most actual sprites.
+static mcugdx_image_t *create_sprite(uint32_t size, uint32_t key_percentage, bool scattered) {
+	mcugdx_image_t *image = mcugdx_mem_alloc(sizeof(mcugdx_image_t), MCUGDX_MEM_INTERNAL);
+	memset(image, 0, sizeof(mcugdx_image_t));
+	image->width = size;
+	image->height = size;
+	image->mem_type = MCUGDX_MEM_INTERNAL;
+	image->pixels = mcugdx_mem_alloc(size * size * sizeof(uint16_t), MCUGDX_MEM_INTERNAL);
+	uint32_t opaque_width = size * (100 - key_percentage) / 100;
+	for (uint32_t i = 0; i < size * size; i++) {
+		uint32_t x = i % size;
+		bool key = scattered ? next_random() % 100 < key_percentage : x < (size - opaque_width) / 2 || x >= (size - opaque_width) / 2 + opaque_width;
+		image->pixels[i] = key ? COLOR_KEY : (uint16_t) (next_random() | 1);
+	}
+	return image;
+}
+
+// Blits the sprite at odd positions, so all source and destination alignments
+// are covered, and returns Mpixels/s
+static double measure(mcugdx_image_t *sprite, int32_t width, int32_t height) {
+	uint32_t size = sprite->width;
+	uint32_t num_blits = PIXELS_PER_RUN / (size * size);
+	double start = mcugdx_time();
+	for (uint32_t i = 0; i < num_blits; i++) {
+		int32_t x = (int32_t) (i * 37) % (width - (int32_t) size);
+		int32_t y = (int32_t) (i * 17) % (height - (int32_t) size);
+		mcugdx_display_blit_keyed(sprite, x, y, COLOR_KEY);
+	}
+	return num_blits * size * size / (mcugdx_time() - start) / 1000000;
+}
+
+// Blits num_blits sprites cycling through the images, first one call per
+// sprite, then as batches with each of the batch options, and logs Mpixels/s
+static void measure_batch(mcugdx_image_t **images, uint32_t num_images, uint32_t num_blits, int32_t width, int32_t height) {
+	mcugdx_blit_t *blits = mcugdx_mem_alloc(num_blits * sizeof(mcugdx_blit_t), MCUGDX_MEM_INTERNAL);
+	memset(blits, 0, num_blits * sizeof(mcugdx_blit_t));
+	uint32_t num_pixels = 0;
+	for (uint32_t i = 0; i < num_blits; i++) {
+		mcugdx_image_t *image = images[i % num_images];
+		blits[i].image = image;
+		blits[i].x = (int32_t) (i * 37) % (width - (int32_t) image->width);
+		blits[i].y = (int32_t) (i * 17) % (height - (int32_t) image->height);
+		blits[i].color_key = COLOR_KEY;
+		blits[i].flags = MCUGDX_BLIT_KEYED;
+		num_pixels += image->width * image->height;
+	}
+	uint32_t num_runs = PIXELS_PER_RUN / num_pixels + 1;
+
+	double start = mcugdx_time();
+	for (uint32_t run = 0; run < num_runs; run++) {
+		for (uint32_t i = 0; i < num_blits; i++) mcugdx_display_blit_keyed(blits[i].image, blits[i].x, blits[i].y, COLOR_KEY);
+	}
+	double single = num_runs * num_pixels / (mcugdx_time() - start) / 1000000;
+
+	uint32_t options[] = {0, MCUGDX_BATCH_SORT, MCUGDX_BATCH_PARALLEL, MCUGDX_BATCH_SORT | MCUGDX_BATCH_PARALLEL};
+	double batched[4];
+	for (uint32_t o = 0; o < 4; o++) {
+		start = mcugdx_time();
+		for (uint32_t run = 0; run < num_runs; run++) mcugdx_display_blit_batch(blits, num_blits, options[o]);
+		batched[o] = num_runs * num_pixels / (mcugdx_time() - start) / 1000000;
+	}
+	mcugdx_log(TAG, "%li blits of %li images, single: %f, batch: %f, sorted: %f, parallel: %f, both: %f Mpixels/s",
+			   num_blits, num_images, single, batched[0], batched[1], batched[2], batched[3]);
+	mcugdx_mem_free(blits);
+}
+
+int mcugdx_main() {
+	mcugdx_init();
+
+	mcugdx_display_config_t display_config = {
+			.driver = MCUGDX_ST7789,
+			.native_width = 240,
+			.native_height = 320,
+			.mosi = 3,
+			.sck = 4,
+			.dc = 2,
+			.cs = 1,
+			.reset = -1};
+	mcugdx_display_init(&display_config);
+	mcugdx_display_set_orientation(MCUGDX_LANDSCAPE);
+	int32_t width = mcugdx_display_width();
+	int32_t height = mcugdx_display_height();
+
+	for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		uint32_t size = sizes[s];
+		for (uint32_t k = 0; k < sizeof(key_percentages) / sizeof(key_percentages[0]); k++) {
+			for (int scattered = 0; scattered < 2; scattered++) {
+				mcugdx_image_t *sprite = create_sprite(size, key_percentages[k], scattered);
+				mcugdx_display_clear();
+				double keyed = measure(sprite, width, height);
+				mcugdx_image_make_sprite(sprite, COLOR_KEY);
+				double spans = measure(sprite, width, height);
+				mcugdx_log(TAG, "size: %lix%li, keyed: %li%% %s, %f Mpixels/s, with spans %f Mpixels/s",
+						   size, size, key_percentages[k], scattered ? "scattered" : "solid", keyed, spans);
+				mcugdx_image_unload(sprite);
+			}
+		}
+		mcugdx_display_show();
+	}
+
+	mcugdx_image_t *images[4];
+	for (uint32_t i = 0; i < 4; i++) {
+		images[i] = create_sprite(sizes[i], 50, false);
+		mcugdx_image_make_sprite(images[i], COLOR_KEY);
+	}
+	measure_batch(images, 4, 64, width, height);
+	measure_batch(images, 4, 512, width, height);
+	for (uint32_t i = 0; i < 4; i++) mcugdx_image_unload(images[i]);
+	mcugdx_display_show();
+	return 0;
+}
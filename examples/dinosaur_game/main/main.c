@@ -184,6 +184,12 @@ void load() {
 	pterodactylus = mcugdx_image_load("pterodactylus.qoi", &mcugdx_rofs, MCUGDX_MEM_EXTERNAL);
 	pterodactylus2 = mcugdx_image_load("pterodactylus-2.qoi", &mcugdx_rofs, MCUGDX_MEM_EXTERNAL);
 
+	// Everything but the ground is blitted keyed, let the blits skip the transparent pixels
+	mcugdx_image_t *sprites[] = {dino_jump, dino_run, cactus, cloud, hill, pterodactylus, pterodactylus2};
+	for (uint32_t i = 0; i < sizeof(sprites) / sizeof(sprites[0]); i++) {
+		mcugdx_image_make_sprite(sprites[i], 0);
+	}
+
 	dino_run_anim = (animation_t){
 			.img = dino_run,
 			.num_frames = 4,
@@ -37,5 +37,7 @@ void DG_SleepMs(uint32_t ms);
 uint32_t DG_GetTicksMs();
 int DG_GetKey(int* pressed, unsigned char* key);
 void DG_SetWindowTitle(const char * title);
+// 256 byte swapped RGB565 colors for the indices in DG_ScreenBuffer
+void DG_SetPalette(const uint16_t *colors);
 
 #endif //DOOM_GENERIC
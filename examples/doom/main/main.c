@@ -23,7 +23,8 @@ mcugdx_display_config_t display_config = {
 		.sck = 4,
 		.dc = 2,
 		.cs = 1,
-		.reset = 5};
+		.reset = 5,
+		.indexed = true};
 #else
 // ILI9341 2,8" 240x320
 mcugdx_display_config_t display_config = {
@@ -34,7 +35,8 @@ mcugdx_display_config_t display_config = {
 		.sck = 4,
 		.dc = 2,
 		.cs = 1,
-		.reset = 5};
+		.reset = 5,
+		.indexed = true};
 #endif
 
 typedef struct {
@@ -191,7 +193,11 @@ sound_module_t DG_sound_module = {
 };
 
 void DG_Init() {
-	DG_ScreenBuffer = (pixel_t *) (mcugdx_display_frame_buffer() + mcugdx_display_width() * 20);
+	DG_ScreenBuffer = (pixel_t *) (mcugdx_display_indexed_frame_buffer() + mcugdx_display_width() * 20);
+}
+
+void DG_SetPalette(const uint16_t *colors) {
+	mcugdx_display_set_palette(colors);
 }
 
 void DG_SetWindowTitle(const char *title) {
@@ -0,0 +1,445 @@
+#include "mcugdx.h"
+#include <stdio.h>
+#include <string.h>
+
+#define TAG "Golden"
+
+// Renders scripted scenes with the dinosaur game assets and compares the frame
+// hashes against the ones recorded with the reference rasterizer. Any change
+// to the blitters must keep these bit-exact. To record new hashes, set the
+// expected hash to 0 and copy the logged one. On desktop, frames that don't
+// match are written to <scene>.qoi for inspection.
+typedef struct {
+	const char *name;
+	void (*draw)(void);
+	bool as_list;
+	bool as_sprites;
+	uint64_t expected_hash;
+} scene_t;
+
+static mcugdx_image_t *cactus;
+static mcugdx_image_t *cloud;
+static mcugdx_image_t *dino_run;
+static mcugdx_image_t *ground;
+static mcugdx_image_t *hill;
+static mcugdx_image_t *pterodactylus;
+
+static uint16_t rgb32_to_rgb16(uint32_t rgb32) {
+	return (rgb32 >> 8 & 0xf800) | (rgb32 >> 5 & 0x07e0) | (rgb32 >> 3 & 0x001f);
+}
+
+static void draw_primitives(void) {
+	mcugdx_display_clear_color(rgb32_to_rgb16(0x4a5786));
+	for (int32_t i = 0; i < 16; i++) {
+		mcugdx_display_rect(i * 23 - 20, i * 17 - 10, 40 + i * 3, 30, rgb32_to_rgb16(0x100000 * i + 0x3377aa));
+		mcugdx_display_hline(-5 + i, 330 - i * 2, 200 + i, rgb32_to_rgb16(0xffffff - 0x0f0f0f * i));
+	}
+	for (int32_t i = 0; i < 64; i++) {
+		mcugdx_display_set_pixel((i * 37) % 330 - 5, (i * 91) % 250 - 5, 0xffff);
+	}
+}
+
+// Lines, ellipses and polygons, aliased on the left, anti-aliased on the
+// right, some of them crossing the screen edges
+static void draw_shapes(void) {
+	mcugdx_display_clear_color(rgb32_to_rgb16(0x202838));
+	for (int32_t i = 0; i < 12; i++) {
+		int32_t x = 80 + i * 13 % 70, y = 60 - i * 9;
+		mcugdx_display_line(80, 60, -40 + i * 25, 250 - i * 3, rgb32_to_rgb16(0xf0c040 - 0x100008 * i));
+		mcugdx_display_line_aa(240, 60, 220 + i * 25 - x, 250 - y, rgb32_to_rgb16(0xf0c040 - 0x100008 * i));
+	}
+	mcugdx_display_fill_ellipse(40, 40, 30, 18, rgb32_to_rgb16(0x3070d0));
+	mcugdx_display_ellipse(40, 40, 34, 22, rgb32_to_rgb16(0xffffff));
+	mcugdx_display_fill_ellipse_aa(200, 40, 30, 18, rgb32_to_rgb16(0x3070d0));
+	mcugdx_display_ellipse_aa(200, 40, 34, 22, rgb32_to_rgb16(0xffffff));
+	mcugdx_display_fill_circle(120, 170, 25, rgb32_to_rgb16(0xd04060));
+	mcugdx_display_circle(0, 240, 40, rgb32_to_rgb16(0x60d040));
+	mcugdx_display_fill_ellipse_aa(290, 170, 25, 25, rgb32_to_rgb16(0xd04060));
+	mcugdx_display_ellipse_aa(320, 0, 40, 40, rgb32_to_rgb16(0x60d040));
+	mcugdx_display_fill_triangle(10, 100, 70, 120, 30, 150, rgb32_to_rgb16(0x80e0e0));
+	mcugdx_display_triangle(10, 100, 70, 120, 30, 150, rgb32_to_rgb16(0xffffff));
+	int32_t hexagon[] = {160, 180, 180, 192, 180, 215, 160, 227, 140, 215, 140, 192};
+	mcugdx_display_fill_polygon(hexagon, 6, rgb32_to_rgb16(0xa060e0));
+	mcugdx_display_polygon(hexagon, 6, rgb32_to_rgb16(0xffffff));
+}
+
+static void draw_background(void) {
+	mcugdx_display_clear();
+	int32_t sky_rows[] = {20, 41, 39, 140};
+	uint32_t sky_colors[] = {0x4a5786, 0x577f9d, 0x6fb0b7, 0xa0ddd3};
+	int32_t y = 0;
+	for (int32_t i = 0; i < 4; i++) {
+		mcugdx_display_rect(0, y, 320, sky_rows[i], rgb32_to_rgb16(sky_colors[i]));
+		y += sky_rows[i];
+	}
+
+	int32_t ground_y = 240 - ground->height;
+	for (int32_t x = 0; x < 3 * (int32_t) cloud->width; x += cloud->width) {
+		mcugdx_display_blit_keyed(cloud, x - 7, ground_y - hill->height - cloud->height / 2, 0);
+	}
+	for (int32_t x = 0; x < 3 * (int32_t) hill->width; x += hill->width) {
+		mcugdx_display_blit_keyed(hill, x - 33, ground_y - hill->height, 0);
+	}
+	for (int32_t x = 0; x < 6 * (int32_t) ground->width; x += ground->width) {
+		mcugdx_display_blit(ground, x - 5, ground_y);
+	}
+}
+
+// The background drawn once into an image and then blitted as a whole, which
+// must look exactly like drawing it directly
+static void draw_target(void) {
+	static mcugdx_image_t *background = NULL;
+	if (!background) {
+		background = mcugdx_image_create(320, 240, MCUGDX_MEM_EXTERNAL);
+		mcugdx_display_set_target(background);
+		draw_background();
+		mcugdx_display_set_target(NULL);
+	}
+	mcugdx_display_blit(background, 0, 0);
+}
+
+static void draw_sprites(void) {
+	draw_background();
+
+	int32_t ground_y = 240 - ground->height;
+	int32_t dino_width = dino_run->width / 4;
+	for (int32_t frame = 0; frame < 4; frame++) {
+		mcugdx_display_blit_region_keyed(dino_run, 10 + frame * 50, ground_y - dino_run->height - frame * 20, frame * dino_width, 0, dino_width, dino_run->height, 0);
+	}
+
+	int32_t cactus_width = cactus->width / 7;
+	for (int32_t frame = 0; frame < 7; frame++) {
+		mcugdx_display_blit_region_keyed(cactus, frame * 45 + 20, ground_y - cactus->height, frame * cactus_width, 0, cactus_width, cactus->height, 0);
+	}
+
+	int32_t ptero_width = pterodactylus->width / 4;
+	mcugdx_display_blit_region_keyed(pterodactylus, 200, 40, 0, 0, ptero_width, pterodactylus->height, 0);
+	mcugdx_display_blit_region_keyed(pterodactylus, 120, 70, ptero_width * 2, 0, ptero_width, pterodactylus->height, 0);
+}
+
+// Same as draw_sprites(), as one parallel batch
+static void draw_sprites_batch(void) {
+	draw_background();
+
+	mcugdx_blit_t blits[13];
+	uint32_t num_blits = 0;
+	int32_t ground_y = 240 - ground->height;
+	int32_t dino_width = dino_run->width / 4;
+	for (int32_t frame = 0; frame < 4; frame++) {
+		blits[num_blits++] = (mcugdx_blit_t){dino_run, 10 + frame * 50, ground_y - dino_run->height - frame * 20, frame * dino_width, 0, dino_width, dino_run->height, 0, MCUGDX_BLIT_KEYED};
+	}
+	int32_t cactus_width = cactus->width / 7;
+	for (int32_t frame = 0; frame < 7; frame++) {
+		blits[num_blits++] = (mcugdx_blit_t){cactus, frame * 45 + 20, ground_y - cactus->height, frame * cactus_width, 0, cactus_width, cactus->height, 0, MCUGDX_BLIT_KEYED};
+	}
+	int32_t ptero_width = pterodactylus->width / 4;
+	blits[num_blits++] = (mcugdx_blit_t){pterodactylus, 200, 40, 0, 0, ptero_width, pterodactylus->height, 0, MCUGDX_BLIT_KEYED};
+	blits[num_blits++] = (mcugdx_blit_t){pterodactylus, 120, 70, ptero_width * 2, 0, ptero_width, pterodactylus->height, 0, MCUGDX_BLIT_KEYED};
+	mcugdx_display_blit_batch(blits, num_blits, MCUGDX_BATCH_SORT | MCUGDX_BATCH_PARALLEL);
+}
+
+// Everything partially off each of the four edges
+static void draw_clipped(void) {
+	draw_background();
+
+	int32_t ptero_width = pterodactylus->width / 4;
+	int32_t edges_x[] = {-ptero_width / 2, 320 - ptero_width / 2, 150, 150};
+	int32_t edges_y[] = {100, 100, -(int32_t) pterodactylus->height / 2, 240 - (int32_t) pterodactylus->height / 2};
+	for (int32_t i = 0; i < 4; i++) {
+		mcugdx_display_blit_region_keyed(pterodactylus, edges_x[i], edges_y[i], ptero_width * i, 0, ptero_width, pterodactylus->height, 0);
+		mcugdx_display_blit(cactus, edges_x[i] + 5, edges_y[i] + 5);
+		mcugdx_display_rect(edges_x[i] - 3, edges_y[i] - 3, 20, 20, 0xf800);
+	}
+	mcugdx_display_blit_keyed(hill, -400, 0, 0);
+	mcugdx_display_blit_region(dino_run, 300, 200, 3, 3, 40, 40);
+}
+
+// Flips, rotations, scales and a rotated, scaled affine blit
+static void draw_transforms(void) {
+	draw_background();
+
+	int32_t ptero_width = pterodactylus->width / 4;
+	uint32_t flags[] = {0, MCUGDX_BLIT_FLIP_X, MCUGDX_BLIT_FLIP_Y, MCUGDX_BLIT_ROTATE_90, MCUGDX_BLIT_ROTATE_180, MCUGDX_BLIT_ROTATE_270};
+	for (int32_t i = 0; i < 6; i++) {
+		mcugdx_display_blit_ex(pterodactylus, i * 55 - 10, 10, ptero_width, 0, ptero_width, pterodactylus->height, MCUGDX_FIXED_ONE, MCUGDX_FIXED_ONE, flags[i] | MCUGDX_BLIT_KEYED, 0);
+	}
+	int32_t scales[] = {MCUGDX_FIXED_ONE / 2, MCUGDX_FIXED_ONE * 3 / 4, MCUGDX_FIXED_ONE * 2, MCUGDX_FIXED_ONE * 5 / 2};
+	for (int32_t i = 0; i < 4; i++) {
+		mcugdx_display_blit_ex(dino_run, i * 70 + 5, 80, 0, 0, dino_run->width / 4, dino_run->height, scales[i], scales[3 - i], MCUGDX_BLIT_KEYED | (i & 1 ? MCUGDX_BLIT_FLIP_X : 0), 0);
+	}
+
+	// Rotated by 30 degrees and scaled by 1.5 around the cactus' center
+	int32_t cos_scaled = 85133, sin_scaled = 49152;
+	int32_t cactus_width = cactus->width / 7;
+	int32_t center_x = cactus_width / 2, center_y = cactus->height / 2;
+	int32_t matrix[] = {cos_scaled, -sin_scaled, 250 * MCUGDX_FIXED_ONE - (cos_scaled * center_x - sin_scaled * center_y),
+						sin_scaled, cos_scaled, 180 * MCUGDX_FIXED_ONE - (sin_scaled * center_x + cos_scaled * center_y)};
+	mcugdx_display_blit_affine(cactus, cactus_width * 2, 0, cactus_width, cactus->height, matrix, MCUGDX_BLIT_KEYED, 0);
+}
+
+// The hill and ground rebuilt from tiles as endlessly repeating layers,
+// scrolled so the wrap around is visible
+static void draw_tilemaps(void) {
+	static mcugdx_tilemap_t *hills = NULL;
+	static mcugdx_tilemap_t *grounds = NULL;
+	if (!hills) {
+		hills = mcugdx_tilemap_create(hill, 16, 13, 0, MCUGDX_MEM_INTERNAL);
+		mcugdx_tilemap_layer_t *layer = mcugdx_tilemap_add_layer(hills, 12, 4, MCUGDX_TILEMAP_KEYED | MCUGDX_TILEMAP_REPEAT_X);
+		layer->offset_y = 240 - ground->height - hill->height;
+		layer->parallax_x = 0.5f;
+		for (uint32_t i = 0; i < 48; i++) mcugdx_tilemap_set_tile(hills, layer, i % 12, i / 12, i + 1);
+
+		grounds = mcugdx_tilemap_create(ground, 16, 16, 0, MCUGDX_MEM_INTERNAL);
+		layer = mcugdx_tilemap_add_layer(grounds, 7, 2, MCUGDX_TILEMAP_REPEAT_X);
+		layer->offset_y = 240 - ground->height;
+		for (uint32_t i = 0; i < 14; i++) mcugdx_tilemap_set_tile(grounds, layer, i % 7, i / 7, (i * 3) % 8 + 1);
+	}
+
+	mcugdx_display_clear_color(rgb32_to_rgb16(0x6fb0b7));
+	mcugdx_tilemap_draw(hills, 150, 0);
+	mcugdx_tilemap_draw(grounds, -37, 0);
+}
+
+// Every blend mode at a few opacities plus tints. Needs sprites, otherwise
+// the color keyed pixels would be blended too.
+static void draw_blend(void) {
+	draw_background();
+
+	int32_t ptero_width = pterodactylus->width / 4;
+	mcugdx_blend_mode_t modes[] = {MCUGDX_BLEND_ALPHA, MCUGDX_BLEND_ADD, MCUGDX_BLEND_MULTIPLY};
+	for (int32_t i = 0; i < 3; i++) {
+		for (int32_t j = 0; j < 4; j++) {
+			mcugdx_display_blit_region_blend(pterodactylus, j * 80 - 10, i * 50 + 5, ptero_width * j, 0, ptero_width, pterodactylus->height, modes[i], (uint8_t) (255 - j * 70));
+		}
+	}
+	mcugdx_display_rect(100, 60, 120, 60, 0xf800);
+	mcugdx_display_blit_blend(cloud, 90, 70, MCUGDX_BLEND_ALPHA, 128);
+	mcugdx_display_blit_tint(cactus, 10, 160, 0xffff, 255);
+	mcugdx_display_blit_region_tint(dino_run, 200, 150, 0, 0, dino_run->width / 4, dino_run->height, 0xf800, 100);
+}
+
+// Indexed images drawn with their own palettes, a cycled palette and a darkened
+// one, clipped at the screen edges
+static void draw_indexed(void) {
+	static mcugdx_indexed_image_t *hill_indexed = NULL;
+	static mcugdx_indexed_image_t *ground_indexed = NULL;
+	static mcugdx_indexed_image_t *dino_indexed = NULL;
+	static uint16_t cycled[16];
+	static uint16_t darkened[256];
+	if (!hill_indexed) {
+		hill_indexed = mcugdx_image_load_indexed("hill.qoi", &mcugdx_rofs, 4, MCUGDX_MEM_INTERNAL);
+		ground_indexed = mcugdx_image_load_indexed("ground.qoi", &mcugdx_rofs, 4, MCUGDX_MEM_INTERNAL);
+		dino_indexed = mcugdx_image_load_indexed("dino-run.qoi", &mcugdx_rofs, 8, MCUGDX_MEM_INTERNAL);
+		for (uint32_t i = 0; i < 16; i++) cycled[i] = hill_indexed->palette[i == 0 ? 0 : i % 4 + 1];
+		// Palettes hold colors as written to memory, i.e. byte swapped
+		for (uint32_t i = 0; i < 256; i++) {
+			uint16_t color = (uint16_t) (dino_indexed->palette[i] >> 8 | dino_indexed->palette[i] << 8);
+			color = (color >> 1) & 0x7bef;
+			darkened[i] = (uint16_t) (color >> 8 | color << 8);
+		}
+	}
+
+	mcugdx_display_clear_color(rgb32_to_rgb16(0x6fb0b7));
+	mcugdx_display_blit_indexed(hill_indexed, -40, 60, NULL, MCUGDX_BLIT_KEYED, 0);
+	mcugdx_display_blit_indexed(hill_indexed, 170, 60, cycled, MCUGDX_BLIT_KEYED, 0);
+	for (int32_t x = -13; x < 320; x += ground_indexed->width) {
+		mcugdx_display_blit_indexed(ground_indexed, x, 240 - ground_indexed->height, NULL, 0, 0);
+	}
+	int32_t dino_width = dino_indexed->width / 4;
+	mcugdx_display_blit_region_indexed(dino_indexed, 20, 150, 0, 0, dino_width, dino_indexed->height, NULL, MCUGDX_BLIT_KEYED, 0);
+	mcugdx_display_blit_region_indexed(dino_indexed, 80, 150, dino_width * 3 + 1, 0, dino_width - 1, dino_indexed->height, darkened, MCUGDX_BLIT_KEYED, 0);
+	mcugdx_display_blit_region_indexed(dino_indexed, 300, 20, dino_width, 0, dino_width, dino_indexed->height, NULL, 0, 0);
+}
+
+// 3x5 digits and a colon, one row per 3 bits, top row in the highest bits
+static const uint16_t digit_bits[] = {
+		0x7b6f, 0x2c97, 0x73e7, 0x73cf, 0x5bc9, 0x79cf, 0x79ef, 0x7249, 0x7bef, 0x7bcf, 0x0410};
+
+static bool digit_bit(uint32_t digit, int32_t x, int32_t y) {
+	return x >= 0 && x < 3 && ((digit_bits[digit] >> (14 - y * 3 - x)) & 1);
+}
+
+// Builds a font from the digits, scaled 2x into 8x12 cells. Anti-aliased fonts
+// get half covered pixels left and right of the covered ones.
+static mcugdx_font_t *create_digit_font(bool antialiased) {
+	uint32_t num_glyphs = sizeof(digit_bits) / sizeof(digit_bits[0]);
+	mcugdx_image_t *atlas = mcugdx_mem_alloc(sizeof(mcugdx_image_t), MCUGDX_MEM_INTERNAL);
+	memset(atlas, 0, sizeof(mcugdx_image_t));
+	atlas->width = num_glyphs * 8;
+	atlas->height = 12;
+	atlas->pixels = mcugdx_mem_alloc(atlas->width * atlas->height * sizeof(uint16_t), MCUGDX_MEM_INTERNAL);
+	atlas->alpha = mcugdx_mem_alloc(atlas->width * atlas->height, MCUGDX_MEM_INTERNAL);
+	atlas->alpha_bits = 8;
+	atlas->mem_type = MCUGDX_MEM_INTERNAL;
+	memset(atlas->alpha, 0, atlas->width * atlas->height);
+
+	mcugdx_glyph_t glyphs[sizeof(digit_bits) / sizeof(digit_bits[0]) + 1];
+	for (uint32_t i = 0; i < num_glyphs; i++) {
+		for (int32_t y = 0; y < 10; y++) {
+			for (int32_t x = 0; x < 8; x++) {
+				int32_t bit_x = (x + 1) / 2 - 1;
+				bool covered = digit_bit(i, bit_x, y / 2);
+				bool edge = digit_bit(i, bit_x - 1, y / 2) || digit_bit(i, bit_x + 1, y / 2);
+				atlas->alpha[(y + 1) * atlas->width + i * 8 + x] = covered ? 255 : edge ? 110 : 0;
+			}
+		}
+		glyphs[i] = (mcugdx_glyph_t){.codepoint = i < 10 ? '0' + i : ':', .x = i * 8, .width = 8, .height = 12, .offset_x = -1, .advance = i < 10 ? 8 : 5};
+	}
+	glyphs[num_glyphs] = (mcugdx_glyph_t){.codepoint = ' ', .advance = 6};
+	mcugdx_kerning_t kernings[] = {{'1', '1', -2}, {':', '1', -1}};
+	return mcugdx_font_create(atlas, 13, 11, glyphs, num_glyphs + 1, kernings, 2, antialiased, MCUGDX_MEM_INTERNAL);
+}
+
+// Digit fonts with and without anti-aliasing in several colors, clipped at the
+// screen edges
+static void draw_text(void) {
+	static mcugdx_font_t *font = NULL;
+	static mcugdx_font_t *font_aa = NULL;
+	if (!font) {
+		font = create_digit_font(false);
+		font_aa = create_digit_font(true);
+	}
+
+	draw_background();
+	mcugdx_display_text(font, "0123456789", 10, 10, MCUGDX_WHITE);
+	mcugdx_display_text(font_aa, "0123456789", 10, 30, MCUGDX_WHITE);
+	mcugdx_display_text(font, "12:34\n111 :1", 100, 60, rgb32_to_rgb16(0xe04030));
+	mcugdx_display_text(font_aa, "12:34\n111 :1", 180, 60, rgb32_to_rgb16(0x203040));
+	mcugdx_display_text(font_aa, "987654321", -20, 232, rgb32_to_rgb16(0x3050f0));
+	mcugdx_display_text(font, "987654321", 290, -6, rgb32_to_rgb16(0x40e060));
+}
+
+// A panel with its own clip rect and origin, drawn over the scene like a HUD.
+// Everything inside it is clipped to the panel, nested clips included.
+static void draw_clip(void) {
+	static mcugdx_font_t *font = NULL;
+	if (!font) font = create_digit_font(true);
+
+	draw_background();
+	mcugdx_display_push_clip(40, 30, 200, 120);
+	mcugdx_display_translate(40, 30);
+	mcugdx_display_clear_color(rgb32_to_rgb16(0x303848));
+	mcugdx_display_blit_keyed(hill, -60, 70, 0);
+	mcugdx_display_fill_circle(190, 10, 30, rgb32_to_rgb16(0xe0c040));
+	mcugdx_display_line_aa(-20, 130, 220, -10, MCUGDX_WHITE);
+	mcugdx_display_text(font, "0123456789:0123", 5, -4, MCUGDX_WHITE);
+
+	mcugdx_display_push_clip(100, 60, 80, 40);
+	mcugdx_display_translate(100, 60);
+	mcugdx_display_clear_color(rgb32_to_rgb16(0x804040));
+	mcugdx_display_blit_region_keyed(dino_run, -10, -5, 0, 0, dino_run->width / 4, dino_run->height, 0);
+	mcugdx_display_text(font, "12:34", 30, 25, rgb32_to_rgb16(0xf0f0a0));
+	mcugdx_display_pop_clip();
+
+	mcugdx_display_rect(100, 110, 30, 30, rgb32_to_rgb16(0x40e060));
+	mcugdx_display_pop_clip();
+	mcugdx_display_rect(230, 140, 30, 30, rgb32_to_rgb16(0x40e060));
+}
+
+// Each filter on its own region of the scene, with sprites drawn over filtered
+// pixels, and a faint red flash over the whole screen at the end
+static void draw_filters(void) {
+	draw_background();
+	mcugdx_display_filter(0, 0, 80, 240, MCUGDX_FILTER_GRAYSCALE, 0, 255);
+	mcugdx_display_filter(80, 0, 80, 240, MCUGDX_FILTER_GRAYSCALE, 0, 128);
+	mcugdx_display_filter(160, 0, 160, 120, MCUGDX_FILTER_FADE, 0, 160);
+	mcugdx_display_filter(160, 120, 160, 120, MCUGDX_FILTER_BRIGHTNESS, 0, 220);
+	mcugdx_display_filter(120, 60, 120, 120, MCUGDX_FILTER_TINT, rgb32_to_rgb16(0x3050f0), 200);
+	mcugdx_display_blit_keyed(dino_run, 150, 100, 0);
+	mcugdx_display_filter(140, 90, 30, 30, MCUGDX_FILTER_BRIGHTNESS, 0, 60);
+	mcugdx_display_filter(-10, -10, 340, 260, MCUGDX_FILTER_FADE, rgb32_to_rgb16(0xff0000), 40);
+}
+
+static scene_t scenes[] = {
+		{"primitives", draw_primitives, false, false, 0xe93d7f494e7ec013ull},
+		{"shapes", draw_shapes, false, false, 0xf62c6fea9f651488ull},
+		{"shapes_list", draw_shapes, true, false, 0xf62c6fea9f651488ull},
+		{"background", draw_background, false, false, 0xfb377414d3fb9f11ull},
+		{"target", draw_target, false, false, 0xfb377414d3fb9f11ull},
+		{"target_list", draw_target, true, false, 0xfb377414d3fb9f11ull},
+		{"sprites", draw_sprites, false, false, 0x4a614a8b7d8ae270ull},
+		{"sprites_list", draw_sprites, true, false, 0x4a614a8b7d8ae270ull},
+		{"sprites_batch", draw_sprites_batch, false, false, 0x4a614a8b7d8ae270ull},
+		{"sprites_batch_list", draw_sprites_batch, true, false, 0x4a614a8b7d8ae270ull},
+		{"clipped", draw_clipped, false, false, 0x5f0a3748381ca5d6ull},
+		{"clipped_list", draw_clipped, true, false, 0x5f0a3748381ca5d6ull},
+		// Converting the images to sprites must not change the output
+		{"sprites_spans", draw_sprites, false, true, 0x4a614a8b7d8ae270ull},
+		{"clipped_spans", draw_clipped, false, true, 0x5f0a3748381ca5d6ull},
+		{"transforms", draw_transforms, false, false, 0xdb44446693583c2full},
+		{"transforms_list", draw_transforms, true, false, 0xdb44446693583c2full},
+		{"tilemaps", draw_tilemaps, false, true, 0x4a77814687f13294ull},
+		{"tilemaps_list", draw_tilemaps, true, true, 0x4a77814687f13294ull},
+		{"text", draw_text, false, false, 0xc43e8da21372470full},
+		{"text_list", draw_text, true, false, 0xc43e8da21372470full},
+		{"blend", draw_blend, false, true, 0x6029d4c9e1923782ull},
+		{"blend_list", draw_blend, true, true, 0x6029d4c9e1923782ull},
+		{"indexed", draw_indexed, false, false, 0xe9c700ae7950ca8bull},
+		{"indexed_list", draw_indexed, true, false, 0xe9c700ae7950ca8bull},
+		{"clip", draw_clip, false, false, 0x57598b560f6f7a45ull},
+		{"clip_list", draw_clip, true, false, 0x57598b560f6f7a45ull},
+		{"filters", draw_filters, false, false, 0xa2f6851a42522073ull},
+		{"filters_list", draw_filters, true, false, 0xa2f6851a42522073ull},
+};
+
+int mcugdx_main() {
+	mcugdx_init();
+	mcugdx_rofs_init();
+
+	mcugdx_display_config_t display_config = {
+			.driver = MCUGDX_ST7789,
+			.native_width = 240,
+			.native_height = 320,
+			.mosi = 3,
+			.sck = 4,
+			.dc = 2,
+			.cs = 1,
+			.reset = -1};
+	mcugdx_display_init(&display_config);
+	mcugdx_display_set_orientation(MCUGDX_LANDSCAPE);
+
+	cactus = mcugdx_image_load("cactus.qoi", &mcugdx_rofs, MCUGDX_MEM_INTERNAL);
+	cloud = mcugdx_image_load("cloud.qoi", &mcugdx_rofs, MCUGDX_MEM_INTERNAL);
+	dino_run = mcugdx_image_load("dino-run.qoi", &mcugdx_rofs, MCUGDX_MEM_INTERNAL);
+	ground = mcugdx_image_load("ground.qoi", &mcugdx_rofs, MCUGDX_MEM_INTERNAL);
+	hill = mcugdx_image_load("hill.qoi", &mcugdx_rofs, MCUGDX_MEM_INTERNAL);
+	pterodactylus = mcugdx_image_load("pterodactylus.qoi", &mcugdx_rofs, MCUGDX_MEM_EXTERNAL);
+	if (!cactus || !cloud || !dino_run || !ground || !hill || !pterodactylus) {
+		mcugdx_loge(TAG, "Could not load images");
+		return 1;
+	}
+
+	uint32_t num_scenes = sizeof(scenes) / sizeof(scenes[0]);
+	uint32_t num_failed = 0;
+	for (uint32_t i = 0; i < num_scenes; i++) {
+		scene_t *scene = &scenes[i];
+		if (scene->as_sprites && !cactus->spans) {
+			mcugdx_image_t *images[] = {cactus, cloud, dino_run, hill, pterodactylus};
+			for (uint32_t j = 0; j < sizeof(images) / sizeof(images[0]); j++) mcugdx_image_make_sprite(images[j], 0);
+		}
+		if (scene->as_list) mcugdx_display_begin_list();
+		scene->draw();
+		if (scene->as_list) mcugdx_display_end_list();
+
+		uint64_t hash = mcugdx_display_hash();
+		if (hash == scene->expected_hash) {
+			mcugdx_log(TAG, "%s: ok", scene->name);
+		} else {
+			num_failed++;
+			mcugdx_loge(TAG, "%s: expected 0x%016llx, got 0x%016llx", scene->name, (unsigned long long) scene->expected_hash, (unsigned long long) hash);
+#ifndef ESP_PLATFORM
+			char path[64];
+			snprintf(path, sizeof(path), "%s.qoi", scene->name);
+			mcugdx_image_t *frame = mcugdx_display_capture(MCUGDX_MEM_EXTERNAL);
+			if (frame) {
+				mcugdx_image_write_qoi(frame, path);
+				mcugdx_image_unload(frame);
+			}
+#endif
+		}
+		mcugdx_display_show();
+	}
+
+	mcugdx_log(TAG, "%li of %li scenes match", num_scenes - num_failed, num_scenes);
+	return num_failed > 0 ? 1 : 0;
+}
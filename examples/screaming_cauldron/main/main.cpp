@@ -96,10 +96,18 @@ void scream_lights(float factor) {
 	int scream_min_red = 150;
 	int scream_max_red = 255;
 
+	// Let the spectrum of the playing scream drive the wave, fall back to the timer if there's none yet
+	mcugdx_audio_analysis_t analysis;
+	bool has_analysis = mcugdx_audio_analysis_get(&analysis) && analysis.num_bands > 0;
+
 	for (int i = 0; i < NUM_LEDS; i++) {
 		float position = (float) i / NUM_LEDS;
 		float wave = sinf(current_time * scream_wave_speed * 2 * M_PI + position * 10 + current_time * scream_move_speed);
 		wave = (wave + 1.0f) * 0.5f;
+		if (has_analysis) {
+			float band = analysis.bands[i * analysis.num_bands / NUM_LEDS] / 8192.0f;
+			wave = wave * 0.3f + (band > 1.0f ? 1.0f : band) * 0.7f;
+		}
 
 		int red_value = (int) (wave * (scream_max_red - scream_min_red) + scream_min_red);
 		if (red_value > 255) red_value = 255;
@@ -196,6 +204,10 @@ extern "C" int mcugdx_main() {
 			.dout = 11};
 	mcugdx_audio_init(&audio_config);
 	mcugdx_audio_set_master_volume(config.volume);
+	mcugdx_audio_analysis_config_t analysis_config = {
+			.fft_size = 256,
+			.num_bands = 8};
+	mcugdx_audio_analysis_enable(&analysis_config);
 
 	mcugdx_sound_t *sounds[100];
 	size_t num_sounds = 0;
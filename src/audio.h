@@ -19,6 +19,9 @@ typedef struct {
 	int bclk;
 	int ws;
 	int dout;
+	// Sets up the mixer without starting the output device. The app has to call
+	// mcugdx_audio_mix() itself, e.g. to benchmark the mixer.
+	bool no_output;
 } mcugdx_audio_config_t;
 
 typedef enum {
@@ -40,12 +43,79 @@ typedef enum {
 
 typedef uint32_t mcugdx_sound_id_t;
 
+// Interface for sounds whose frames are synthesized at playback time. Each
+// voice gets its own state via init, which may be NULL to share user_data
+// across all voices. generate() is called from the mixer with the current
+// output block and must add its frames into it with the given gains applied,
+// see mcugdx_audio_mix_frame(). Returning 0 ends the voice (single shot) or
+// triggers reset() (loop). A looping voice that returns 0 again right after
+// reset() is ended like a single shot one. reset and free may be NULL. The callbacks run with
+// the audio lock held and must not call mcugdx_sound_* functions. With mix
+// workers enabled, generate() and reset() of different voices may run
+// concurrently on different cores. destroy, if set, is called with user_data
+// when the sound is unloaded.
+typedef struct {
+	bool (*init)(void *user_data, void **voice_state);
+	uint32_t (*generate)(void *voice_state, int32_t *output, uint32_t num_frames,
+						 mcugdx_audio_channels_t channels, int32_t pan_left_gain,
+						 int32_t pan_right_gain, int32_t final_gain);
+	void (*reset)(void *voice_state);
+	void (*free)(void *voice_state);
+	void (*destroy)(void *user_data);
+} mcugdx_audio_generator_t;
+
+static inline int32_t *mcugdx_audio_mix_frame(int32_t *output, mcugdx_audio_channels_t channels, int32_t left_sample, int32_t right_sample, int32_t pan_left_gain, int32_t pan_right_gain, int32_t final_gain) {
+	left_sample = ((left_sample * pan_left_gain) >> 8) * final_gain >> 8;
+	right_sample = ((right_sample * pan_right_gain) >> 8) * final_gain >> 8;
+
+	if (channels == MCUGDX_MONO) {
+		output[0] += (left_sample + right_sample) >> 1;
+		return output + 1;
+	} else {
+		output[0] += left_sample;
+		output[1] += right_sample;
+		return output + 2;
+	}
+}
+
+#define MCUGDX_AUDIO_ANALYSIS_MAX_BANDS 16
+
+typedef struct {
+	uint32_t fft_size; // power of two between 64 and 1024
+	uint32_t num_bands;// logarithmically spaced, up to MCUGDX_AUDIO_ANALYSIS_MAX_BANDS, 0 disables the FFT
+} mcugdx_audio_analysis_config_t;
+
+// Levels of the final mix, updated by the mixer after every mixed block.
+// Levels and bands are in the range 0-32767, index 0 of rms and peak is the
+// left channel, index 1 the right channel. Mono output sets both.
+typedef struct {
+	uint32_t sequence;
+	uint16_t rms[2];
+	uint16_t peak[2];
+	uint32_t num_bands;
+	uint16_t bands[MCUGDX_AUDIO_ANALYSIS_MAX_BANDS];
+} mcugdx_audio_analysis_t;
+
 bool mcugdx_audio_init(mcugdx_audio_config_t *config);
 
 void mcugdx_audio_mix(int32_t *frames, uint32_t num_frames, mcugdx_audio_channels_t channels);
 
+// Spreads the active voices over num_workers additional threads, each mixing
+// into a private accumulator that is summed before limiting. 0 (the default)
+// mixes everything on the audio thread. The ESP32-S3 has two cores, so 1 is
+// the only useful value there.
+bool mcugdx_audio_set_mix_workers(uint32_t num_workers);
+
+uint32_t mcugdx_audio_get_mix_workers(void);
+
 void mcugdx_audio_set_master_volume(uint8_t volume);
 
+bool mcugdx_audio_analysis_enable(mcugdx_audio_analysis_config_t *config);
+
+void mcugdx_audio_analysis_disable(void);
+
+bool mcugdx_audio_analysis_get(mcugdx_audio_analysis_t *analysis);
+
 uint8_t mcugdx_audio_get_master_volume(void);
 
 uint32_t mcugdx_audio_get_sample_rate(void);
@@ -54,11 +124,17 @@ mcugdx_sound_t *mcugdx_sound_load(const char *path, mcugdx_file_system_t *fs,
 								  mcugdx_sound_type_t sound_type,
 								  mcugdx_memory_type_t mem_type);
 
+// Takes ownership of frames, which must be allocated via mcugdx_mem_alloc() and
+// hold at least one frame.
 mcugdx_sound_t *mcugdx_sound_load_raw(int16_t *frames, uint32_t num_frames,
 									  mcugdx_audio_channels_t channels,
 									  uint32_t sample_rate,
 									  mcugdx_memory_type_t mem_type);
 
+mcugdx_sound_t *mcugdx_sound_create_generator(const mcugdx_audio_generator_t *generator, void *user_data,
+											  mcugdx_audio_channels_t channels,
+											  mcugdx_memory_type_t mem_type);
+
 void mcugdx_sound_unload(mcugdx_sound_t *sound);
 
 double mcugdx_sound_duration(mcugdx_sound_t *sound);
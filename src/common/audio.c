@@ -1,4 +1,5 @@
 #include "audio.h"
+#include "audio_workers.h"
 #include "log.h"
 #include "mutex.h"
 #define QOA_IMPLEMENTATION
@@ -35,6 +36,8 @@ typedef struct mcugdx_sound_internal_t {
 	const mcugdx_audio_decoder_t *decoder;
 	mcugdx_file_system_t *fs;
 	const char *path;
+	const mcugdx_audio_generator_t *generator;
+	void *generator_data;
 } mcugdx_sound_internal_t;
 
 typedef struct mcugdx_audio_renderer_t mcugdx_audio_renderer_t;
@@ -67,20 +70,6 @@ typedef struct {
     uint32_t channels;                // Cache the channel count
 } mp3_decoder_state_t;
 
-static inline int32_t *mix_frames(int32_t *output, int32_t channels, int32_t left_sample, int32_t right_sample, int32_t pan_left_gain, int32_t pan_right_gain, int32_t final_gain) {
-	left_sample = ((left_sample * pan_left_gain) >> 8) * final_gain >> 8;
-	right_sample = ((right_sample * pan_right_gain) >> 8) * final_gain >> 8;
-
-	if (channels == MCUGDX_MONO) {
-		output[0] += (left_sample + right_sample) >> 1;
-		return output + 1;
-	} else {
-		output[0] += left_sample;
-		output[1] += right_sample;
-		return output + 2;
-	}
-}
-
 static bool qoa_init(mcugdx_file_handle_t file, mcugdx_file_system_t *fs,
                     uint32_t *sample_rate, uint32_t *channels, uint32_t *total_frames,
                     void **decoder_state) {
@@ -176,7 +165,7 @@ static uint32_t qoa_decode_frames(void *decoder_state, int32_t *output, uint32_t
         for (uint32_t i = 0; i < frames_to_copy; i++) {
             int32_t left_sample = src[i * channels];
             int32_t right_sample = channels == 1 ? left_sample : src[i * channels + 1];
-            dst = mix_frames(dst, out_channels, left_sample, right_sample,
+            dst = mcugdx_audio_mix_frame(dst, out_channels, left_sample, right_sample,
                            pan_left_gain, pan_right_gain, final_gain);
         }
 
@@ -300,7 +289,7 @@ static uint32_t mp3_decode_frames(void *decoder_state, int32_t *output, uint32_t
         for (uint32_t i = 0; i < frames_to_copy; i++) {
             int32_t left_sample = src[i * state->channels];
             int32_t right_sample = state->channels == 1 ? left_sample : src[i * state->channels + 1];
-            dst = mix_frames(dst, out_channels, left_sample, right_sample,
+            dst = mcugdx_audio_mix_frame(dst, out_channels, left_sample, right_sample,
                            pan_left_gain, pan_right_gain, final_gain);
         }
 
@@ -337,6 +326,111 @@ static void mp3_free(void *decoder_state) {
     }
 }
 
+typedef struct {
+    const mcugdx_audio_generator_t *generator;
+    void *voice_state;
+} generator_decoder_state_t;
+
+// Generator sounds have no file, so they are created via generator_create()
+// instead of init(), but share the rest of the decoder interface.
+static void *generator_create(mcugdx_sound_internal_t *internal) {
+    generator_decoder_state_t *state = mcugdx_mem_alloc(sizeof(generator_decoder_state_t), MCUGDX_MEM_INTERNAL);
+    if (!state) return NULL;
+
+    state->generator = internal->generator;
+    state->voice_state = internal->generator_data;
+    if (state->generator->init && !state->generator->init(internal->generator_data, &state->voice_state)) {
+        mcugdx_mem_free(state);
+        return NULL;
+    }
+    return state;
+}
+
+static uint32_t generator_decode_frames(void *decoder_state, int32_t *output, uint32_t num_frames,
+                                       mcugdx_audio_channels_t out_channels, int32_t pan_left_gain,
+                                       int32_t pan_right_gain, int32_t final_gain) {
+    generator_decoder_state_t *state = (generator_decoder_state_t *)decoder_state;
+    return state->generator->generate(state->voice_state, output, num_frames, out_channels,
+                                      pan_left_gain, pan_right_gain, final_gain);
+}
+
+static void generator_reset(void *decoder_state) {
+    generator_decoder_state_t *state = (generator_decoder_state_t *)decoder_state;
+    if (state->generator->reset) state->generator->reset(state->voice_state);
+}
+
+static void generator_free(void *decoder_state) {
+    generator_decoder_state_t *state = (generator_decoder_state_t *)decoder_state;
+    if (state) {
+        if (state->generator->free) state->generator->free(state->voice_state);
+        mcugdx_mem_free(state);
+    }
+}
+
+typedef struct {
+    int16_t *frames;
+    uint32_t num_frames;
+    uint32_t channels;
+} raw_sound_data_t;
+
+typedef struct {
+    raw_sound_data_t *data;
+    uint32_t position;
+} raw_voice_state_t;
+
+static bool raw_init(void *user_data, void **voice_state) {
+    raw_voice_state_t *state = mcugdx_mem_alloc(sizeof(raw_voice_state_t), MCUGDX_MEM_INTERNAL);
+    if (!state) return false;
+    state->data = (raw_sound_data_t *)user_data;
+    state->position = 0;
+    *voice_state = state;
+    return true;
+}
+
+static uint32_t raw_generate(void *voice_state, int32_t *output, uint32_t num_frames,
+                             mcugdx_audio_channels_t out_channels, int32_t pan_left_gain,
+                             int32_t pan_right_gain, int32_t final_gain) {
+    raw_voice_state_t *state = (raw_voice_state_t *)voice_state;
+    uint32_t channels = state->data->channels;
+    uint32_t frames_to_copy = state->data->num_frames - state->position;
+    if (frames_to_copy > num_frames) {
+        frames_to_copy = num_frames;
+    }
+
+    int16_t *src = state->data->frames + state->position * channels;
+    for (uint32_t i = 0; i < frames_to_copy; i++) {
+        int32_t left_sample = src[i * channels];
+        int32_t right_sample = channels == 1 ? left_sample : src[i * channels + 1];
+        output = mcugdx_audio_mix_frame(output, out_channels, left_sample, right_sample,
+                                        pan_left_gain, pan_right_gain, final_gain);
+    }
+
+    state->position += frames_to_copy;
+    return frames_to_copy;
+}
+
+static void raw_reset(void *voice_state) {
+    ((raw_voice_state_t *)voice_state)->position = 0;
+}
+
+static void raw_free(void *voice_state) {
+    mcugdx_mem_free(voice_state);
+}
+
+static void raw_destroy(void *user_data) {
+    raw_sound_data_t *data = (raw_sound_data_t *)user_data;
+    mcugdx_mem_free(data->frames);
+    mcugdx_mem_free(data);
+}
+
+static const mcugdx_audio_generator_t raw_generator = {
+    .init = raw_init,
+    .generate = raw_generate,
+    .reset = raw_reset,
+    .free = raw_free,
+    .destroy = raw_destroy
+};
+
 struct mcugdx_audio_renderer_t {
 	void *renderer_data;
 	uint32_t (*render)(mcugdx_audio_renderer_t *renderer, int32_t *output, uint32_t num_frames, mcugdx_audio_channels_t channels, int32_t pan_left_gain, int32_t pan_right_gain, int32_t final_gain);
@@ -358,6 +452,13 @@ static const mcugdx_audio_decoder_t mp3_decoder = {
     .free = mp3_free
 };
 
+static const mcugdx_audio_decoder_t generator_decoder = {
+    .init = NULL,
+    .decode_frames = generator_decode_frames,
+    .reset = generator_reset,
+    .free = generator_free
+};
+
 typedef struct {
     mcugdx_sound_internal_t *sound;
     void *decoder_state;              // Format-specific decoder state
@@ -365,12 +466,27 @@ typedef struct {
     uint8_t pan;
     mcugdx_playback_mode_t mode;
     uint32_t id;
+    bool finished;
 } mcugdx_sound_instance_t;
 
+typedef struct {
+	uint8_t instances[MAX_SOUND_INSTANCES];
+	uint32_t num_instances;
+	int32_t *output;
+} mix_partition_t;
+
 static mcugdx_sound_instance_t sound_instances[MAX_SOUND_INSTANCES] = {0};
 static uint32_t next_id = 0;
 static uint8_t master_volume = 255;
 extern mcugdx_mutex_t audio_lock;
+extern void mcugdx_audio_analysis_process(int16_t *frames, uint32_t num_frames, mcugdx_audio_channels_t channels);
+
+static mix_partition_t mix_partitions[MCUGDX_AUDIO_MAX_MIX_WORKERS + 1];
+static int32_t *accumulators[MCUGDX_AUDIO_MAX_MIX_WORKERS] = {0};
+static uint32_t accumulator_size = 0;
+static uint32_t num_mix_workers = 0;
+static uint32_t mix_num_frames;
+static mcugdx_audio_channels_t mix_channels;
 
 mcugdx_sound_t *mcugdx_sound_load(const char *path, mcugdx_file_system_t *fs,
 								  mcugdx_sound_type_t sound_type, mcugdx_memory_type_t mem_type) {
@@ -415,6 +531,8 @@ mcugdx_sound_t *mcugdx_sound_load(const char *path, mcugdx_file_system_t *fs,
 	// Store data needed for future decoder creation
 	internal->fs = fs;
 	internal->path = mcugdx_mem_strdup(path, mem_type);
+	internal->generator = NULL;
+	internal->generator_data = NULL;
 	internal->sound.type = sound_type;
 
 	// Clean up temporary decoder state
@@ -423,6 +541,62 @@ mcugdx_sound_t *mcugdx_sound_load(const char *path, mcugdx_file_system_t *fs,
 	return &internal->sound;
 }
 
+mcugdx_sound_t *mcugdx_sound_create_generator(const mcugdx_audio_generator_t *generator, void *user_data,
+											  mcugdx_audio_channels_t channels,
+											  mcugdx_memory_type_t mem_type) {
+	if (!generator || !generator->generate) {
+		mcugdx_loge(TAG, "Invalid parameters");
+		return NULL;
+	}
+
+	mcugdx_sound_internal_t *internal = mcugdx_mem_alloc(sizeof(mcugdx_sound_internal_t), mem_type);
+	if (!internal) {
+		mcugdx_loge(TAG, "Failed to allocate sound internal structure");
+		return NULL;
+	}
+
+	internal->decoder = &generator_decoder;
+	internal->fs = NULL;
+	internal->path = NULL;
+	internal->generator = generator;
+	internal->generator_data = user_data;
+	internal->sound.type = MCUGDX_STREAMED;
+	internal->sound.sample_rate = mcugdx_audio_get_sample_rate();
+	internal->sound.channels = channels;
+	internal->sound.num_frames = 0;
+
+	return &internal->sound;
+}
+
+mcugdx_sound_t *mcugdx_sound_load_raw(int16_t *frames, uint32_t num_frames,
+									  mcugdx_audio_channels_t channels,
+									  uint32_t sample_rate,
+									  mcugdx_memory_type_t mem_type) {
+	if (!frames || num_frames == 0) {
+		mcugdx_loge(TAG, "Invalid parameters");
+		return NULL;
+	}
+
+	raw_sound_data_t *data = mcugdx_mem_alloc(sizeof(raw_sound_data_t), mem_type);
+	if (!data) {
+		mcugdx_loge(TAG, "Failed to allocate raw sound data");
+		return NULL;
+	}
+	data->frames = frames;
+	data->num_frames = num_frames;
+	data->channels = channels;
+
+	mcugdx_sound_t *sound = mcugdx_sound_create_generator(&raw_generator, data, channels, mem_type);
+	if (!sound) {
+		mcugdx_mem_free(data);
+		return NULL;
+	}
+	sound->type = MCUGDX_PRELOADED;
+	sound->sample_rate = sample_rate;
+	sound->num_frames = num_frames;
+	return sound;
+}
+
 void mcugdx_sound_unload(mcugdx_sound_t *sound) {
 	if (!sound) return;
 
@@ -445,6 +619,11 @@ void mcugdx_sound_unload(mcugdx_sound_t *sound) {
 		mcugdx_mem_free((void *)internal->path);
 	}
 
+	// Let generators release data shared by all their voices
+	if (internal->generator && internal->generator->destroy) {
+		internal->generator->destroy(internal->generator_data);
+	}
+
 	// Free the internal structure itself
 	mcugdx_mem_free(internal);
 }
@@ -486,20 +665,28 @@ mcugdx_sound_id_t mcugdx_sound_play(mcugdx_sound_t *sound, uint8_t volume, uint8
 
 	mcugdx_sound_internal_t *internal = (mcugdx_sound_internal_t *)sound;
 
-	// Create new file handle and decoder state for this instance
-	mcugdx_file_handle_t file = internal->fs->open(internal->path);
-	if (!file) {
-		mcugdx_mutex_unlock(&audio_lock);
-		return -1;
-	}
-
 	void *decoder_state;
-	uint32_t dummy_rate, dummy_channels, dummy_frames;
-	if (!internal->decoder->init(file, internal->fs, &dummy_rate, &dummy_channels,
-								&dummy_frames, &decoder_state)) {
-		internal->fs->close(file);
-		mcugdx_mutex_unlock(&audio_lock);
-		return -1;
+	if (internal->generator) {
+		decoder_state = generator_create(internal);
+		if (!decoder_state) {
+			mcugdx_mutex_unlock(&audio_lock);
+			return -1;
+		}
+	} else {
+		// Create new file handle and decoder state for this instance
+		mcugdx_file_handle_t file = internal->fs->open(internal->path);
+		if (!file) {
+			mcugdx_mutex_unlock(&audio_lock);
+			return -1;
+		}
+
+		uint32_t dummy_rate, dummy_channels, dummy_frames;
+		if (!internal->decoder->init(file, internal->fs, &dummy_rate, &dummy_channels,
+									&dummy_frames, &decoder_state)) {
+			internal->fs->close(file);
+			mcugdx_mutex_unlock(&audio_lock);
+			return -1;
+		}
 	}
 
 	instance->sound = internal;
@@ -565,52 +752,142 @@ static void calculate_pan_gains(uint8_t pan, int32_t *gain_left, int32_t *gain_r
 	*gain_right = (uint8_t) (255 * (1.0f + normalized_pan) / 2);
 }
 
+// Mixes a single instance into the buffer. Instances that run out of frames
+// are only marked as finished, the audio thread cleans them up after all
+// workers are done, as freeing decoders isn't safe to do concurrently.
+static void mix_instance(mcugdx_sound_instance_t *instance, int32_t *frames, uint32_t num_frames, mcugdx_audio_channels_t channels) {
+	int32_t pan_left_gain, pan_right_gain;
+	calculate_pan_gains(instance->pan, &pan_left_gain, &pan_right_gain);
+	int32_t final_gain = instance->volume;
+
+	uint32_t frames_remaining = num_frames;
+	uint32_t buffer_offset = 0;
+	bool just_reset = false;
+
+	while (frames_remaining > 0) {
+		uint32_t frames_decoded = instance->sound->decoder->decode_frames(
+			instance->decoder_state,
+			frames + (buffer_offset * channels),
+			frames_remaining,
+			channels,
+			pan_left_gain,
+			pan_right_gain,
+			final_gain
+		);
+
+		if (frames_decoded == 0) {
+			// A voice without frames right after a reset would loop forever
+			if (instance->mode == MCUGDX_LOOP && !just_reset) {
+				instance->sound->decoder->reset(instance->decoder_state);
+				just_reset = true;
+				continue;
+			} else {
+				instance->finished = true;
+				break;
+			}
+		}
+
+		frames_remaining -= frames_decoded;
+		buffer_offset += frames_decoded;
+		just_reset = false;
+	}
+}
+
+static void mix_partition(uint32_t index) {
+	mix_partition_t *partition = &mix_partitions[index];
+	for (uint32_t i = 0; i < partition->num_instances; i++) {
+		mix_instance(&sound_instances[partition->instances[i]], partition->output, mix_num_frames, mix_channels);
+	}
+}
+
+bool mcugdx_audio_set_mix_workers(uint32_t num_workers) {
+	if (num_workers > MCUGDX_AUDIO_MAX_MIX_WORKERS) {
+		mcugdx_loge(TAG, "At most %i mix workers are supported", MCUGDX_AUDIO_MAX_MIX_WORKERS);
+		return false;
+	}
+
+	mcugdx_mutex_lock(&audio_lock);
+	bool result = mcugdx_audio_workers_start(num_workers, mix_partition);
+	num_mix_workers = result ? num_workers : 0;
+	for (uint32_t i = 0; i < MCUGDX_AUDIO_MAX_MIX_WORKERS; i++) {
+		mcugdx_mem_free(accumulators[i]);
+		accumulators[i] = NULL;
+	}
+	accumulator_size = 0;
+	mcugdx_mutex_unlock(&audio_lock);
+	return result;
+}
+
+uint32_t mcugdx_audio_get_mix_workers(void) {
+	return num_mix_workers;
+}
+
+static bool ensure_accumulators(uint32_t num_samples) {
+	if (num_samples <= accumulator_size) return true;
+	for (uint32_t i = 0; i < num_mix_workers; i++) {
+		mcugdx_mem_free(accumulators[i]);
+		accumulators[i] = mcugdx_mem_alloc(num_samples * sizeof(int32_t), MCUGDX_MEM_INTERNAL);
+		if (!accumulators[i]) {
+			mcugdx_loge(TAG, "Failed to allocate mix accumulators, mixing on a single core");
+			accumulator_size = 0;
+			return false;
+		}
+	}
+	accumulator_size = num_samples;
+	return true;
+}
+
 void mcugdx_audio_mix(int32_t *frames, uint32_t num_frames, mcugdx_audio_channels_t channels) {
-	memset(frames, 0, num_frames * channels * sizeof(int32_t));
+	uint32_t num_samples = num_frames * channels;
+	memset(frames, 0, num_samples * sizeof(int32_t));
 
 	mcugdx_mutex_lock(&audio_lock);
 
-	double start =  mcugdx_time();
-	for (int i = 0; i < MAX_SOUND_INSTANCES; i++) {
-		mcugdx_sound_instance_t *instance = &sound_instances[i];
-		if (!instance->sound) continue;
-
-		int32_t pan_left_gain, pan_right_gain;
-		calculate_pan_gains(instance->pan, &pan_left_gain, &pan_right_gain);
-		int32_t final_gain = instance->volume;
-
-		uint32_t frames_remaining = num_frames;
-		uint32_t buffer_offset = 0;
-
-		while (frames_remaining > 0) {
-			uint32_t frames_decoded = instance->sound->decoder->decode_frames(
-				instance->decoder_state,
-				frames + (buffer_offset * channels),
-				frames_remaining,
-				channels,
-				pan_left_gain,
-				pan_right_gain,
-				final_gain
-			);
-
-			if (frames_decoded == 0) {
-				if (instance->mode == MCUGDX_LOOP) {
-					instance->sound->decoder->reset(instance->decoder_state);
-					continue;
-				} else {
-					// Clean up instance
-					instance->sound->decoder->free(instance->decoder_state);
-					instance->decoder_state = NULL;
-					instance->sound = NULL;
-					break;
-				}
-			}
+	uint32_t num_partitions = 1;
+	if (num_mix_workers > 0 && ensure_accumulators(num_samples)) num_partitions = num_mix_workers + 1;
+
+	// Spread the active instances round robin. Partition 0 mixes straight
+	// into the output, each worker mixes into its own accumulator.
+	for (uint32_t i = 0; i < num_partitions; i++) {
+		mix_partitions[i].num_instances = 0;
+		mix_partitions[i].output = i == 0 ? frames : accumulators[i - 1];
+	}
+	uint32_t num_active = 0;
+	for (uint32_t i = 0; i < MAX_SOUND_INSTANCES; i++) {
+		if (!sound_instances[i].sound) continue;
+		mix_partition_t *partition = &mix_partitions[num_active++ % num_partitions];
+		partition->instances[partition->num_instances++] = (uint8_t) i;
+	}
+	mix_num_frames = num_frames;
+	mix_channels = channels;
 
-			frames_remaining -= frames_decoded;
-			buffer_offset += frames_decoded;
+	if (num_partitions > 1 && num_active > 1) {
+		for (uint32_t i = 1; i < num_partitions; i++) {
+			if (mix_partitions[i].num_instances > 0) memset(mix_partitions[i].output, 0, num_samples * sizeof(int32_t));
+		}
+		mcugdx_audio_workers_dispatch();
+		mix_partition(0);
+		mcugdx_audio_workers_wait();
+		for (uint32_t i = 1; i < num_partitions; i++) {
+			if (mix_partitions[i].num_instances == 0) continue;
+			int32_t *accumulator = mix_partitions[i].output;
+			for (uint32_t j = 0; j < num_samples; j++) frames[j] += accumulator[j];
+		}
+	} else {
+		for (uint32_t i = 0; i < MAX_SOUND_INSTANCES; i++) {
+			if (sound_instances[i].sound) mix_instance(&sound_instances[i], frames, num_frames, channels);
 		}
 	}
 
+	for (uint32_t i = 0; i < MAX_SOUND_INSTANCES; i++) {
+		mcugdx_sound_instance_t *instance = &sound_instances[i];
+		if (!instance->finished) continue;
+		instance->sound->decoder->free(instance->decoder_state);
+		instance->decoder_state = NULL;
+		instance->sound = NULL;
+		instance->finished = false;
+	}
+
 	mcugdx_mutex_unlock(&audio_lock);
 
 	int32_t max_amplitude = 0;
@@ -648,6 +925,8 @@ void mcugdx_audio_mix(int32_t *frames, uint32_t num_frames, mcugdx_audio_channel
 
 		output[i] = (int16_t) sample;
 	}
+
+	mcugdx_audio_analysis_process(output, num_frames, channels);
 }
 
 void mcugdx_audio_set_master_volume(uint8_t volume) {
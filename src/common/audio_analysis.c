@@ -0,0 +1,245 @@
+#include "audio.h"
+#include "log.h"
+#include "mem.h"
+#include "mutex.h"
+#include <math.h>
+#include <string.h>
+
+#define TAG "mcugdx_audio_analysis"
+#define PI 3.14159265358979323846f
+#define MIN_FFT_SIZE 64
+#define MAX_FFT_SIZE 1024
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#define memory_barrier() MemoryBarrier()
+#elif defined(__GNUC__) || defined(__clang__)
+#define memory_barrier() __sync_synchronize()
+#else
+#error "Unsupported compiler"
+#endif
+
+typedef struct {
+	uint32_t fft_size;
+	uint32_t fft_bits;
+	uint32_t num_bands;
+	uint32_t band_edges[MCUGDX_AUDIO_ANALYSIS_MAX_BANDS + 1];
+	int16_t *window;
+	int16_t *cos_table;
+	int16_t *sin_table;
+	int16_t *input;
+	uint32_t input_pos;
+	int16_t *re;
+	int16_t *im;
+	uint16_t bands[MCUGDX_AUDIO_ANALYSIS_MAX_BANDS];
+} analysis_state_t;
+
+extern mcugdx_mutex_t audio_lock;
+static analysis_state_t *analysis = NULL;
+
+// Written by the audio thread only. Readers copy the snapshot and retry if
+// the sequence was odd (write in progress) or changed during the copy.
+static volatile uint32_t snapshot_sequence = 0;
+static mcugdx_audio_analysis_t snapshot;
+
+static void analysis_free(analysis_state_t *state) {
+	if (!state) return;
+	mcugdx_mem_free(state->window);
+	mcugdx_mem_free(state->cos_table);
+	mcugdx_mem_free(state->sin_table);
+	mcugdx_mem_free(state->input);
+	mcugdx_mem_free(state->re);
+	mcugdx_mem_free(state->im);
+	mcugdx_mem_free(state);
+}
+
+bool mcugdx_audio_analysis_enable(mcugdx_audio_analysis_config_t *config) {
+	uint32_t n = config->fft_size;
+	if (n < MIN_FFT_SIZE || n > MAX_FFT_SIZE || (n & (n - 1)) || config->num_bands > MCUGDX_AUDIO_ANALYSIS_MAX_BANDS || config->num_bands > n / 4) {
+		mcugdx_loge(TAG, "Invalid analysis config, fft size: %li, bands: %li", config->fft_size, config->num_bands);
+		return false;
+	}
+
+	analysis_state_t *state = mcugdx_mem_alloc(sizeof(analysis_state_t), MCUGDX_MEM_INTERNAL);
+	if (!state) {
+		mcugdx_loge(TAG, "Failed to allocate analysis state");
+		return false;
+	}
+	memset(state, 0, sizeof(analysis_state_t));
+	state->fft_size = n;
+	state->num_bands = config->num_bands;
+	while ((1u << state->fft_bits) < n) state->fft_bits++;
+
+	state->window = mcugdx_mem_alloc(n * sizeof(int16_t), MCUGDX_MEM_INTERNAL);
+	state->cos_table = mcugdx_mem_alloc(n / 2 * sizeof(int16_t), MCUGDX_MEM_INTERNAL);
+	state->sin_table = mcugdx_mem_alloc(n / 2 * sizeof(int16_t), MCUGDX_MEM_INTERNAL);
+	state->input = mcugdx_mem_alloc(n * sizeof(int16_t), MCUGDX_MEM_INTERNAL);
+	state->re = mcugdx_mem_alloc(n * sizeof(int16_t), MCUGDX_MEM_INTERNAL);
+	state->im = mcugdx_mem_alloc(n * sizeof(int16_t), MCUGDX_MEM_INTERNAL);
+	if (!state->window || !state->cos_table || !state->sin_table || !state->input || !state->re || !state->im) {
+		mcugdx_loge(TAG, "Failed to allocate analysis buffers");
+		analysis_free(state);
+		return false;
+	}
+
+	// Hann window and twiddle factors in Q15
+	for (uint32_t i = 0; i < n; i++) {
+		state->window[i] = (int16_t) (INT16_MAX * 0.5f * (1.0f - cosf(2 * PI * i / (n - 1))));
+	}
+	for (uint32_t i = 0; i < n / 2; i++) {
+		state->cos_table[i] = (int16_t) (INT16_MAX * cosf(2 * PI * i / n));
+		state->sin_table[i] = (int16_t) (INT16_MAX * sinf(2 * PI * i / n));
+	}
+
+	// Logarithmically spaced bands from bin 1 to n / 2, each at least one bin wide
+	state->band_edges[0] = 1;
+	for (uint32_t b = 1; b < state->num_bands; b++) {
+		uint32_t edge = (uint32_t) powf((float) (n / 2), (float) b / state->num_bands);
+		state->band_edges[b] = edge > state->band_edges[b - 1] ? edge : state->band_edges[b - 1] + 1;
+	}
+	state->band_edges[state->num_bands] = n / 2;
+
+	mcugdx_mutex_lock(&audio_lock);
+	analysis_state_t *old = analysis;
+	analysis = state;
+	mcugdx_mutex_unlock(&audio_lock);
+	analysis_free(old);
+	return true;
+}
+
+void mcugdx_audio_analysis_disable(void) {
+	mcugdx_mutex_lock(&audio_lock);
+	analysis_state_t *old = analysis;
+	analysis = NULL;
+	mcugdx_mutex_unlock(&audio_lock);
+	analysis_free(old);
+}
+
+bool mcugdx_audio_analysis_get(mcugdx_audio_analysis_t *result) {
+	for (int tries = 0; tries < 8; tries++) {
+		uint32_t sequence = snapshot_sequence;
+		memory_barrier();
+		if (sequence == 0 || (sequence & 1)) continue;
+		memcpy(result, &snapshot, sizeof(mcugdx_audio_analysis_t));
+		memory_barrier();
+		if (snapshot_sequence == sequence) {
+			result->sequence = sequence >> 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+// In-place radix-2 decimation in time FFT on Q15 data. Every stage scales by
+// 1/2 so the butterflies can't overflow, the result is the DFT divided by n.
+static void fft_q15(analysis_state_t *state) {
+	int16_t *re = state->re;
+	int16_t *im = state->im;
+	uint32_t n = state->fft_size;
+
+	for (uint32_t i = 1, j = 0; i < n; i++) {
+		uint32_t bit = n >> 1;
+		for (; j & bit; bit >>= 1) j ^= bit;
+		j ^= bit;
+		if (i < j) {
+			int16_t tmp = re[i];
+			re[i] = re[j];
+			re[j] = tmp;
+			tmp = im[i];
+			im[i] = im[j];
+			im[j] = tmp;
+		}
+	}
+
+	for (uint32_t size = 2, twiddle_step = n / 2; size <= n; size <<= 1, twiddle_step >>= 1) {
+		uint32_t half = size >> 1;
+		for (uint32_t start = 0; start < n; start += size) {
+			for (uint32_t k = 0; k < half; k++) {
+				int32_t wr = state->cos_table[k * twiddle_step];
+				int32_t wi = -state->sin_table[k * twiddle_step];
+				uint32_t a = start + k;
+				uint32_t b = a + half;
+				int32_t tr = (wr * re[b] - wi * im[b]) >> 15;
+				int32_t ti = (wr * im[b] + wi * re[b]) >> 15;
+				int32_t ar = re[a];
+				int32_t ai = im[a];
+				re[b] = (int16_t) ((ar - tr) >> 1);
+				im[b] = (int16_t) ((ai - ti) >> 1);
+				re[a] = (int16_t) ((ar + tr) >> 1);
+				im[a] = (int16_t) ((ai + ti) >> 1);
+			}
+		}
+	}
+}
+
+static void analyze_spectrum(analysis_state_t *state) {
+	uint32_t n = state->fft_size;
+	for (uint32_t i = 0; i < n; i++) {
+		state->re[i] = (int16_t) ((state->input[i] * state->window[i]) >> 15);
+		state->im[i] = 0;
+	}
+	fft_q15(state);
+
+	for (uint32_t b = 0; b < state->num_bands; b++) {
+		// Up to 2 * 32768^2, which only fits unsigned
+		uint32_t max_power = 0;
+		for (uint32_t i = state->band_edges[b]; i < state->band_edges[b + 1]; i++) {
+			uint32_t power = (uint32_t) (state->re[i] * state->re[i]) + (uint32_t) (state->im[i] * state->im[i]);
+			if (power > max_power) max_power = power;
+		}
+		// A full scale sine ends up at 1/4 amplitude due to the window and the one-sided spectrum
+		float magnitude = sqrtf((float) max_power) * 4;
+		state->bands[b] = (uint16_t) (magnitude > INT16_MAX ? INT16_MAX : magnitude);
+	}
+}
+
+// Called by mcugdx_audio_mix() with the final 16-bit output of each block.
+void mcugdx_audio_analysis_process(int16_t *frames, uint32_t num_frames, mcugdx_audio_channels_t channels) {
+	if (!analysis) return;
+
+	mcugdx_mutex_lock(&audio_lock);
+	analysis_state_t *state = analysis;
+	if (!state) {
+		mcugdx_mutex_unlock(&audio_lock);
+		return;
+	}
+
+	int64_t sum_squares[2] = {0, 0};
+	int32_t peak[2] = {0, 0};
+	for (uint32_t i = 0; i < num_frames; i++) {
+		for (uint32_t c = 0; c < (uint32_t) channels; c++) {
+			int32_t sample = frames[i * channels + c];
+			sum_squares[c] += sample * sample;
+			if (sample < 0) sample = -sample;
+			if (sample > peak[c]) peak[c] = sample;
+		}
+	}
+
+	// Only the most recent fft_size frames of a block matter for the spectrum
+	uint32_t start = 0;
+	if (state->num_bands > 0) {
+		if (num_frames > state->fft_size) start = num_frames - state->fft_size;
+		for (uint32_t i = start; i < num_frames; i++) {
+			int16_t *frame = frames + i * channels;
+			state->input[state->input_pos++] = channels == MCUGDX_MONO ? frame[0] : (int16_t) ((frame[0] + frame[1]) >> 1);
+			if (state->input_pos == state->fft_size) {
+				analyze_spectrum(state);
+				state->input_pos = 0;
+			}
+		}
+	}
+
+	snapshot_sequence++;
+	memory_barrier();
+	for (uint32_t c = 0; c < 2; c++) {
+		uint32_t src = channels == MCUGDX_MONO ? 0 : c;
+		snapshot.rms[c] = num_frames ? (uint16_t) sqrtf((float) sum_squares[src] / num_frames) : 0;
+		snapshot.peak[c] = (uint16_t) (peak[src] > INT16_MAX ? INT16_MAX : peak[src]);
+	}
+	snapshot.num_bands = state->num_bands;
+	memcpy(snapshot.bands, state->bands, sizeof(snapshot.bands));
+	memory_barrier();
+	snapshot_sequence++;
+
+	mcugdx_mutex_unlock(&audio_lock);
+}
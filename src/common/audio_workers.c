@@ -0,0 +1,204 @@
+#include "audio_workers.h"
+#include "log.h"
+
+#define TAG "mcugdx_audio_workers"
+
+static mcugdx_audio_work_func_t work_func;
+static uint32_t num_workers = 0;
+static volatile bool stopping = false;
+
+#if defined(ESP_PLATFORM)
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static SemaphoreHandle_t start_signals[MCUGDX_AUDIO_MAX_MIX_WORKERS];
+static SemaphoreHandle_t done_signals[MCUGDX_AUDIO_MAX_MIX_WORKERS];
+
+static void worker_task(void *args) {
+	uint32_t index = (uint32_t) (uintptr_t) args;
+	while (true) {
+		xSemaphoreTake(start_signals[index], portMAX_DELAY);
+		if (stopping) break;
+		work_func(index + 1);
+		xSemaphoreGive(done_signals[index]);
+	}
+	xSemaphoreGive(done_signals[index]);
+	vTaskDelete(NULL);
+}
+
+static bool platform_start(uint32_t index) {
+	start_signals[index] = xSemaphoreCreateBinary();
+	done_signals[index] = xSemaphoreCreateBinary();
+	// Not pinned, so the scheduler can put the worker on whichever core the mixing thread isn't using
+	if (start_signals[index] && done_signals[index] &&
+		xTaskCreatePinnedToCore(worker_task, "mcugdx_mix_worker", 4096, (void *) (uintptr_t) index, 5, NULL, tskNO_AFFINITY) == pdPASS) {
+		return true;
+	}
+
+	// Workers that already started are cleaned up by platform_stop()
+	if (start_signals[index]) vSemaphoreDelete(start_signals[index]);
+	if (done_signals[index]) vSemaphoreDelete(done_signals[index]);
+	return false;
+}
+
+static void platform_dispatch(void) {
+	for (uint32_t i = 0; i < num_workers; i++) xSemaphoreGive(start_signals[i]);
+}
+
+static void platform_wait(void) {
+	for (uint32_t i = 0; i < num_workers; i++) xSemaphoreTake(done_signals[i], portMAX_DELAY);
+}
+
+static void platform_stop(void) {
+	stopping = true;
+	platform_dispatch();
+	platform_wait();
+	for (uint32_t i = 0; i < num_workers; i++) {
+		vSemaphoreDelete(start_signals[i]);
+		vSemaphoreDelete(done_signals[i]);
+	}
+}
+#else
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE thread_t;
+static CRITICAL_SECTION lock;
+static CONDITION_VARIABLE start_cond;
+static CONDITION_VARIABLE done_cond;
+#define lock_init() InitializeCriticalSection(&lock), InitializeConditionVariable(&start_cond), InitializeConditionVariable(&done_cond)
+#define lock_destroy() DeleteCriticalSection(&lock)
+#define lock_acquire() EnterCriticalSection(&lock)
+#define lock_release() LeaveCriticalSection(&lock)
+#define cond_wait(cond) SleepConditionVariableCS(&(cond), &lock, INFINITE)
+#define cond_broadcast(cond) WakeAllConditionVariable(&(cond))
+#else
+#include <pthread.h>
+typedef pthread_t thread_t;
+static pthread_mutex_t lock;
+static pthread_cond_t start_cond;
+static pthread_cond_t done_cond;
+#define lock_init() pthread_mutex_init(&lock, NULL), pthread_cond_init(&start_cond, NULL), pthread_cond_init(&done_cond, NULL)
+#define lock_destroy() pthread_mutex_destroy(&lock), pthread_cond_destroy(&start_cond), pthread_cond_destroy(&done_cond)
+#define lock_acquire() pthread_mutex_lock(&lock)
+#define lock_release() pthread_mutex_unlock(&lock)
+#define cond_wait(cond) pthread_cond_wait(&(cond), &lock)
+#define cond_broadcast(cond) pthread_cond_broadcast(&(cond))
+#endif
+
+static thread_t threads[MCUGDX_AUDIO_MAX_MIX_WORKERS];
+static uint32_t generation = 0;
+static uint32_t pending = 0;
+static uint32_t start_generations[MCUGDX_AUDIO_MAX_MIX_WORKERS];
+
+static void worker_loop(uint32_t index) {
+	lock_acquire();
+	// Taken before the thread was created, a dispatch may happen before we get here
+	uint32_t seen_generation = start_generations[index];
+	while (true) {
+		while (generation == seen_generation && !stopping) cond_wait(start_cond);
+		if (stopping) break;
+		seen_generation = generation;
+		lock_release();
+
+		work_func(index + 1);
+
+		lock_acquire();
+		if (--pending == 0) cond_broadcast(done_cond);
+	}
+	lock_release();
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker_thread(LPVOID args) {
+	worker_loop((uint32_t) (uintptr_t) args);
+	return 0;
+}
+#else
+static void *worker_thread(void *args) {
+	worker_loop((uint32_t) (uintptr_t) args);
+	return NULL;
+}
+#endif
+
+static bool platform_start(uint32_t index) {
+	if (index == 0) lock_init();
+	start_generations[index] = generation;
+#ifdef _WIN32
+	threads[index] = CreateThread(NULL, 0, worker_thread, (LPVOID) (uintptr_t) index, 0, NULL);
+	bool started = threads[index] != NULL;
+#else
+	bool started = pthread_create(&threads[index], NULL, worker_thread, (void *) (uintptr_t) index) == 0;
+#endif
+	// Once a worker runs, platform_stop() destroys the lock
+	if (!started && index == 0) lock_destroy();
+	return started;
+}
+
+static void platform_dispatch(void) {
+	lock_acquire();
+	pending = num_workers;
+	generation++;
+	cond_broadcast(start_cond);
+	lock_release();
+}
+
+static void platform_wait(void) {
+	lock_acquire();
+	while (pending > 0) cond_wait(done_cond);
+	lock_release();
+}
+
+static void platform_stop(void) {
+	// Set under the lock, as the workers check it while waiting for work
+	lock_acquire();
+	stopping = true;
+	cond_broadcast(start_cond);
+	lock_release();
+	for (uint32_t i = 0; i < num_workers; i++) {
+#ifdef _WIN32
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+#else
+		pthread_join(threads[i], NULL);
+#endif
+	}
+	lock_destroy();
+}
+#endif
+
+void mcugdx_audio_workers_stop(void) {
+	if (num_workers == 0) return;
+	platform_stop();
+	num_workers = 0;
+}
+
+bool mcugdx_audio_workers_start(uint32_t count, mcugdx_audio_work_func_t func) {
+	mcugdx_audio_workers_stop();
+	if (count > MCUGDX_AUDIO_MAX_MIX_WORKERS) {
+		mcugdx_loge(TAG, "At most %i mix workers are supported", MCUGDX_AUDIO_MAX_MIX_WORKERS);
+		return false;
+	}
+
+	work_func = func;
+	stopping = false;
+	for (uint32_t i = 0; i < count; i++) {
+		if (!platform_start(i)) {
+			mcugdx_loge(TAG, "Could not start mix worker %li", i);
+			mcugdx_audio_workers_stop();
+			return false;
+		}
+		num_workers = i + 1;
+	}
+	return true;
+}
+
+// Wakes up all workers. The caller mixes partition 0 and then waits via
+// mcugdx_audio_workers_wait() for the workers to finish theirs.
+void mcugdx_audio_workers_dispatch(void) {
+	if (num_workers > 0) platform_dispatch();
+}
+
+void mcugdx_audio_workers_wait(void) {
+	if (num_workers > 0) platform_wait();
+}
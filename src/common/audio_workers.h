@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MCUGDX_AUDIO_MAX_MIX_WORKERS 7
+
+// Pool of threads the mixer distributes voices to. Workers are numbered
+// from 1, partition 0 is always mixed by the audio thread itself.
+typedef void (*mcugdx_audio_work_func_t)(uint32_t worker);
+
+bool mcugdx_audio_workers_start(uint32_t count, mcugdx_audio_work_func_t func);
+
+void mcugdx_audio_workers_stop(void);
+
+void mcugdx_audio_workers_dispatch(void);
+
+void mcugdx_audio_workers_wait(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,330 +1,1811 @@
 #include "display.h"
+#include "log.h"
+#include "mem.h"
+#include <math.h>
 #include <string.h>
 
+#define TAG "mcugdx_display"
+#define INITIAL_COMMAND_CAPACITY 256
+#define MAX_OCCLUDERS 8
+
+// Merging two dirty rects is worth it if the union doesn't add more pixels
+// than it would cost to set up another window on the display
+#define DIRTY_MERGE_SLACK 256
+#define WINDOW_COMMAND_BYTES 11
+
+typedef enum {
+	COMMAND_FILL,
+	COMMAND_FILL_BLEND,
+	COMMAND_BLIT,
+	COMMAND_BLIT_KEYED,
+	COMMAND_BLEND,
+	COMMAND_TRANSFORM,
+	COMMAND_TRANSFORM_KEYED,
+	COMMAND_MASK,
+	COMMAND_INDEXED,
+	COMMAND_FILTER
+} command_type_t;
+
+// Tinting is an alpha blend with the source colors moved towards a color first
+#define BLEND_TINT 3
+
+#define NO_TRANSPARENT_INDEX 0xffff
+
+// RGB565 spread over 32 bits as 00000gggggg00000rrrrr000000bbbbb, so all three
+// channels can be scaled with a single multiply by a 5 bit alpha
+#define SPREAD_MASK 0x07e0f81fu
+
+// Draw call recorded in banded or list mode. The destination is already clipped to
+// the screen, color is the fill color as written to memory, the color key, the
+// tint or the mask color. Blended fills use color in native byte order and an
+// opacity in [0, 32]. Blends use blend_mode and opacity, transforms store the index of
+// their transform_t. Indexed blits draw indexed through palette, color is their
+// transparent index or NO_TRANSPARENT_INDEX. Filters store their mcugdx_filter_t
+// in blend_mode, the amount in opacity and color in native byte order.
+typedef struct {
+	uint8_t type;
+	uint8_t blend_mode;
+	uint8_t opacity;
+	uint16_t color;
+	uint16_t transform;
+	int16_t x, y, width, height;
+	int16_t src_x, src_y;
+	union {
+		mcugdx_image_t *image;
+		mcugdx_indexed_image_t *indexed;
+	};
+	const uint16_t *palette;
+} draw_command_t;
+
+// Maps destination pixels to source pixels for scaled, flipped, rotated and
+// affine blits. u and v are the 16.16 source coordinates of the center of the
+// top left destination pixel and advance by du/dv per destination pixel in x
+// and y. Only source pixels in src_x1 <= x < src_x2, src_y1 <= y < src_y2 are drawn.
+// repeat_x is the integer factor of blits scaled up along rows, 0 otherwise.
+typedef struct {
+	int32_t u, v;
+	int32_t du_dx, dv_dx, du_dy, dv_dy;
+	int32_t src_x1, src_y1, src_x2, src_y2;
+	int32_t repeat_x;
+} transform_t;
+
+// Where the rasterizers write to. Pixel x, y in screen coordinates is stored at
+// pixels[(y - origin_y) * stride + x], anything outside the clip rect is dropped.
+typedef struct {
+	uint16_t *pixels;
+	int32_t stride;
+	int32_t origin_y;
+	int32_t clip_x1, clip_y1, clip_x2, clip_y2;
+} render_target_t;
+
 extern mcugdx_display_t display;
+extern void mcugdx_display_parallel(void (*work)(uint32_t part));
 
-void mcugdx_display_clear(void) {
-	memset(display.frame_buffer, 0, display.width * display.height * sizeof(uint16_t));
+static draw_command_t *commands = NULL;
+static uint32_t num_commands = 0;
+static uint32_t command_capacity = 0;
+static bool recording_list = false;
+static bool commands_culled = false;
+static transform_t *transforms = NULL;
+static uint32_t num_transforms = 0;
+static uint32_t transform_capacity = 0;
+
+// A pushed clip rect in screen coordinates, inclusive, and the translation
+// that was current when it was pushed
+typedef struct {
+	int32_t x1, y1, x2, y2;
+	int32_t translate_x, translate_y;
+} clip_t;
+
+// Image draw calls go to instead of the screen, NULL for the screen
+static mcugdx_image_t *target_image = NULL;
+
+static clip_t clips[MCUGDX_DISPLAY_MAX_CLIPS];
+static uint32_t num_clips = 0;
+static int32_t translate_x = 0;
+static int32_t translate_y = 0;
+
+static inline int32_t rect_area(mcugdx_rect_t *rect) {
+	return rect->width * rect->height;
 }
 
-void mcugdx_display_clear_color(uint16_t color) {
-	color = swap_bytes(color);
-	uint32_t *frame_buffer32 = (uint32_t *) display.frame_buffer;
-	uint32_t color32 = ((uint32_t) color << 16) | color;
-	size_t count32 = (display.width * display.height) / 2;
-	size_t remainder = (display.width * display.height) % 2;
+static mcugdx_rect_t rect_union(mcugdx_rect_t *a, mcugdx_rect_t *b) {
+	int32_t x1 = a->x < b->x ? a->x : b->x;
+	int32_t y1 = a->y < b->y ? a->y : b->y;
+	int32_t x2 = a->x + a->width > b->x + b->width ? a->x + a->width : b->x + b->width;
+	int32_t y2 = a->y + a->height > b->y + b->height ? a->y + a->height : b->y + b->height;
+	return (mcugdx_rect_t){x1, y1, x2 - x1, y2 - y1};
+}
 
-	for (size_t i = 0; i < count32; i++) {
-		frame_buffer32[i] = color32;
+// Takes inclusive, already clipped coordinates
+static void add_dirty_rect(int32_t x1, int32_t y1, int32_t x2, int32_t y2) {
+	mcugdx_rect_t rect = {x1, y1, x2 - x1 + 1, y2 - y1 + 1};
+
+	// Absorb all rects that are cheaper to send as part of the new one. Merging
+	// grows the new rect, so start over after each merge.
+	for (uint32_t i = 0; i < display.num_dirty_rects;) {
+		mcugdx_rect_t *other = &display.dirty_rects[i];
+		mcugdx_rect_t merged = rect_union(&rect, other);
+		if (rect_area(&merged) <= rect_area(&rect) + rect_area(other) + DIRTY_MERGE_SLACK) {
+			rect = merged;
+			*other = display.dirty_rects[--display.num_dirty_rects];
+			i = 0;
+		} else {
+			i++;
+		}
 	}
 
-	if (remainder) {
-		display.frame_buffer[display.width * display.height - 1] = color;
+	if (display.num_dirty_rects < MCUGDX_DISPLAY_MAX_DIRTY_RECTS) {
+		display.dirty_rects[display.num_dirty_rects++] = rect;
+		return;
 	}
+
+	// List is full, merge with the rect that grows the least
+	uint32_t best = 0;
+	int32_t best_growth = INT32_MAX;
+	for (uint32_t i = 0; i < display.num_dirty_rects; i++) {
+		mcugdx_rect_t merged = rect_union(&rect, &display.dirty_rects[i]);
+		int32_t growth = rect_area(&merged) - rect_area(&display.dirty_rects[i]);
+		if (growth < best_growth) {
+			best_growth = growth;
+			best = i;
+		}
+	}
+	display.dirty_rects[best] = rect_union(&rect, &display.dirty_rects[best]);
 }
 
-void mcugdx_display_set_pixel(int32_t x, int32_t y, uint16_t color) {
-	if (x < 0 || x >= (int32_t) display.width) return;
-	if (y < 0 || y >= (int32_t) display.height) return;
+static inline void mark_dirty(int32_t x1, int32_t y1, int32_t x2, int32_t y2) {
+	if (display.dirty_tracking && !target_image) add_dirty_rect(x1, y1, x2, y2);
+}
 
-	uint16_t reversed_color = color;
-	display.frame_buffer[x + display.width * y] = reversed_color;
+void mcugdx_display_set_dirty_tracking(bool enabled) {
+	display.dirty_tracking = enabled;
+	display.num_dirty_rects = 0;
+	mark_dirty(0, 0, display.width - 1, display.height - 1);
 }
 
-void mcugdx_display_hline(int32_t x1, int32_t x2, int32_t y, uint16_t color) {
-	if (x1 > x2) {
-		int32_t tmp = x2;
-		x2 = x1;
-		x1 = tmp;
+void mcugdx_display_mark_dirty(int32_t x, int32_t y, int32_t width, int32_t height) {
+	int32_t x2 = x + width - 1;
+	int32_t y2 = y + height - 1;
+	if (x < 0) x = 0;
+	if (y < 0) y = 0;
+	if (x2 >= (int32_t) display.width) x2 = (int32_t) display.width - 1;
+	if (y2 >= (int32_t) display.height) y2 = (int32_t) display.height - 1;
+	if (x > x2 || y > y2) return;
+	mark_dirty(x, y, x2, y2);
+}
+
+// Called by the platform's mcugdx_display_show(). Returns the regions to upload
+// and clears the dirty list. Without dirty tracking that's always the full screen.
+uint32_t mcugdx_display_take_dirty_rects(mcugdx_rect_t *rects) {
+	if (!display.dirty_tracking) {
+		rects[0] = (mcugdx_rect_t){0, 0, (int32_t) display.width, (int32_t) display.height};
+		return 1;
 	}
 
-	if (x1 >= (int32_t) display.width) return;
-	if (x2 < 0) return;
-	if (y < 0) return;
-	if (y >= (int32_t) display.height) return;
+	uint32_t num_rects = display.num_dirty_rects;
+	memcpy(rects, display.dirty_rects, num_rects * sizeof(mcugdx_rect_t));
+	display.num_dirty_rects = 0;
+	return num_rects;
+}
 
-	if (x1 < 0) x1 = 0;
-	if (x2 >= (int32_t) display.width) x2 = (int32_t) display.width - 1;
+// Called by the platform for every window it sends to the display, in frame
+// buffer pixels, which are scale x scale pixels each on the panel
+void mcugdx_display_count_window(int32_t width, int32_t height) {
+	display.bytes_sent += WINDOW_COMMAND_BYTES + width * height * display.scale * display.scale * sizeof(uint16_t);
+}
 
-	uint16_t reversed_color = swap_bytes(color);
-	uint16_t *pixels = display.frame_buffer + y * (int32_t) display.width + x1;
-	int32_t num_pixels = x2 - x1 + 1;
-	while (num_pixels--) {
-		*pixels++ = reversed_color;
+uint64_t mcugdx_display_bytes_sent(void) {
+	return display.bytes_sent;
+}
+
+static bool commands_reserve(uint32_t count) {
+	if (num_commands + count <= command_capacity) return true;
+	uint32_t new_capacity = command_capacity ? command_capacity * 2 : INITIAL_COMMAND_CAPACITY;
+	while (new_capacity < num_commands + count) new_capacity *= 2;
+	draw_command_t *new_commands = mcugdx_mem_alloc(new_capacity * sizeof(draw_command_t), MCUGDX_MEM_INTERNAL);
+	if (!new_commands) {
+		mcugdx_loge(TAG, "Could not grow draw command buffer to %li commands", new_capacity);
+		return false;
+	}
+	if (commands) {
+		memcpy(new_commands, commands, num_commands * sizeof(draw_command_t));
+		mcugdx_mem_free(commands);
 	}
+	commands = new_commands;
+	command_capacity = new_capacity;
+	return true;
 }
 
-void mcugdx_display_rect(int32_t x1, int32_t y1, int32_t width, int32_t height, uint16_t color) {
-	if (width <= 0 || height <= 0) return;
+static void clear_commands(void) {
+	num_commands = 0;
+	num_transforms = 0;
+}
+
+static draw_command_t *record(command_type_t type, uint16_t color, int32_t x1, int32_t y1, int32_t x2, int32_t y2, mcugdx_image_t *image, int32_t src_x, int32_t src_y) {
+	// A fill covering the whole screen hides everything recorded before it
+	if (type == COMMAND_FILL && x1 == 0 && y1 == 0 && x2 == (int32_t) display.width - 1 && y2 == (int32_t) display.height - 1) clear_commands();
+	if (!commands_reserve(1)) return NULL;
+
+	draw_command_t *command = &commands[num_commands++];
+	command->type = type;
+	command->color = color;
+	command->x = (int16_t) x1;
+	command->y = (int16_t) y1;
+	command->width = (int16_t) (x2 - x1 + 1);
+	command->height = (int16_t) (y2 - y1 + 1);
+	command->src_x = (int16_t) src_x;
+	command->src_y = (int16_t) src_y;
+	command->image = image;
+	return command;
+}
+
+static inline render_target_t screen_target(void) {
+	return (render_target_t){
+			.pixels = display.frame_buffer,
+			.stride = (int32_t) display.width,
+			.origin_y = 0,
+			.clip_x1 = 0,
+			.clip_y1 = 0,
+			.clip_x2 = (int32_t) display.width - 1,
+			.clip_y2 = (int32_t) display.height - 1};
+}
+
+// Draw calls are recorded in banded and list mode, unless they go to an image
+static inline bool recording(void) {
+	return (display.band_height > 0 || recording_list) && !target_image;
+}
+
+// The screen or target image clipped to the innermost pushed clip rect. Draw
+// calls clip against this before recording, so recorded commands are replayed
+// into screen_target() no matter what clip rect is current by then.
+static inline render_target_t draw_target(void) {
+	render_target_t target = screen_target();
+	if (target_image) {
+		target.pixels = target_image->pixels;
+		target.stride = (int32_t) target_image->width;
+		target.clip_x2 = (int32_t) target_image->width - 1;
+		target.clip_y2 = (int32_t) target_image->height - 1;
+	} else if (display.indexed_frame_buffer) {
+		// The indexed frame buffer can't be drawn into, only target images
+		target.clip_x2 = -1;
+		target.clip_y2 = -1;
+	}
+	if (num_clips > 0) {
+		clip_t *clip = &clips[num_clips - 1];
+		if (clip->x1 > target.clip_x1) target.clip_x1 = clip->x1;
+		if (clip->y1 > target.clip_y1) target.clip_y1 = clip->y1;
+		if (clip->x2 < target.clip_x2) target.clip_x2 = clip->x2;
+		if (clip->y2 < target.clip_y2) target.clip_y2 = clip->y2;
+	}
+	return target;
+}
 
-	color = swap_bytes(color);
+// Clips the inclusive rect against the target's clip rect. Returns false if nothing is left.
+static inline bool clip_rect(render_target_t *target, int32_t *x1, int32_t *y1, int32_t *x2, int32_t *y2) {
+	if (*x1 < target->clip_x1) *x1 = target->clip_x1;
+	if (*y1 < target->clip_y1) *y1 = target->clip_y1;
+	if (*x2 > target->clip_x2) *x2 = target->clip_x2;
+	if (*y2 > target->clip_y2) *y2 = target->clip_y2;
+	return *x1 <= *x2 && *y1 <= *y2;
+}
 
-	int32_t x2 = x1 + width - 1;
-	int32_t y2 = y1 + height - 1;
+// Clips a blit of a width x height region at src_x/src_y of an image_width x image_height
+// image to dst_x/dst_y, first against the image bounds, then against the target.
+// Returns false if nothing is left.
+static bool clip_region(render_target_t *target, int32_t image_width, int32_t image_height, int32_t *dst_x, int32_t *dst_y, int32_t *src_x, int32_t *src_y, int32_t *width, int32_t *height) {
+	if (*src_x < 0) {
+		*width += *src_x;
+		*dst_x -= *src_x;
+		*src_x = 0;
+	}
+	if (*src_y < 0) {
+		*height += *src_y;
+		*dst_y -= *src_y;
+		*src_y = 0;
+	}
+	if (*src_x + *width > image_width) *width = image_width - *src_x;
+	if (*src_y + *height > image_height) *height = image_height - *src_y;
 
-	x1 = (x1 < 0) ? 0 : (x1 >= (int32_t) display.width ? (int32_t) display.width - 1 : x1);
-	y1 = (y1 < 0) ? 0 : (y1 >= (int32_t) display.height ? (int32_t) display.height - 1 : y1);
-	x2 = (x2 < 0) ? 0 : (x2 >= (int32_t) display.width ? (int32_t) display.width - 1 : x2);
-	y2 = (y2 < 0) ? 0 : (y2 >= (int32_t) display.height ? (int32_t) display.height - 1 : y2);
+	int32_t x1 = *dst_x, y1 = *dst_y;
+	int32_t x2 = x1 + *width - 1, y2 = y1 + *height - 1;
+	if (*width <= 0 || *height <= 0 || !clip_rect(target, &x1, &y1, &x2, &y2)) return false;
 
-	if (x1 > x2 || y1 > y2) return;
+	*src_x += x1 - *dst_x;
+	*src_y += y1 - *dst_y;
+	*dst_x = x1;
+	*dst_y = y1;
+	*width = x2 - x1 + 1;
+	*height = y2 - y1 + 1;
+	return true;
+}
 
-	int32_t clipped_width = x2 - x1 + 1;
-	int32_t next_row = display.width - clipped_width;
+static inline bool clip_blit(render_target_t *target, mcugdx_image_t *image, int32_t *dst_x, int32_t *dst_y, int32_t *src_x, int32_t *src_y, int32_t *width, int32_t *height) {
+	return clip_region(target, (int32_t) image->width, (int32_t) image->height, dst_x, dst_y, src_x, src_y, width, height);
+}
 
+static inline uint16_t *target_pixel(render_target_t *target, int32_t x, int32_t y) {
+	return target->pixels + (y - target->origin_y) * target->stride + x;
+}
+
+static void fill_row(uint16_t *dst, int32_t width, uint16_t color) {
+	if (((uintptr_t) dst & 2) && width > 0) {
+		*dst++ = color;
+		width--;
+	}
 	uint32_t color32 = ((uint32_t) color << 16) | color;
-	uint32_t *pixel32 = (uint32_t *) (display.frame_buffer + y1 * display.width + x1);
+	uint32_t *dst32 = (uint32_t *) dst;
+	for (int32_t x = 0; x < width / 2; x++) {
+		*dst32++ = color32;
+	}
+	if (width & 1) dst[width - 1] = color;
+}
+
+// Keyed blits pick the widest compare and select available at compile time.
+// Desktops use SSE2 or NEON on 8 pixels at once, everything else, including
+// the ESP32-S3, builds a per-pixel mask for two 32-bit words at a time.
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+
+static void blit_row_keyed(uint16_t *dst, const uint16_t *src, int32_t width, uint16_t color_key) {
+	int32_t x = 0;
+	const __m128i key = _mm_set1_epi16((int16_t) color_key);
+	for (; x + 8 <= width; x += 8) {
+		__m128i src_colors = _mm_loadu_si128((const __m128i *) (src + x));
+		__m128i transparent = _mm_cmpeq_epi16(src_colors, key);
+		int mask = _mm_movemask_epi8(transparent);
+		if (mask == 0xffff) continue;
+		if (mask != 0) {
+			__m128i dst_colors = _mm_loadu_si128((const __m128i *) (dst + x));
+			src_colors = _mm_or_si128(_mm_and_si128(transparent, dst_colors), _mm_andnot_si128(transparent, src_colors));
+		}
+		_mm_storeu_si128((__m128i *) (dst + x), src_colors);
+	}
+	for (; x < width; x++) {
+		if (src[x] != color_key) dst[x] = src[x];
+	}
+}
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+
+static void blit_row_keyed(uint16_t *dst, const uint16_t *src, int32_t width, uint16_t color_key) {
+	int32_t x = 0;
+	const uint16x8_t key = vdupq_n_u16(color_key);
+	for (; x + 8 <= width; x += 8) {
+		uint16x8_t src_colors = vld1q_u16(src + x);
+		uint16x8_t transparent = vceqq_u16(src_colors, key);
+		uint64x2_t halves = vreinterpretq_u64_u16(transparent);
+		uint64_t all = vgetq_lane_u64(halves, 0) & vgetq_lane_u64(halves, 1);
+		if (all == UINT64_MAX) continue;
+		vst1q_u16(dst + x, vbslq_u16(transparent, vld1q_u16(dst + x), src_colors));
+	}
+	for (; x < width; x++) {
+		if (src[x] != color_key) dst[x] = src[x];
+	}
+}
+#else
+// 0xffff in each half of the result where the half of the input is non-zero
+static inline uint32_t opaque_mask(uint32_t diff) {
+	uint32_t low = ((diff & 0xffff) + 0xffff) >> 16;
+	uint32_t high = ((diff >> 16) + 0xffff) >> 16;
+	return (0 - low) >> 16 | (0 - high) << 16;
+}
+
+static void blit_row_keyed(uint16_t *dst, const uint16_t *src, int32_t width, uint16_t color_key) {
+	int32_t x = 0;
+	// Two pixels per 32-bit word if source and destination share their alignment
+	if ((((uintptr_t) dst ^ (uintptr_t) src) & 2) == 0) {
+		if (((uintptr_t) dst & 2) && width > 0) {
+			if (src[0] != color_key) dst[0] = src[0];
+			x = 1;
+		}
+		uint32_t color_key32 = ((uint32_t) color_key << 16) | color_key;
+		const uint32_t *src32 = (const uint32_t *) (src + x);
+		uint32_t *dst32 = (uint32_t *) (dst + x);
+		for (; x + 4 <= width; x += 4, src32 += 2, dst32 += 2) {
+			uint32_t src0 = src32[0], src1 = src32[1];
+			uint32_t mask0 = opaque_mask(src0 ^ color_key32);
+			uint32_t mask1 = opaque_mask(src1 ^ color_key32);
+			if ((mask0 | mask1) == 0) continue;
+			dst32[0] = (dst32[0] & ~mask0) | (src0 & mask0);
+			dst32[1] = (dst32[1] & ~mask1) | (src1 & mask1);
+		}
+	}
+	for (; x < width; x++) {
+		if (src[x] != color_key) dst[x] = src[x];
+	}
+}
+#endif
 
+// Color is written as is, callers swap bytes where needed
+static void fill_target(render_target_t *target, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t color) {
+	if (!clip_rect(target, &x1, &y1, &x2, &y2)) return;
+	uint16_t *dst = target_pixel(target, x1, y1);
 	for (int32_t y = y1; y <= y2; y++) {
-		int32_t x = 0;
-		for (; x < clipped_width - 1; x += 2) {
-			*pixel32++ = color32;
+		fill_row(dst, x2 - x1 + 1, color);
+		dst += target->stride;
+	}
+}
+
+// Copies the parts of the sprite's opaque spans that fall into the clipped
+// source columns, spans are sorted by x within a row
+static void blit_spans(uint16_t *dst, int32_t stride, mcugdx_image_t *image, int32_t src_x, int32_t src_y, int32_t width, int32_t height) {
+	int32_t src_x2 = src_x + width;
+	for (int32_t y = src_y; y < src_y + height; y++) {
+		uint16_t *src = image->pixels + y * image->width;
+		mcugdx_image_span_t *span = image->spans + image->row_spans[y];
+		mcugdx_image_span_t *end = image->spans + image->row_spans[y + 1];
+		for (; span < end && span->x < src_x2; span++) {
+			int32_t x1 = span->x > src_x ? span->x : src_x;
+			int32_t x2 = span->x + span->width < src_x2 ? span->x + span->width : src_x2;
+			if (x1 < x2) memcpy(dst + x1 - src_x, src + x1, (x2 - x1) * sizeof(uint16_t));
 		}
-		if (x < clipped_width) {
-			*(uint16_t *) pixel32 = color;
-			pixel32 = (uint32_t *) ((uint16_t *) pixel32 + 1);
+		dst += stride;
+	}
+}
+
+static void blit_target(render_target_t *target, mcugdx_image_t *image, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t width, int32_t height, bool keyed, uint16_t color_key) {
+	if (!clip_blit(target, image, &dst_x, &dst_y, &src_x, &src_y, &width, &height)) return;
+
+	if (keyed && image->spans && image->color_key == color_key) {
+		blit_spans(target_pixel(target, dst_x, dst_y), target->stride, image, src_x, src_y, width, height);
+		return;
+	}
+
+	uint16_t *dst = target_pixel(target, dst_x, dst_y);
+	uint16_t *src = image->pixels + src_y * image->width + src_x;
+	for (int32_t y = 0; y < height; y++) {
+		if (keyed) {
+			blit_row_keyed(dst, src, width, color_key);
+		} else {
+			memcpy(dst, src, width * sizeof(uint16_t));
 		}
-		pixel32 = (uint32_t *) ((uint16_t *) pixel32 + next_row);
+		dst += target->stride;
+		src += image->width;
 	}
 }
 
-void mcugdx_display_blit(mcugdx_image_t *src, int32_t x, int32_t y) {
-	int32_t dst_x1 = x;
-	int32_t dst_y1 = y;
-	int32_t dst_x2 = x + src->width - 1;
-	int32_t dst_y2 = y + src->height - 1;
-	int32_t src_x1 = 0;
-	int32_t src_y1 = 0;
+static inline uint32_t spread(uint16_t color) {
+	return (color | ((uint32_t) color << 16)) & SPREAD_MASK;
+}
+
+static inline uint16_t unspread(uint32_t color) {
+	return (uint16_t) (color | (color >> 16));
+}
 
-	if (dst_x1 >= (int32_t) display.width) return;
-	if (dst_x2 < 0) return;
-	if (dst_y1 >= (int32_t) display.height) return;
-	if (dst_y2 < 0) return;
+// Colors in native byte order, alpha in [0, 32]
+static inline uint16_t blend_alpha(uint16_t src, uint16_t dst, uint32_t alpha) {
+	uint32_t s = spread(src);
+	uint32_t d = spread(dst);
+	d += (s - d) * alpha >> 5;
+	return unspread(d & SPREAD_MASK);
+}
+
+static inline uint16_t blend_add(uint16_t src, uint16_t dst, uint32_t alpha) {
+	uint32_t sum = spread(dst) + ((spread(src) * alpha >> 5) & SPREAD_MASK);
+	// Channels that overflowed into the gap above them are saturated
+	uint32_t overflow_rb = sum & 0x00010020u;
+	uint32_t overflow_g = sum & 0x08000000u;
+	sum |= (overflow_rb - (overflow_rb >> 5)) | (overflow_g - (overflow_g >> 6));
+	return unspread(sum & SPREAD_MASK);
+}
 
-	if (dst_x1 < 0) {
-		src_x1 -= dst_x1;
-		dst_x1 = 0;
+static inline uint16_t blend_multiply(uint16_t src, uint16_t dst, uint32_t alpha) {
+	uint32_t r = ((dst >> 11) * ((src >> 11) + 1)) >> 5;
+	uint32_t g = (((dst >> 5) & 0x3f) * (((src >> 5) & 0x3f) + 1)) >> 6;
+	uint32_t b = ((dst & 0x1f) * ((src & 0x1f) + 1)) >> 5;
+	return blend_alpha((uint16_t) (r << 11 | g << 5 | b), dst, alpha);
+}
+
+// 8 bit alpha of the source pixel at index, see mcugdx_blend_mode_t
+static inline uint32_t image_alpha(mcugdx_image_t *image, uint32_t index) {
+	if (image->alpha_bits == 8) return image->alpha[index];
+	if (image->alpha_bits == 4) return ((image->alpha[index >> 1] >> ((index & 1) << 2)) & 0xf) * 17;
+	if (image->spans && image->pixels[index] == image->color_key) return 0;
+	return 255;
+}
+
+static void blend_row(uint16_t *dst, mcugdx_image_t *image, uint32_t src_index, int32_t width, uint8_t mode, uint32_t opacity) {
+	for (int32_t x = 0; x < width; x++, src_index++) {
+		// Rounds 255 * 255 to 32
+		uint32_t alpha = (image_alpha(image, src_index) * opacity + 1024) >> 11;
+		if (alpha == 0) continue;
+		uint16_t src_color = swap_bytes(image->pixels[src_index]);
+		uint16_t dst_color = swap_bytes(dst[x]);
+		switch (mode) {
+			case MCUGDX_BLEND_ALPHA:
+				dst_color = blend_alpha(src_color, dst_color, alpha);
+				break;
+			case MCUGDX_BLEND_ADD:
+				dst_color = blend_add(src_color, dst_color, alpha);
+				break;
+			case MCUGDX_BLEND_MULTIPLY:
+				dst_color = blend_multiply(src_color, dst_color, alpha);
+				break;
+		}
+		dst[x] = swap_bytes(dst_color);
 	}
-	if (dst_y1 < 0) {
-		src_y1 -= dst_y1;
-		dst_y1 = 0;
+}
+
+// For tints, opacity is the tint amount, the blend itself only uses the image's alpha
+static void blend_target(render_target_t *target, mcugdx_image_t *image, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t width, int32_t height, uint8_t mode, uint8_t opacity, uint16_t tint) {
+	if (!clip_blit(target, image, &dst_x, &dst_y, &src_x, &src_y, &width, &height)) return;
+
+	uint16_t *dst = target_pixel(target, dst_x, dst_y);
+	uint32_t src_index = src_y * image->width + src_x;
+	if (mode != BLEND_TINT) {
+		for (int32_t y = 0; y < height; y++) {
+			blend_row(dst, image, src_index, width, mode, opacity);
+			dst += target->stride;
+			src_index += image->width;
+		}
+		return;
+	}
+
+	uint32_t amount = (opacity * 32 + 127) / 255;
+	for (int32_t y = 0; y < height; y++) {
+		for (int32_t x = 0; x < width; x++) {
+			uint32_t alpha = (image_alpha(image, src_index + x) + 4) >> 3;
+			if (alpha == 0) continue;
+			uint16_t src_color = blend_alpha(tint, swap_bytes(image->pixels[src_index + x]), amount);
+			dst[x] = swap_bytes(blend_alpha(src_color, swap_bytes(dst[x]), alpha));
+		}
+		dst += target->stride;
+		src_index += image->width;
+	}
+}
+
+// Color in native byte order, alpha in [0, 32]
+static void fill_blend_target(render_target_t *target, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t color, uint32_t alpha) {
+	if (!clip_rect(target, &x1, &y1, &x2, &y2)) return;
+	uint16_t *dst = target_pixel(target, x1, y1);
+	for (int32_t y = y1; y <= y2; y++) {
+		for (int32_t x = 0; x <= x2 - x1; x++) {
+			dst[x] = swap_bytes(blend_alpha(color, swap_bytes(dst[x]), alpha));
+		}
+		dst += target->stride;
+	}
+}
+
+// Filters scale each channel of a pixel as c * mul + add >> 8, where add
+// includes rounding. Fades and tints keep channels in range, brightness
+// above 1 has to saturate. add is repeated in both halves of the word.
+typedef struct {
+	uint32_t mul_r, mul_g, mul_b;
+	uint32_t add_r, add_g, add_b;
+	bool saturate;
+} filter_t;
+
+static inline uint32_t swap_pair(uint32_t pair) {
+	return ((pair >> 8) & 0x00ff00ffu) | ((pair & 0x00ff00ffu) << 8);
+}
+
+// Filters two byte swapped pixels in one 32-bit word. Each channel stays in
+// its 16-bit half, as no product exceeds 16 bits.
+static inline uint32_t filter_pair(uint32_t pair, const filter_t *filter) {
+	pair = swap_pair(pair);
+	uint32_t r = ((((pair >> 11) & 0x001f001fu) * filter->mul_r + filter->add_r) >> 8) & 0x00ff00ffu;
+	uint32_t g = ((((pair >> 5) & 0x003f003fu) * filter->mul_g + filter->add_g) >> 8) & 0x00ff00ffu;
+	uint32_t b = (((pair & 0x001f001fu) * filter->mul_b + filter->add_b) >> 8) & 0x00ff00ffu;
+	if (filter->saturate) {
+		// Scales are below 2, so only the bit above each channel can be set
+		r = (r | ((r >> 5) & 0x00010001u) * 0x1f) & 0x001f001fu;
+		g = (g | ((g >> 6) & 0x00010001u) * 0x3f) & 0x003f003fu;
+		b = (b | ((b >> 5) & 0x00010001u) * 0x1f) & 0x001f001fu;
 	}
-	if (dst_x2 >= (int32_t) display.width) dst_x2 = (int32_t) display.width - 1;
-	if (dst_y2 >= (int32_t) display.height) dst_y2 = (int32_t) display.height - 1;
+	return swap_pair(r << 11 | g << 5 | b);
+}
 
-	int32_t clipped_width = dst_x2 - dst_x1 + 1;
-	int32_t clipped_height = dst_y2 - dst_y1 + 1;
+// Moves two byte swapped pixels towards their luma by amount in [0, 256]
+static inline uint32_t grayscale_pair(uint32_t pair, uint32_t amount) {
+	pair = swap_pair(pair);
+	uint32_t r = (pair >> 11) & 0x001f001fu;
+	uint32_t g = (pair >> 5) & 0x003f003fu;
+	uint32_t b = pair & 0x001f001fu;
+	// 6 bit luma, red and blue count twice to match green's precision
+	uint32_t luma = ((r * 154 + g * 151 + b * 59 + 0x00800080u) >> 8) & 0x00ff00ffu;
+	uint32_t luma_5 = (luma >> 1) & 0x001f001fu;
+	uint32_t keep = 256 - amount;
+	r = ((r * keep + luma_5 * amount + 0x00800080u) >> 8) & 0x001f001fu;
+	g = ((g * keep + luma * amount + 0x00800080u) >> 8) & 0x003f003fu;
+	b = ((b * keep + luma_5 * amount + 0x00800080u) >> 8) & 0x001f001fu;
+	return swap_pair(r << 11 | g << 5 | b);
+}
 
-	uint16_t *dst_pixel = display.frame_buffer + dst_y1 * display.width + dst_x1;
-	uint16_t *src_pixel = src->pixels + src_y1 * src->width + src_x1;
+// Filter rows use the same 16-bit lane math as the 32-bit words above, on
+// 8 pixels at once with SSE2 or NEON.
+#if defined(__SSE2__) || defined(_M_X64)
+static inline __m128i swap_lanes(__m128i pixels) {
+	return _mm_or_si128(_mm_srli_epi16(pixels, 8), _mm_slli_epi16(pixels, 8));
+}
 
-	for (int32_t row = 0; row < clipped_height; row++) {
-		memcpy(dst_pixel, src_pixel, clipped_width * sizeof(uint16_t));
-		dst_pixel += display.width;
-		src_pixel += src->width;
+static void filter_row(uint16_t *dst, int32_t width, const filter_t *filter) {
+	int32_t x = 0;
+	const __m128i mask_5 = _mm_set1_epi16(0x1f);
+	const __m128i mask_6 = _mm_set1_epi16(0x3f);
+	const __m128i mul_r = _mm_set1_epi16((int16_t) filter->mul_r);
+	const __m128i mul_g = _mm_set1_epi16((int16_t) filter->mul_g);
+	const __m128i mul_b = _mm_set1_epi16((int16_t) filter->mul_b);
+	const __m128i add_r = _mm_set1_epi16((int16_t) filter->add_r);
+	const __m128i add_g = _mm_set1_epi16((int16_t) filter->add_g);
+	const __m128i add_b = _mm_set1_epi16((int16_t) filter->add_b);
+	for (; x + 8 <= width; x += 8) {
+		__m128i pixels = swap_lanes(_mm_loadu_si128((const __m128i *) (dst + x)));
+		__m128i r = _mm_srli_epi16(pixels, 11);
+		__m128i g = _mm_and_si128(_mm_srli_epi16(pixels, 5), mask_6);
+		__m128i b = _mm_and_si128(pixels, mask_5);
+		r = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(r, mul_r), add_r), 8);
+		g = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(g, mul_g), add_g), 8);
+		b = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(b, mul_b), add_b), 8);
+		if (filter->saturate) {
+			r = _mm_min_epi16(r, mask_5);
+			g = _mm_min_epi16(g, mask_6);
+			b = _mm_min_epi16(b, mask_5);
+		}
+		pixels = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(r, 11), _mm_slli_epi16(g, 5)), b);
+		_mm_storeu_si128((__m128i *) (dst + x), swap_lanes(pixels));
+	}
+	for (; x < width; x++) {
+		dst[x] = (uint16_t) filter_pair(dst[x], filter);
 	}
 }
 
-void mcugdx_display_blit_keyed(mcugdx_image_t *src, int32_t x, int32_t y, uint16_t color_key) {
-	int32_t dst_x1 = (x < 0) ? 0 : x;
-	int32_t dst_y1 = (y < 0) ? 0 : y;
-	int32_t dst_x2 = (x + src->width > display.width) ? display.width - 1 : x + src->width - 1;
-	int32_t dst_y2 = (y + src->height > display.height) ? display.height - 1 : y + src->height - 1;
-
-	if (dst_x1 >= (int32_t) display.width || dst_x2 < 0 || dst_y1 >= (int32_t) display.height || dst_y2 < 0) return;
-
-	int32_t src_x1 = (x < 0) ? -x : 0;
-	int32_t src_y1 = (y < 0) ? -y : 0;
-	int32_t clipped_width = dst_x2 - dst_x1 + 1;
-	int32_t dst_next_row = display.width - clipped_width;
-	int32_t src_next_row = src->width - clipped_width;
-
-	uint32_t *dst_pixel32 = (uint32_t *) (display.frame_buffer + dst_y1 * display.width + dst_x1);
-	uint32_t *src_pixel32 = (uint32_t *) (src->pixels + src_y1 * src->width + src_x1);
-
-	uint32_t color_key32 = (color_key << 16) | (color_key);
-	for (y = dst_y1; y <= dst_y2; y++) {
-		x = 0;
-		for (; x < clipped_width - 3; x += 4) {
-			uint32_t src_colors1 = *src_pixel32++;
-			uint32_t src_colors2 = *src_pixel32++;
-			uint32_t dst_colors1 = *dst_pixel32;
-			uint32_t dst_colors2 = *(dst_pixel32 + 1);
-
-			if (src_colors1 != color_key32) {
-				if ((src_colors1 & 0xFFFF) != color_key) {
-					dst_colors1 = (dst_colors1 & 0xFFFF0000) | (src_colors1 & 0xFFFF);
-				}
-				if ((src_colors1 >> 16) != color_key) {
-					dst_colors1 = (dst_colors1 & 0x0000FFFF) | (src_colors1 & 0xFFFF0000);
-				}
-				*dst_pixel32++ = dst_colors1;
+static void grayscale_row(uint16_t *dst, int32_t width, uint32_t amount) {
+	int32_t x = 0;
+	const __m128i mask_5 = _mm_set1_epi16(0x1f);
+	const __m128i mask_6 = _mm_set1_epi16(0x3f);
+	const __m128i round = _mm_set1_epi16(0x80);
+	const __m128i keep = _mm_set1_epi16((int16_t) (256 - amount));
+	const __m128i move = _mm_set1_epi16((int16_t) amount);
+	for (; x + 8 <= width; x += 8) {
+		__m128i pixels = swap_lanes(_mm_loadu_si128((const __m128i *) (dst + x)));
+		__m128i r = _mm_srli_epi16(pixels, 11);
+		__m128i g = _mm_and_si128(_mm_srli_epi16(pixels, 5), mask_6);
+		__m128i b = _mm_and_si128(pixels, mask_5);
+		__m128i luma = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(154)), _mm_mullo_epi16(g, _mm_set1_epi16(151)));
+		luma = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(luma, _mm_mullo_epi16(b, _mm_set1_epi16(59))), round), 8);
+		__m128i luma_5 = _mm_mullo_epi16(_mm_srli_epi16(luma, 1), move);
+		luma = _mm_mullo_epi16(luma, move);
+		r = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, keep), luma_5), round), 8);
+		g = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(g, keep), luma), round), 8);
+		b = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(b, keep), luma_5), round), 8);
+		pixels = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(r, 11), _mm_slli_epi16(g, 5)), b);
+		_mm_storeu_si128((__m128i *) (dst + x), swap_lanes(pixels));
+	}
+	for (; x < width; x++) {
+		dst[x] = (uint16_t) grayscale_pair(dst[x], amount);
+	}
+}
+#elif defined(__ARM_NEON)
+static inline uint16x8_t load_swapped(const uint16_t *src) {
+	return vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8((const uint8_t *) src)));
+}
+
+static inline void store_swapped(uint16_t *dst, uint16x8_t pixels) {
+	vst1q_u8((uint8_t *) dst, vrev16q_u8(vreinterpretq_u8_u16(pixels)));
+}
+
+static void filter_row(uint16_t *dst, int32_t width, const filter_t *filter) {
+	int32_t x = 0;
+	const uint16x8_t mask_5 = vdupq_n_u16(0x1f);
+	const uint16x8_t mask_6 = vdupq_n_u16(0x3f);
+	const uint16x8_t add_r = vdupq_n_u16((uint16_t) filter->add_r);
+	const uint16x8_t add_g = vdupq_n_u16((uint16_t) filter->add_g);
+	const uint16x8_t add_b = vdupq_n_u16((uint16_t) filter->add_b);
+	for (; x + 8 <= width; x += 8) {
+		uint16x8_t pixels = load_swapped(dst + x);
+		uint16x8_t r = vshrq_n_u16(pixels, 11);
+		uint16x8_t g = vandq_u16(vshrq_n_u16(pixels, 5), mask_6);
+		uint16x8_t b = vandq_u16(pixels, mask_5);
+		r = vshrq_n_u16(vmlaq_n_u16(add_r, r, (uint16_t) filter->mul_r), 8);
+		g = vshrq_n_u16(vmlaq_n_u16(add_g, g, (uint16_t) filter->mul_g), 8);
+		b = vshrq_n_u16(vmlaq_n_u16(add_b, b, (uint16_t) filter->mul_b), 8);
+		if (filter->saturate) {
+			r = vminq_u16(r, mask_5);
+			g = vminq_u16(g, mask_6);
+			b = vminq_u16(b, mask_5);
+		}
+		store_swapped(dst + x, vorrq_u16(vorrq_u16(vshlq_n_u16(r, 11), vshlq_n_u16(g, 5)), b));
+	}
+	for (; x < width; x++) {
+		dst[x] = (uint16_t) filter_pair(dst[x], filter);
+	}
+}
+
+static void grayscale_row(uint16_t *dst, int32_t width, uint32_t amount) {
+	int32_t x = 0;
+	const uint16x8_t mask_5 = vdupq_n_u16(0x1f);
+	const uint16x8_t mask_6 = vdupq_n_u16(0x3f);
+	const uint16x8_t round = vdupq_n_u16(0x80);
+	const uint16_t keep = (uint16_t) (256 - amount);
+	for (; x + 8 <= width; x += 8) {
+		uint16x8_t pixels = load_swapped(dst + x);
+		uint16x8_t r = vshrq_n_u16(pixels, 11);
+		uint16x8_t g = vandq_u16(vshrq_n_u16(pixels, 5), mask_6);
+		uint16x8_t b = vandq_u16(pixels, mask_5);
+		uint16x8_t luma = vmlaq_n_u16(vmlaq_n_u16(vmlaq_n_u16(round, r, 154), g, 151), b, 59);
+		luma = vshrq_n_u16(luma, 8);
+		uint16x8_t luma_5 = vmlaq_n_u16(round, vshrq_n_u16(luma, 1), (uint16_t) amount);
+		luma = vmlaq_n_u16(round, luma, (uint16_t) amount);
+		r = vshrq_n_u16(vmlaq_n_u16(luma_5, r, keep), 8);
+		g = vshrq_n_u16(vmlaq_n_u16(luma, g, keep), 8);
+		b = vshrq_n_u16(vmlaq_n_u16(luma_5, b, keep), 8);
+		store_swapped(dst + x, vorrq_u16(vorrq_u16(vshlq_n_u16(r, 11), vshlq_n_u16(g, 5)), b));
+	}
+	for (; x < width; x++) {
+		dst[x] = (uint16_t) grayscale_pair(dst[x], amount);
+	}
+}
+#else
+static void filter_row(uint16_t *dst, int32_t width, const filter_t *filter) {
+	if (((uintptr_t) dst & 2) && width > 0) {
+		*dst = (uint16_t) filter_pair(*dst, filter);
+		dst++;
+		width--;
+	}
+	uint32_t *dst32 = (uint32_t *) dst;
+	for (int32_t x = 0; x < width / 2; x++, dst32++) {
+		*dst32 = filter_pair(*dst32, filter);
+	}
+	if (width & 1) dst[width - 1] = (uint16_t) filter_pair(dst[width - 1], filter);
+}
+
+static void grayscale_row(uint16_t *dst, int32_t width, uint32_t amount) {
+	if (((uintptr_t) dst & 2) && width > 0) {
+		*dst = (uint16_t) grayscale_pair(*dst, amount);
+		dst++;
+		width--;
+	}
+	uint32_t *dst32 = (uint32_t *) dst;
+	for (int32_t x = 0; x < width / 2; x++, dst32++) {
+		*dst32 = grayscale_pair(*dst32, amount);
+	}
+	if (width & 1) dst[width - 1] = (uint16_t) grayscale_pair(dst[width - 1], amount);
+}
+#endif
+
+// Color in native byte order, amount in [0, 255], see mcugdx_filter_t
+static void filter_target(render_target_t *target, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint8_t type, uint16_t color, uint8_t amount) {
+	if (!clip_rect(target, &x1, &y1, &x2, &y2)) return;
+
+	filter_t filter = {256, 256, 256, 0x00800080u, 0x00800080u, 0x00800080u, false};
+	uint32_t r = color >> 11, g = (color >> 5) & 0x3f, b = color & 0x1f;
+	switch (type) {
+		case MCUGDX_FILTER_FADE:
+			filter.mul_r = filter.mul_g = filter.mul_b = 256 - amount;
+			filter.add_r = (r * amount + 0x80) * 0x10001u;
+			filter.add_g = (g * amount + 0x80) * 0x10001u;
+			filter.add_b = (b * amount + 0x80) * 0x10001u;
+			break;
+		case MCUGDX_FILTER_BRIGHTNESS:
+			filter.mul_r = filter.mul_g = filter.mul_b = amount * 2;
+			filter.saturate = amount > 128;
+			break;
+		case MCUGDX_FILTER_TINT:
+			// Multiplying by (c + 1) / 32 or / 64, blended with 1 by amount
+			filter.mul_r = ((r + 1) * 8 * amount + 256 * (256 - amount) + 0x80) >> 8;
+			filter.mul_g = ((g + 1) * 4 * amount + 256 * (256 - amount) + 0x80) >> 8;
+			filter.mul_b = ((b + 1) * 8 * amount + 256 * (256 - amount) + 0x80) >> 8;
+			break;
+	}
+
+	uint16_t *dst = target_pixel(target, x1, y1);
+	for (int32_t y = y1; y <= y2; y++) {
+		if (type == MCUGDX_FILTER_GRAYSCALE) {
+			grayscale_row(dst, x2 - x1 + 1, amount);
+		} else {
+			filter_row(dst, x2 - x1 + 1, &filter);
+		}
+		dst += target->stride;
+	}
+}
+
+// Looks up the indices through the palette, skipping the transparent index,
+// which is NO_TRANSPARENT_INDEX to draw all pixels. 4 bit images are read a
+// byte, so two pixels, at a time.
+static void indexed_target(render_target_t *target, mcugdx_indexed_image_t *image, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t width, int32_t height, const uint16_t *palette, uint32_t transparent) {
+	if (!clip_region(target, (int32_t) image->width, (int32_t) image->height, &dst_x, &dst_y, &src_x, &src_y, &width, &height)) return;
+
+	uint16_t *dst = target_pixel(target, dst_x, dst_y);
+	for (int32_t y = src_y; y < src_y + height; y++, dst += target->stride) {
+		uint32_t index = y * image->width + src_x;
+		if (image->bits_per_pixel == 8) {
+			const uint8_t *src = image->indices + index;
+			if (transparent == NO_TRANSPARENT_INDEX) {
+				for (int32_t x = 0; x < width; x++) dst[x] = palette[src[x]];
 			} else {
-				dst_pixel32++;
+				for (int32_t x = 0; x < width; x++) {
+					if (src[x] != transparent) dst[x] = palette[src[x]];
+				}
 			}
+			continue;
+		}
 
-			if (src_colors2 != color_key32) {
-				if ((src_colors2 & 0xFFFF) != color_key) {
-					dst_colors2 = (dst_colors2 & 0xFFFF0000) | (src_colors2 & 0xFFFF);
-				}
-				if ((src_colors2 >> 16) != color_key) {
-					dst_colors2 = (dst_colors2 & 0x0000FFFF) | (src_colors2 & 0xFFFF0000);
+		int32_t x = 0;
+		const uint8_t *src = image->indices + (index >> 1);
+		if (index & 1) {
+			uint32_t i = *src++ >> 4;
+			if (i != transparent) dst[0] = palette[i];
+			x++;
+		}
+		for (; x + 1 < width; x += 2) {
+			uint32_t pair = *src++;
+			if ((pair & 0xf) != transparent) dst[x] = palette[pair & 0xf];
+			if ((pair >> 4) != transparent) dst[x + 1] = palette[pair >> 4];
+		}
+		if (x < width && (*src & 0xf) != transparent) dst[x] = palette[*src & 0xf];
+	}
+}
+
+// Draws the pixels covered by the image's spans, or all pixels if it has none,
+// in color. Runs without an alpha plane are filled, otherwise the alpha is the
+// coverage of each pixel.
+static void mask_target(render_target_t *target, mcugdx_image_t *image, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t width, int32_t height, uint16_t color) {
+	if (!clip_blit(target, image, &dst_x, &dst_y, &src_x, &src_y, &width, &height)) return;
+
+	uint16_t swapped = swap_bytes(color);
+	uint16_t *dst = target_pixel(target, dst_x, dst_y);
+	int32_t src_x2 = src_x + width;
+	mcugdx_image_span_t row = {(uint16_t) src_x, (uint16_t) width};
+	for (int32_t y = src_y; y < src_y + height; y++, dst += target->stride) {
+		mcugdx_image_span_t *span = image->spans ? image->spans + image->row_spans[y] : &row;
+		mcugdx_image_span_t *end = image->spans ? image->spans + image->row_spans[y + 1] : &row + 1;
+		for (; span < end && span->x < src_x2; span++) {
+			int32_t x1 = span->x > src_x ? span->x : src_x;
+			int32_t x2 = span->x + span->width < src_x2 ? span->x + span->width : src_x2;
+			if (x1 >= x2) continue;
+			if (!image->alpha) {
+				fill_row(dst + x1 - src_x, x2 - x1, swapped);
+				continue;
+			}
+			uint32_t index = y * image->width + x1;
+			for (int32_t x = x1; x < x2; x++, index++) {
+				uint32_t alpha = (image_alpha(image, index) + 4) >> 3;
+				uint16_t *pixel = dst + x - src_x;
+				if (alpha == 32) {
+					*pixel = swapped;
+				} else if (alpha > 0) {
+					*pixel = swap_bytes(blend_alpha(color, swap_bytes(*pixel), alpha));
 				}
-				*dst_pixel32++ = dst_colors2;
-			} else {
-				dst_pixel32++;
 			}
 		}
+	}
+}
 
-		for (; x < clipped_width; x++) {
-			uint16_t src_color = ((uint16_t *) src_pixel32)[0];
-			if (src_color != color_key) {
-				((uint16_t *) dst_pixel32)[0] = src_color;
+// Rows where the source row doesn't change, which is every row of unrotated
+// blits. Flips and integer scales copy or repeat pixels without stepping u.
+// du is rounded, so integer scales other than powers of two come as repeat.
+static void transform_row_aligned(uint16_t *dst, const uint16_t *src, int32_t u, int32_t du, int32_t repeat, int32_t width, bool keyed, uint16_t color_key) {
+	if (du == 0x10000) {
+		if (keyed) {
+			blit_row_keyed(dst, src + (u >> 16), width, color_key);
+		} else {
+			memcpy(dst, src + (u >> 16), width * sizeof(uint16_t));
+		}
+		return;
+	}
+
+	if (du == -0x10000) {
+		src += u >> 16;
+		if (keyed) {
+			for (int32_t x = 0; x < width; x++) {
+				uint16_t color = src[-x];
+				if (color != color_key) dst[x] = color;
 			}
-			dst_pixel32 = (uint32_t *) ((uint16_t *) dst_pixel32 + 1);
-			src_pixel32 = (uint32_t *) ((uint16_t *) src_pixel32 + 1);
+		} else {
+			for (int32_t x = 0; x < width; x++) dst[x] = src[-x];
 		}
+		return;
+	}
 
-		dst_pixel32 = (uint32_t *) ((uint16_t *) dst_pixel32 + dst_next_row);
-		src_pixel32 = (uint32_t *) ((uint16_t *) src_pixel32 + src_next_row);
+	int32_t step = du < 0 ? -du : du;
+	if (repeat == 0 && step < 0x10000 && 0x10000 % step == 0) repeat = 0x10000 / step;
+	if (repeat > 1) {
+		// Scaled up by an integer factor, the first source pixel may be partially done
+		int32_t done = (int32_t) (((uint32_t) u & 0xffff) * repeat >> 16);
+		int32_t count = du > 0 ? repeat - done : done + 1;
+		int32_t direction = du > 0 ? 1 : -1;
+		src += u >> 16;
+		for (int32_t x = 0; x < width; src += direction, count = repeat) {
+			uint16_t color = *src;
+			if (count > width - x) count = width - x;
+			if (!keyed || color != color_key) {
+				for (int32_t i = 0; i < count; i++) dst[x + i] = color;
+			}
+			x += count;
+		}
+		return;
+	}
+
+	for (int32_t x = 0; x < width; x++, u += du) {
+		uint16_t color = src[u >> 16];
+		if (!keyed || color != color_key) dst[x] = color;
 	}
 }
 
-void mcugdx_display_blit_region(mcugdx_image_t *src, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height) {
-	if (src_width <= 0 || src_height <= 0) return;
+static inline int64_t floor_div(int64_t a, int64_t b) {
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// Narrows [*k1, *k2] to the steps k for which start + k * step is in [min, max)
+static inline void clip_steps(int64_t start, int32_t step, int64_t min, int64_t max, int64_t *k1, int64_t *k2) {
+	if (step == 0) {
+		if (start < min || start >= max) *k2 = *k1 - 1;
+		return;
+	}
+	int64_t first, last;
+	if (step > 0) {
+		first = -floor_div(start - min, step);
+		last = floor_div(max - 1 - start, step);
+	} else {
+		first = -floor_div(max - 1 - start, -step);
+		last = floor_div(start - min, -step);
+	}
+	if (first > *k1) *k1 = first;
+	if (last < *k2) *k2 = last;
+}
+
+// Draws the transformed image into the part of the destination rect x1, y1 to
+// x2, y2 inside the target's clip rect. Each row is clipped to the span mapping
+// into the source rect up front, so the inner loops need no bounds checks.
+static void transform_target(render_target_t *target, mcugdx_image_t *image, int32_t x1, int32_t y1, int32_t x2, int32_t y2, transform_t *transform, bool keyed, uint16_t color_key) {
+	int32_t cx1 = x1, cy1 = y1, cx2 = x2, cy2 = y2;
+	if (!clip_rect(target, &cx1, &cy1, &cx2, &cy2)) return;
+
+	int64_t u_min = (int64_t) transform->src_x1 << 16, u_max = (int64_t) transform->src_x2 << 16;
+	int64_t v_min = (int64_t) transform->src_y1 << 16, v_max = (int64_t) transform->src_y2 << 16;
+	for (int32_t y = cy1; y <= cy2; y++) {
+		int64_t u = transform->u + (int64_t) (y - y1) * transform->du_dy + (int64_t) (cx1 - x1) * transform->du_dx;
+		int64_t v = transform->v + (int64_t) (y - y1) * transform->dv_dy + (int64_t) (cx1 - x1) * transform->dv_dx;
+		int64_t k1 = 0, k2 = cx2 - cx1;
+		clip_steps(u, transform->du_dx, u_min, u_max, &k1, &k2);
+		clip_steps(v, transform->dv_dx, v_min, v_max, &k1, &k2);
+		if (k1 > k2) continue;
+
+		uint16_t *dst = target_pixel(target, cx1 + (int32_t) k1, y);
+		int32_t row_u = (int32_t) (u + k1 * transform->du_dx);
+		int32_t row_v = (int32_t) (v + k1 * transform->dv_dx);
+		int32_t width = (int32_t) (k2 - k1 + 1);
+		if (transform->dv_dx == 0) {
+			transform_row_aligned(dst, image->pixels + (row_v >> 16) * image->width, row_u, transform->du_dx, transform->repeat_x, width, keyed, color_key);
+			continue;
+		}
+		for (int32_t x = 0; x < width; x++, row_u += transform->du_dx, row_v += transform->dv_dx) {
+			uint16_t color = image->pixels[(row_v >> 16) * image->width + (row_u >> 16)];
+			if (!keyed || color != color_key) dst[x] = color;
+		}
+	}
+}
+
+static void fill(int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t color) {
+	render_target_t screen = draw_target();
+	if (!clip_rect(&screen, &x1, &y1, &x2, &y2)) return;
+	mark_dirty(x1, y1, x2, y2);
+
+	if (recording()) {
+		record(COMMAND_FILL, color, x1, y1, x2, y2, NULL, 0, 0);
+	} else {
+		fill_target(&screen, x1, y1, x2, y2, color);
+	}
+}
 
-	int32_t dst_x2 = dst_x + src_width - 1;
-	int32_t dst_y2 = dst_y + src_height - 1;
+// Fills with color in native byte order blended at alpha in [0, 32], used for
+// the edges of anti-aliased primitives
+static void fill_blend(int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t color, uint32_t alpha) {
+	if (alpha == 0) return;
+	if (alpha >= 32) {
+		fill(x1, y1, x2, y2, swap_bytes(color));
+		return;
+	}
 
-	int32_t clip_left = (dst_x < 0) ? -dst_x : 0;
-	int32_t clip_top = (dst_y < 0) ? -dst_y : 0;
-	int32_t clip_right = (dst_x2 >= (int32_t) display.width) ? (int32_t) display.width - dst_x - 1 : src_width - 1;
-	int32_t clip_bottom = (dst_y2 >= (int32_t) display.height) ? (int32_t) display.height - dst_y - 1 : src_height - 1;
+	render_target_t screen = draw_target();
+	if (!clip_rect(&screen, &x1, &y1, &x2, &y2)) return;
+	mark_dirty(x1, y1, x2, y2);
 
-	if (clip_left > clip_right || clip_top > clip_bottom) return;
+	if (recording()) {
+		draw_command_t *command = record(COMMAND_FILL_BLEND, color, x1, y1, x2, y2, NULL, 0, 0);
+		if (command) command->opacity = (uint8_t) alpha;
+	} else {
+		fill_blend_target(&screen, x1, y1, x2, y2, color, alpha);
+	}
+}
+
+static void blit(mcugdx_image_t *image, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t width, int32_t height, bool keyed, uint16_t color_key) {
+	render_target_t screen = draw_target();
+	if (!clip_blit(&screen, image, &dst_x, &dst_y, &src_x, &src_y, &width, &height)) return;
+	mark_dirty(dst_x, dst_y, dst_x + width - 1, dst_y + height - 1);
 
-	int32_t clipped_width = clip_right - clip_left + 1;
-	int32_t clipped_height = clip_bottom - clip_top + 1;
+	if (recording()) {
+		record(keyed ? COMMAND_BLIT_KEYED : COMMAND_BLIT, color_key, dst_x, dst_y, dst_x + width - 1, dst_y + height - 1, image, src_x, src_y);
+	} else {
+		blit_target(&screen, image, dst_x, dst_y, src_x, src_y, width, height, keyed, color_key);
+	}
+}
+
+static void blend(mcugdx_image_t *image, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t width, int32_t height, uint8_t mode, uint8_t opacity, uint16_t tint) {
+	render_target_t screen = draw_target();
+	if (!clip_blit(&screen, image, &dst_x, &dst_y, &src_x, &src_y, &width, &height)) return;
+	mark_dirty(dst_x, dst_y, dst_x + width - 1, dst_y + height - 1);
+
+	if (recording()) {
+		draw_command_t *command = record(COMMAND_BLEND, tint, dst_x, dst_y, dst_x + width - 1, dst_y + height - 1, image, src_x, src_y);
+		if (!command) return;
+		command->blend_mode = mode;
+		command->opacity = opacity;
+	} else {
+		blend_target(&screen, image, dst_x, dst_y, src_x, src_y, width, height, mode, opacity, tint);
+	}
+}
 
-	src_x += clip_left;
-	src_y += clip_top;
-	dst_x += clip_left;
-	dst_y += clip_top;
+static void mask(mcugdx_image_t *image, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t width, int32_t height, uint16_t color) {
+	render_target_t screen = draw_target();
+	if (!clip_blit(&screen, image, &dst_x, &dst_y, &src_x, &src_y, &width, &height)) return;
+	mark_dirty(dst_x, dst_y, dst_x + width - 1, dst_y + height - 1);
 
-	uint16_t *dst_base = display.frame_buffer + dst_y * display.width + dst_x;
-	uint16_t *src_base = src->pixels + src_y * src->width + src_x;
+	if (recording()) {
+		record(COMMAND_MASK, color, dst_x, dst_y, dst_x + width - 1, dst_y + height - 1, image, src_x, src_y);
+	} else {
+		mask_target(&screen, image, dst_x, dst_y, src_x, src_y, width, height, color);
+	}
+}
 
-	if (clipped_width > 16) {
-		for (int32_t y = 0; y < clipped_height; y++) {
-			memcpy(dst_base, src_base, clipped_width * sizeof(uint16_t));
-			dst_base += display.width;
-			src_base += src->width;
+static void indexed(mcugdx_indexed_image_t *image, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t width, int32_t height, const uint16_t *palette, uint32_t flags, uint16_t color_key) {
+	// Transparency is a property of the pixels, so the key is looked up in the
+	// image's own palette, whatever palette it is drawn with
+	uint32_t transparent = NO_TRANSPARENT_INDEX;
+	if (flags & MCUGDX_BLIT_KEYED) {
+		for (uint32_t i = 0; i < (1u << image->bits_per_pixel) && transparent == NO_TRANSPARENT_INDEX; i++) {
+			if (image->palette[i] == color_key) transparent = i;
 		}
+	}
+	if (!palette) palette = image->palette;
+
+	render_target_t screen = draw_target();
+	if (!clip_region(&screen, (int32_t) image->width, (int32_t) image->height, &dst_x, &dst_y, &src_x, &src_y, &width, &height)) return;
+	mark_dirty(dst_x, dst_y, dst_x + width - 1, dst_y + height - 1);
+
+	if (recording()) {
+		draw_command_t *command = record(COMMAND_INDEXED, (uint16_t) transparent, dst_x, dst_y, dst_x + width - 1, dst_y + height - 1, NULL, src_x, src_y);
+		if (!command) return;
+		command->indexed = image;
+		command->palette = palette;
 	} else {
-		uint32_t *dst_word = (uint32_t *) dst_base;
-		uint32_t *src_word = (uint32_t *) src_base;
-		int32_t dst_stride = display.width / 2;
-		int32_t src_stride = src->width / 2;
-		int32_t word_width = clipped_width / 2;
-		int32_t remainder = clipped_width % 2;
-
-		for (int32_t y = 0; y < clipped_height; y++) {
-			for (int32_t x = 0; x < word_width; x++) {
-				dst_word[x] = src_word[x];
+		indexed_target(&screen, image, dst_x, dst_y, src_x, src_y, width, height, palette, transparent);
+	}
+}
+
+// Draws the destination rect x1, y1 to x2, y2 with the transform given for x1, y1
+static void transform(mcugdx_image_t *image, int32_t x1, int32_t y1, int32_t x2, int32_t y2, transform_t *transform, bool keyed, uint16_t color_key) {
+	if (transform->src_x1 < 0) transform->src_x1 = 0;
+	if (transform->src_y1 < 0) transform->src_y1 = 0;
+	if (transform->src_x2 > (int32_t) image->width) transform->src_x2 = (int32_t) image->width;
+	if (transform->src_y2 > (int32_t) image->height) transform->src_y2 = (int32_t) image->height;
+	if (transform->src_x1 >= transform->src_x2 || transform->src_y1 >= transform->src_y2) return;
+
+	// Keep the mapping, but move the transform's origin to the clipped rect
+	render_target_t screen = draw_target();
+	int32_t cx1 = x1, cy1 = y1;
+	if (!clip_rect(&screen, &cx1, &cy1, &x2, &y2)) return;
+	transform->u += (int32_t) ((int64_t) (cx1 - x1) * transform->du_dx + (int64_t) (cy1 - y1) * transform->du_dy);
+	transform->v += (int32_t) ((int64_t) (cx1 - x1) * transform->dv_dx + (int64_t) (cy1 - y1) * transform->dv_dy);
+	mark_dirty(cx1, cy1, x2, y2);
+
+	if (recording()) {
+		if (num_transforms == transform_capacity) {
+			uint32_t new_capacity = transform_capacity ? transform_capacity * 2 : INITIAL_COMMAND_CAPACITY / 4;
+			if (new_capacity > UINT16_MAX + 1) {
+				mcugdx_loge(TAG, "At most %li transformed blits can be recorded", (uint32_t) UINT16_MAX + 1);
+				return;
+			}
+			transform_t *new_transforms = mcugdx_mem_alloc(new_capacity * sizeof(transform_t), MCUGDX_MEM_INTERNAL);
+			if (!new_transforms) {
+				mcugdx_loge(TAG, "Could not grow transform buffer to %li transforms", new_capacity);
+				return;
 			}
-			if (remainder) {
-				((uint16_t *) (&dst_word[word_width]))[0] = ((uint16_t *) (&src_word[word_width]))[0];
+			if (transforms) {
+				memcpy(new_transforms, transforms, num_transforms * sizeof(transform_t));
+				mcugdx_mem_free(transforms);
 			}
-			dst_word += dst_stride;
-			src_word += src_stride;
+			transforms = new_transforms;
+			transform_capacity = new_capacity;
 		}
+		draw_command_t *command = record(keyed ? COMMAND_TRANSFORM_KEYED : COMMAND_TRANSFORM, color_key, cx1, cy1, x2, y2, image, 0, 0);
+		if (!command) return;
+		command->transform = (uint16_t) num_transforms;
+		transforms[num_transforms++] = *transform;
+	} else {
+		transform_target(&screen, image, cx1, cy1, x2, y2, transform, keyed, color_key);
 	}
 }
 
-void mcugdx_display_blit_region_keyed(mcugdx_image_t *src, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height, uint16_t color_key) {
-	int32_t clip_src_x = src_x;
-	int32_t clip_src_y = src_y;
-	int32_t clip_dst_x = dst_x;
-	int32_t clip_dst_y = dst_y;
-	int32_t clip_width = src_width;
-	int32_t clip_height = src_height;
+static inline bool rect_contains(mcugdx_rect_t *outer, draw_command_t *command) {
+	return command->x >= outer->x && command->y >= outer->y &&
+		   command->x + command->width <= outer->x + outer->width &&
+		   command->y + command->height <= outer->y + outer->height;
+}
+
+// Drops commands that are completely overdrawn by a later opaque fill or blit.
+// Walks the list back to front, keeping the largest opaque rects seen so far as
+// occluders. Only single occluders are tested, a command covered by the union
+// of several rects survives, which is rare enough not to matter.
+static void cull_occluded_commands(void) {
+	mcugdx_rect_t occluders[MAX_OCCLUDERS];
+	uint32_t num_occluders = 0;
+	uint32_t kept = num_commands;
+
+	for (int32_t i = (int32_t) num_commands - 1; i >= 0; i--) {
+		draw_command_t *command = &commands[i];
+		bool occluded = false;
+		for (uint32_t j = 0; j < num_occluders && !occluded; j++) {
+			occluded = rect_contains(&occluders[j], command);
+		}
+		if (occluded) continue;
+		commands[--kept] = *command;
+
+		bool opaque = command->type == COMMAND_FILL || command->type == COMMAND_BLIT || (command->type == COMMAND_INDEXED && command->color == NO_TRANSPARENT_INDEX);
+		if (!opaque) continue;
+		mcugdx_rect_t rect = {command->x, command->y, command->width, command->height};
+		if (num_occluders < MAX_OCCLUDERS) {
+			occluders[num_occluders++] = rect;
+		} else {
+			uint32_t smallest = 0;
+			for (uint32_t j = 1; j < num_occluders; j++) {
+				if (rect_area(&occluders[j]) < rect_area(&occluders[smallest])) smallest = j;
+			}
+			if (rect_area(&rect) > rect_area(&occluders[smallest])) occluders[smallest] = rect;
+		}
+	}
+
+	num_commands -= kept;
+	memmove(commands, commands + kept, num_commands * sizeof(draw_command_t));
+}
+
+// Executes all commands overlapping the target's clip rect
+static void execute_commands(render_target_t *target, draw_command_t *list, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		draw_command_t *command = &list[i];
+		if (command->y > target->clip_y2 || command->y + command->height - 1 < target->clip_y1) continue;
+		switch (command->type) {
+			case COMMAND_FILL:
+				fill_target(target, command->x, command->y, command->x + command->width - 1, command->y + command->height - 1, command->color);
+				break;
+			case COMMAND_FILL_BLEND:
+				fill_blend_target(target, command->x, command->y, command->x + command->width - 1, command->y + command->height - 1, command->color, command->opacity);
+				break;
+			case COMMAND_BLIT:
+			case COMMAND_BLIT_KEYED:
+				blit_target(target, command->image, command->x, command->y, command->src_x, command->src_y, command->width, command->height, command->type == COMMAND_BLIT_KEYED, command->color);
+				break;
+			case COMMAND_BLEND:
+				blend_target(target, command->image, command->x, command->y, command->src_x, command->src_y, command->width, command->height, command->blend_mode, command->opacity, command->color);
+				break;
+			case COMMAND_TRANSFORM:
+			case COMMAND_TRANSFORM_KEYED:
+				transform_target(target, command->image, command->x, command->y, command->x + command->width - 1, command->y + command->height - 1, &transforms[command->transform], command->type == COMMAND_TRANSFORM_KEYED, command->color);
+				break;
+			case COMMAND_INDEXED:
+				indexed_target(target, command->indexed, command->x, command->y, command->src_x, command->src_y, command->width, command->height, command->palette, command->color);
+				break;
+			case COMMAND_MASK:
+				mask_target(target, command->image, command->x, command->y, command->src_x, command->src_y, command->width, command->height, command->color);
+				break;
+			case COMMAND_FILTER:
+				filter_target(target, command->x, command->y, command->x + command->width - 1, command->y + command->height - 1, command->blend_mode, command->color, command->opacity);
+				break;
+		}
+	}
+}
+
+// Moves count commands starting at start around so commands drawing the same
+// image follow each other, in the order the images were first used. Commands of
+// one image keep their order. The space behind the commands is used as scratch.
+static void group_by_image(uint32_t start, uint32_t count) {
+	draw_command_t *src = commands + start;
+	draw_command_t *dst = commands + start + count;
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		mcugdx_image_t *image = src[i].image;
+		if (!image) continue;
+		for (uint32_t j = i; j < count; j++) {
+			if (src[j].image != image) continue;
+			dst[n++] = src[j];
+			src[j].image = NULL;
+		}
+	}
+	memcpy(src, dst, count * sizeof(draw_command_t));
+}
+
+static uint32_t batch_start;
+
+// Renders the upper (part 0) or lower (part 1) half of the clip rect for the
+// batch recorded from batch_start on.
+static void execute_batch_part(uint32_t part) {
+	render_target_t target = draw_target();
+	int32_t split = (target.clip_y1 + target.clip_y2 + 1) / 2;
+	if (part == 0) {
+		target.clip_y2 = split - 1;
+	} else {
+		target.clip_y1 = split;
+	}
+	execute_commands(&target, commands + batch_start, num_commands - batch_start);
+}
+
+void mcugdx_display_begin_list(void) {
+	// Banded mode always records
+	if (display.band_height > 0) return;
+	recording_list = true;
+	clear_commands();
+}
+
+void mcugdx_display_end_list(void) {
+	if (!recording_list) return;
+	recording_list = false;
+	cull_occluded_commands();
+	render_target_t screen = screen_target();
+	execute_commands(&screen, commands, num_commands);
+	clear_commands();
+}
 
-	if (clip_src_x < 0) {
-		clip_width += clip_src_x;
-		clip_dst_x -= clip_src_x;
-		clip_src_x = 0;
+// Called by the platform's mcugdx_display_show() in banded mode for each band,
+// replays all recorded draw commands overlapping rows y to y + height - 1 into
+// the band's pixels.
+void mcugdx_display_render_band(uint16_t *pixels, int32_t y, int32_t height) {
+	if (!commands_culled) {
+		cull_occluded_commands();
+		commands_culled = true;
 	}
-	if (clip_src_y < 0) {
-		clip_height += clip_src_y;
-		clip_dst_y -= clip_src_y;
-		clip_src_y = 0;
+
+	render_target_t band = {
+			.pixels = pixels,
+			.stride = (int32_t) display.width,
+			.origin_y = y,
+			.clip_x1 = 0,
+			.clip_y1 = y,
+			.clip_x2 = (int32_t) display.width - 1,
+			.clip_y2 = y + height - 1};
+
+	// Start out black like the frame buffer would, unless a clear covers it anyway
+	draw_command_t *first = num_commands > 0 ? &commands[0] : NULL;
+	bool covered = first && first->type == COMMAND_FILL && first->width == (int32_t) display.width && first->height == (int32_t) display.height;
+	if (!covered) memset(pixels, 0, display.width * height * sizeof(uint16_t));
+
+	execute_commands(&band, commands, num_commands);
+}
+
+// Called by the platform's mcugdx_display_show() after the last band was sent.
+void mcugdx_display_end_bands(void) {
+	mcugdx_display_count_window(display.width, display.height);
+	clear_commands();
+	commands_culled = false;
+}
+
+bool mcugdx_display_push_clip(int32_t x, int32_t y, int32_t width, int32_t height) {
+	if (num_clips == MCUGDX_DISPLAY_MAX_CLIPS) {
+		mcugdx_loge(TAG, "At most %li clip rects can be pushed", (uint32_t) MCUGDX_DISPLAY_MAX_CLIPS);
+		return false;
 	}
 
-	if (clip_src_x + clip_width > (int32_t) src->width) {
-		clip_width = src->width - clip_src_x;
+	render_target_t current = draw_target();
+	clip_t *clip = &clips[num_clips++];
+	clip->x1 = x + translate_x;
+	clip->y1 = y + translate_y;
+	clip->x2 = clip->x1 + (width > 0 ? width : 0) - 1;
+	clip->y2 = clip->y1 + (height > 0 ? height : 0) - 1;
+	if (clip->x1 < current.clip_x1) clip->x1 = current.clip_x1;
+	if (clip->y1 < current.clip_y1) clip->y1 = current.clip_y1;
+	if (clip->x2 > current.clip_x2) clip->x2 = current.clip_x2;
+	if (clip->y2 > current.clip_y2) clip->y2 = current.clip_y2;
+	clip->translate_x = translate_x;
+	clip->translate_y = translate_y;
+	return true;
+}
+
+void mcugdx_display_pop_clip(void) {
+	if (num_clips == 0) return;
+	num_clips--;
+	translate_x = clips[num_clips].translate_x;
+	translate_y = clips[num_clips].translate_y;
+}
+
+void mcugdx_display_translate(int32_t x, int32_t y) {
+	translate_x += x;
+	translate_y += y;
+}
+
+void mcugdx_display_get_clip(mcugdx_rect_t *clip) {
+	render_target_t current = draw_target();
+	clip->x = current.clip_x1 - translate_x;
+	clip->y = current.clip_y1 - translate_y;
+	clip->width = current.clip_x2 >= current.clip_x1 ? current.clip_x2 - current.clip_x1 + 1 : 0;
+	clip->height = current.clip_y2 >= current.clip_y1 ? current.clip_y2 - current.clip_y1 + 1 : 0;
+}
+
+void mcugdx_display_set_target(mcugdx_image_t *image) {
+	target_image = image;
+}
+
+mcugdx_image_t *mcugdx_display_get_target(void) {
+	return target_image;
+}
+
+void mcugdx_display_clear(void) {
+	mcugdx_display_clear_color(0);
+}
+
+void mcugdx_display_clear_color(uint16_t color) {
+	render_target_t target = draw_target();
+	fill(target.clip_x1, target.clip_y1, target.clip_x2, target.clip_y2, swap_bytes(color));
+}
+
+void mcugdx_display_set_pixel(int32_t x, int32_t y, uint16_t color) {
+	x += translate_x;
+	y += translate_y;
+	fill(x, y, x, y, color);
+}
+
+void mcugdx_display_hline(int32_t x1, int32_t x2, int32_t y, uint16_t color) {
+	if (x1 > x2) {
+		int32_t tmp = x2;
+		x2 = x1;
+		x1 = tmp;
 	}
-	if (clip_src_y + clip_height > (int32_t) src->height) {
-		clip_height = src->height - clip_src_y;
+	fill(x1 + translate_x, y + translate_y, x2 + translate_x, y + translate_y, swap_bytes(color));
+}
+
+void mcugdx_display_rect(int32_t x1, int32_t y1, int32_t width, int32_t height, uint16_t color) {
+	if (width <= 0 || height <= 0) return;
+	x1 += translate_x;
+	y1 += translate_y;
+	fill(x1, y1, x1 + width - 1, y1 + height - 1, swap_bytes(color));
+}
+
+static inline int64_t ceil_div(int64_t a, int64_t b) {
+	return -floor_div(-a, b);
+}
+
+// Draws a line along its major axis a, on which it advances by at most one
+// pixel per step on the minor axis b, as one fill per run of pixels on the same
+// b. Runs are computed directly, so only the visible ones are visited.
+static void line_runs(int32_t a1, int32_t b1, int32_t a2, int32_t b2, bool steep, uint16_t color) {
+	if (a1 > a2) {
+		int32_t tmp = a1;
+		a1 = a2;
+		a2 = tmp;
+		tmp = b1;
+		b1 = b2;
+		b2 = tmp;
 	}
+	render_target_t screen = draw_target();
+	int32_t a_min = steep ? screen.clip_y1 : screen.clip_x1, a_max = steep ? screen.clip_y2 : screen.clip_x2;
+	int32_t b_min = steep ? screen.clip_x1 : screen.clip_y1, b_max = steep ? screen.clip_x2 : screen.clip_y2;
+	if (a2 < a_min || a1 > a_max) return;
 
-	if (clip_dst_x < 0) {
-		clip_width += clip_dst_x;
-		clip_src_x -= clip_dst_x;
-		clip_dst_x = 0;
+	// Pixel a is on b1 + step * k with k = floor((2 * (a - a1) * db + da) / (2 * da)),
+	// so run k starts at the first a where that reaches k
+	int64_t da = (int64_t) a2 - a1, db = b2 > b1 ? (int64_t) b2 - b1 : (int64_t) b1 - b2;
+	int32_t step = b2 >= b1 ? 1 : -1;
+	int64_t k1 = 0, k2 = db;
+	if (da > 0) {
+		if (a1 < a_min) k1 = floor_div(2 * (a_min - (int64_t) a1) * db + da, 2 * da);
+		if (a2 > a_max) k2 = floor_div(2 * (a_max - (int64_t) a1) * db + da, 2 * da);
 	}
-	if (clip_dst_y < 0) {
-		clip_height += clip_dst_y;
-		clip_src_y -= clip_dst_y;
-		clip_dst_y = 0;
+	int64_t visible_k1 = step > 0 ? (int64_t) b_min - b1 : (int64_t) b1 - b_max;
+	int64_t visible_k2 = step > 0 ? (int64_t) b_max - b1 : (int64_t) b1 - b_min;
+	if (visible_k1 > k1) k1 = visible_k1;
+	if (visible_k2 < k2) k2 = visible_k2;
+
+	for (int64_t k = k1; k <= k2; k++) {
+		int32_t start = k == 0 ? a1 : (int32_t) (a1 + ceil_div((2 * k - 1) * da, 2 * db));
+		int32_t end = k == db ? a2 : (int32_t) (a1 + ceil_div((2 * k + 1) * da, 2 * db) - 1);
+		int32_t b = (int32_t) (b1 + step * k);
+		if (steep) {
+			fill(b, start, b, end, color);
+		} else {
+			fill(start, b, end, b, color);
+		}
 	}
+}
 
-	if (clip_dst_x + clip_width > (int32_t) display.width) {
-		clip_width = display.width - clip_dst_x;
+// Rows y and -y of an ellipse, pixels start to end on both sides of the center
+static void ellipse_rows(int32_t cx, int32_t cy, int32_t y, int32_t start, int32_t end, uint16_t color) {
+	for (int32_t row = cy - y; row <= cy + y; row += y > 0 ? 2 * y : 1) {
+		if (start == 0) {
+			fill(cx - end, row, cx + end, row, color);
+		} else {
+			fill(cx - end, row, cx - start, row, color);
+			fill(cx + start, row, cx + end, row, color);
+		}
 	}
-	if (clip_dst_y + clip_height > (int32_t) display.height) {
-		clip_height = display.height - clip_dst_y;
+}
+
+// Pixels whose centers are inside the ellipse with radii rx + 0.5 and ry + 0.5.
+// The outline consists of the pixels of the filled ellipse that have a neighbor
+// outside of it. Row half widths shrink monotonically from the center row, so
+// all of them are found in one pass.
+static void ellipse(int32_t cx, int32_t cy, int32_t rx, int32_t ry, uint16_t color, bool filled) {
+	if (rx < 0 || ry < 0) return;
+	int64_t a = 2 * (int64_t) rx + 1, b = 2 * (int64_t) ry + 1;
+	int32_t width = rx;
+	for (int32_t y = 0; y <= ry; y++) {
+		int32_t next = width;
+		while (next >= 0 && 4 * (int64_t) next * next * b * b + 4 * (int64_t) (y + 1) * (y + 1) * a * a > a * a * b * b) next--;
+		int32_t start = filled ? 0 : next + 1 < width ? next + 1 : width;
+		ellipse_rows(cx, cy, y, start, width, color);
+		width = next;
 	}
+}
 
-	if (clip_width <= 0 || clip_height <= 0) {
+// Signed distance of dx, dy from the ellipse outline, approximated by the
+// implicit function divided by the length of its gradient
+static inline float ellipse_distance(float dx, float dy, float rx, float ry) {
+	float nx = dx / (rx * rx), ny = dy / (ry * ry);
+	float gradient = 2 * sqrtf(nx * nx + ny * ny);
+	return gradient > 0 ? (dx * nx + dy * ny - 1) / gradient : -rx;
+}
+
+// Half width of row dy of the ellipse, negative if the row is outside of it
+static inline float ellipse_half_width(int32_t dy, float rx, float ry) {
+	float t = 1 - (dy * dy) / (ry * ry);
+	return rx > 0 && ry > 0 && t >= 0 ? rx * sqrtf(t) : -1;
+}
+
+// Filled ellipses have their edge at the same radii as the aliased ones, outlines
+// are one pixel wide rings on rx, ry. Only the pixels between an inner and an
+// outer ellipse one pixel off the edge are blended, the rest is filled or skipped.
+static void ellipse_aa(int32_t cx, int32_t cy, int32_t rx, int32_t ry, uint16_t color, bool filled) {
+	if (rx < 1 || ry < 1) {
+		ellipse(cx, cy, rx, ry, swap_bytes(color), filled);
+		return;
+	}
+	render_target_t screen = draw_target();
+	float edge_rx = filled ? rx + 0.5f : (float) rx, edge_ry = filled ? ry + 0.5f : (float) ry;
+	for (int32_t dy = -ry - 1; dy <= ry + 1; dy++) {
+		int32_t y = cy + dy;
+		if (y < screen.clip_y1 || y > screen.clip_y2) continue;
+		int32_t outer = (int32_t) ceilf(ellipse_half_width(dy, edge_rx + 1, edge_ry + 1));
+		float inner_width = ellipse_half_width(dy, edge_rx - 1, edge_ry - 1);
+		int32_t inner = inner_width >= 0 ? (int32_t) inner_width : -1;
+		if (filled && inner >= 0) fill(cx - inner, y, cx + inner, y, swap_bytes(color));
+		for (int32_t dx = inner + 1; dx <= outer; dx++) {
+			float distance = ellipse_distance((float) dx, (float) dy, edge_rx, edge_ry);
+			float coverage = filled ? 0.5f - distance : 1 - fabsf(distance);
+			uint32_t alpha = coverage <= 0 ? 0 : coverage >= 1 ? 32 : (uint32_t) (coverage * 32 + 0.5f);
+			fill_blend(cx + dx, y, cx + dx, y, color, alpha);
+			if (dx > 0) fill_blend(cx - dx, y, cx - dx, y, color, alpha);
+		}
+	}
+}
+
+void mcugdx_display_line(int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t color) {
+	x1 += translate_x;
+	y1 += translate_y;
+	x2 += translate_x;
+	y2 += translate_y;
+	int32_t dx = x2 > x1 ? x2 - x1 : x1 - x2;
+	int32_t dy = y2 > y1 ? y2 - y1 : y1 - y2;
+	if (dx >= dy) {
+		line_runs(x1, y1, x2, y2, false, swap_bytes(color));
+	} else {
+		line_runs(y1, x1, y2, x2, true, swap_bytes(color));
+	}
+}
+
+void mcugdx_display_line_aa(int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t color) {
+	int32_t dx = x2 > x1 ? x2 - x1 : x1 - x2;
+	int32_t dy = y2 > y1 ? y2 - y1 : y1 - y2;
+	if (dx == 0 || dy == 0 || dx == dy) {
+		mcugdx_display_line(x1, y1, x2, y2, color);
 		return;
 	}
+	x1 += translate_x;
+	y1 += translate_y;
+	x2 += translate_x;
+	y2 += translate_y;
 
-	uint16_t *src_row = &src->pixels[clip_src_y * src->width + clip_src_x];
-	uint16_t *dst_row = &display.frame_buffer[clip_dst_y * display.width + clip_dst_x];
-	int32_t src_stride = src->width;
-	int32_t dst_stride = display.width;
+	// Xiaolin Wu: step along the major axis a and split each pixel between
+	// the two pixels on the minor axis b the line passes between
+	bool steep = dy > dx;
+	int32_t a1 = steep ? y1 : x1, b1 = steep ? x1 : y1, a2 = steep ? y2 : x2, b2 = steep ? x2 : y2;
+	if (a1 > a2) {
+		int32_t tmp = a1;
+		a1 = a2;
+		a2 = tmp;
+		tmp = b1;
+		b1 = b2;
+		b2 = tmp;
+	}
+	render_target_t screen = draw_target();
+	int32_t start = steep ? screen.clip_y1 : screen.clip_x1, end = steep ? screen.clip_y2 : screen.clip_x2;
+	if (start < a1) start = a1;
+	if (end > a2) end = a2;
 
-	for (int32_t y = 0; y < clip_height; y++) {
-		uint32_t *src_ptr = (uint32_t *) src_row;
-		uint32_t *dst_ptr = (uint32_t *) dst_row;
+	// Multiplied rather than shifted, b may be negative
+	int64_t gradient = ((int64_t) b2 - b1) * 0x10000 / (a2 - a1);
+	int64_t b = (int64_t) b1 * 0x10000 + (start - (int64_t) a1) * gradient;
+	for (int32_t a = start; a <= end; a++, b += gradient) {
+		int32_t pixel = (int32_t) (b >> 16);
+		uint32_t alpha = (uint32_t) ((32 * (0x10000 - (b & 0xffff)) + 0x8000) >> 16);
+		if (steep) {
+			fill_blend(pixel, a, pixel, a, color, alpha);
+			fill_blend(pixel + 1, a, pixel + 1, a, color, 32 - alpha);
+		} else {
+			fill_blend(a, pixel, a, pixel, color, alpha);
+			fill_blend(a, pixel + 1, a, pixel + 1, color, 32 - alpha);
+		}
+	}
+}
 
-		for (int32_t x = 0; x < clip_width / 2; x++) {
-			uint32_t src_pixels = *src_ptr++;
-			uint32_t dst_pixels = *dst_ptr;
+void mcugdx_display_ellipse(int32_t cx, int32_t cy, int32_t rx, int32_t ry, uint16_t color) {
+	ellipse(cx + translate_x, cy + translate_y, rx, ry, swap_bytes(color), false);
+}
 
-			uint16_t src_pixel1 = src_pixels & 0xFFFF;
-			uint16_t src_pixel2 = src_pixels >> 16;
+void mcugdx_display_fill_ellipse(int32_t cx, int32_t cy, int32_t rx, int32_t ry, uint16_t color) {
+	ellipse(cx + translate_x, cy + translate_y, rx, ry, swap_bytes(color), true);
+}
 
-			if (src_pixel1 != color_key) {
-				dst_pixels = (dst_pixels & 0xFFFF0000) | src_pixel1;
-			}
-			if (src_pixel2 != color_key) {
-				dst_pixels = (dst_pixels & 0x0000FFFF) | (src_pixel2 << 16);
-			}
+void mcugdx_display_ellipse_aa(int32_t cx, int32_t cy, int32_t rx, int32_t ry, uint16_t color) {
+	ellipse_aa(cx + translate_x, cy + translate_y, rx, ry, color, false);
+}
+
+void mcugdx_display_fill_ellipse_aa(int32_t cx, int32_t cy, int32_t rx, int32_t ry, uint16_t color) {
+	ellipse_aa(cx + translate_x, cy + translate_y, rx, ry, color, true);
+}
+
+void mcugdx_display_circle(int32_t cx, int32_t cy, int32_t radius, uint16_t color) {
+	ellipse(cx + translate_x, cy + translate_y, radius, radius, swap_bytes(color), false);
+}
 
-			*dst_ptr++ = dst_pixels;
+void mcugdx_display_fill_circle(int32_t cx, int32_t cy, int32_t radius, uint16_t color) {
+	ellipse(cx + translate_x, cy + translate_y, radius, radius, swap_bytes(color), true);
+}
+
+void mcugdx_display_triangle(int32_t x1, int32_t y1, int32_t x2, int32_t y2, int32_t x3, int32_t y3, uint16_t color) {
+	int32_t points[] = {x1, y1, x2, y2, x3, y3};
+	mcugdx_display_polygon(points, 3, color);
+}
+
+void mcugdx_display_fill_triangle(int32_t x1, int32_t y1, int32_t x2, int32_t y2, int32_t x3, int32_t y3, uint16_t color) {
+	int32_t points[] = {x1, y1, x2, y2, x3, y3};
+	mcugdx_display_fill_polygon(points, 3, color);
+}
+
+void mcugdx_display_polygon(const int32_t *points, uint32_t num_points, uint16_t color) {
+	for (uint32_t i = 0; i < num_points; i++) {
+		uint32_t j = i + 1 < num_points ? i + 1 : 0;
+		mcugdx_display_line(points[i * 2], points[i * 2 + 1], points[j * 2], points[j * 2 + 1], color);
+	}
+}
+
+void mcugdx_display_fill_polygon(const int32_t *points, uint32_t num_points, uint16_t color) {
+	if (num_points == 0) return;
+	render_target_t screen = draw_target();
+	int32_t y_min = points[1], y_max = points[1];
+	for (uint32_t i = 1; i < num_points; i++) {
+		if (points[i * 2 + 1] < y_min) y_min = points[i * 2 + 1];
+		if (points[i * 2 + 1] > y_max) y_max = points[i * 2 + 1];
+	}
+	y_min += translate_y;
+	y_max += translate_y;
+	if (y_min < screen.clip_y1) y_min = screen.clip_y1;
+	if (y_max > screen.clip_y2) y_max = screen.clip_y2;
+
+	// A convex polygon covers one span per row, between the leftmost and
+	// rightmost crossing of its edges with the row's pixel centers
+	uint16_t swapped = swap_bytes(color);
+	for (int32_t y = y_min; y <= y_max; y++) {
+		int64_t left = INT64_MAX, right = INT64_MIN;
+		for (uint32_t i = 0; i < num_points; i++) {
+			uint32_t j = i + 1 < num_points ? i + 1 : 0;
+			// Edges run downwards, horizontal ones cover their whole row
+			bool down = points[i * 2 + 1] <= points[j * 2 + 1];
+			int64_t xa = points[(down ? i : j) * 2] + translate_x, ya = points[(down ? i : j) * 2 + 1] + translate_y;
+			int64_t xb = points[(down ? j : i) * 2] + translate_x, yb = points[(down ? j : i) * 2 + 1] + translate_y;
+			if (y < ya || y > yb) continue;
+			int64_t left_x = ya == yb ? (xa < xb ? xa : xb) : xa + ceil_div((y - ya) * (xb - xa), yb - ya);
+			int64_t right_x = ya == yb ? (xa < xb ? xb : xa) : xa + floor_div((y - ya) * (xb - xa), yb - ya);
+			if (left_x < left) left = left_x;
+			if (right_x > right) right = right_x;
 		}
+		if (left > screen.clip_x2 || right < screen.clip_x1 || left > right) continue;
+		fill((int32_t) (left < screen.clip_x1 ? screen.clip_x1 : left), y, (int32_t) (right > screen.clip_x2 ? screen.clip_x2 : right), y, swapped);
+	}
+}
 
-		if (clip_width & 1) {
-			uint16_t src_pixel = ((uint16_t *) src_ptr)[0];
-			if (src_pixel != color_key) {
-				((uint16_t *) dst_ptr)[0] = src_pixel;
-			}
+void mcugdx_display_filter(int32_t x, int32_t y, int32_t width, int32_t height, mcugdx_filter_t filter, uint16_t color, uint8_t amount) {
+	if (width <= 0 || height <= 0) return;
+	if (filter == MCUGDX_FILTER_BRIGHTNESS ? amount == 128 : amount == 0) return;
+	int32_t x1 = x + translate_x, y1 = y + translate_y;
+	int32_t x2 = x1 + width - 1, y2 = y1 + height - 1;
+	render_target_t screen = draw_target();
+	if (!clip_rect(&screen, &x1, &y1, &x2, &y2)) return;
+	mark_dirty(x1, y1, x2, y2);
+
+	if (recording()) {
+		draw_command_t *command = record(COMMAND_FILTER, color, x1, y1, x2, y2, NULL, 0, 0);
+		if (command) {
+			command->blend_mode = (uint8_t) filter;
+			command->opacity = amount;
 		}
+	} else {
+		filter_target(&screen, x1, y1, x2, y2, (uint8_t) filter, color, amount);
+	}
+}
 
-		src_row += src_stride;
-		dst_row += dst_stride;
+void mcugdx_display_blit(mcugdx_image_t *src, int32_t x, int32_t y) {
+	blit(src, x + translate_x, y + translate_y, 0, 0, src->width, src->height, false, 0);
+}
+
+void mcugdx_display_blit_keyed(mcugdx_image_t *src, int32_t x, int32_t y, uint16_t color_key) {
+	blit(src, x + translate_x, y + translate_y, 0, 0, src->width, src->height, true, color_key);
+}
+
+void mcugdx_display_blit_region(mcugdx_image_t *src, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height) {
+	blit(src, dst_x + translate_x, dst_y + translate_y, src_x, src_y, src_width, src_height, false, 0);
+}
+
+void mcugdx_display_blit_region_keyed(mcugdx_image_t *src, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height, uint16_t color_key) {
+	blit(src, dst_x + translate_x, dst_y + translate_y, src_x, src_y, src_width, src_height, true, color_key);
+}
+
+void mcugdx_display_blit_blend(mcugdx_image_t *src, int32_t x, int32_t y, mcugdx_blend_mode_t mode, uint8_t opacity) {
+	blend(src, x + translate_x, y + translate_y, 0, 0, src->width, src->height, mode, opacity, 0);
+}
+
+void mcugdx_display_blit_region_blend(mcugdx_image_t *src, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height, mcugdx_blend_mode_t mode, uint8_t opacity) {
+	blend(src, dst_x + translate_x, dst_y + translate_y, src_x, src_y, src_width, src_height, mode, opacity, 0);
+}
+
+void mcugdx_display_blit_tint(mcugdx_image_t *src, int32_t x, int32_t y, uint16_t color, uint8_t amount) {
+	blend(src, x + translate_x, y + translate_y, 0, 0, src->width, src->height, BLEND_TINT, amount, color);
+}
+
+void mcugdx_display_blit_region_tint(mcugdx_image_t *src, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height, uint16_t color, uint8_t amount) {
+	blend(src, dst_x + translate_x, dst_y + translate_y, src_x, src_y, src_width, src_height, BLEND_TINT, amount, color);
+}
+
+void mcugdx_display_blit_indexed(mcugdx_indexed_image_t *src, int32_t x, int32_t y, const uint16_t *palette, uint32_t flags, uint16_t color_key) {
+	indexed(src, x + translate_x, y + translate_y, 0, 0, src->width, src->height, palette, flags, color_key);
+}
+
+void mcugdx_display_blit_region_indexed(mcugdx_indexed_image_t *src, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height, const uint16_t *palette, uint32_t flags, uint16_t color_key) {
+	indexed(src, dst_x + translate_x, dst_y + translate_y, src_x, src_y, src_width, src_height, palette, flags, color_key);
+}
+
+void mcugdx_display_blit_region_mask(mcugdx_image_t *src, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height, uint16_t color) {
+	mask(src, dst_x + translate_x, dst_y + translate_y, src_x, src_y, src_width, src_height, color);
+}
+
+void mcugdx_display_blit_ex(mcugdx_image_t *src, int32_t x, int32_t y, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height, int32_t scale_x, int32_t scale_y, uint32_t flags, uint16_t color_key) {
+	if (scale_x <= 0 || scale_y <= 0 || src_width <= 0 || src_height <= 0) return;
+	bool rotated = flags & MCUGDX_BLIT_ROTATE_90;
+	int32_t rotated_width = rotated ? src_height : src_width;
+	int32_t rotated_height = rotated ? src_width : src_height;
+	int64_t width = ((int64_t) rotated_width * scale_x + 0xffff) >> 16;
+	int64_t height = ((int64_t) rotated_height * scale_y + 0xffff) >> 16;
+	x += translate_x;
+	y += translate_y;
+	render_target_t screen = draw_target();
+	if (x + width <= screen.clip_x1 || y + height <= screen.clip_y1 || x > screen.clip_x2 || y > screen.clip_y2) return;
+
+	// Going right or down one destination pixel moves step_x or step_y through
+	// the flipped and rotated region. Rotated clockwise, destination rows run up
+	// the flipped region from its bottom edge, columns run from left to right.
+	int32_t step_x = (int32_t) (((int64_t) 1 << 32) / scale_x);
+	int32_t step_y = (int32_t) (((int64_t) 1 << 32) / scale_y);
+	transform_t t = {0};
+	if (!rotated && scale_x % MCUGDX_FIXED_ONE == 0) t.repeat_x = scale_x / MCUGDX_FIXED_ONE;
+	if (rotated) {
+		t.dv_dx = -step_x;
+		t.du_dy = step_y;
+		t.u = step_y / 2;
+		t.v = (src_height << 16) - step_x / 2;
+	} else {
+		t.du_dx = step_x;
+		t.dv_dy = step_y;
+		t.u = step_x / 2;
+		t.v = step_y / 2;
+	}
+	if (flags & MCUGDX_BLIT_FLIP_X) {
+		t.u = (src_width << 16) - t.u;
+		t.du_dx = -t.du_dx;
+		t.du_dy = -t.du_dy;
+	}
+	if (flags & MCUGDX_BLIT_FLIP_Y) {
+		t.v = (src_height << 16) - t.v;
+		t.dv_dx = -t.dv_dx;
+		t.dv_dy = -t.dv_dy;
 	}
+	t.u += src_x * 0x10000;
+	t.v += src_y * 0x10000;
+	t.src_x1 = src_x;
+	t.src_y1 = src_y;
+	t.src_x2 = src_x + src_width;
+	t.src_y2 = src_y + src_height;
+	transform(src, x, y, (int32_t) (x + width - 1), (int32_t) (y + height - 1), &t, flags & MCUGDX_BLIT_KEYED, color_key);
+}
+
+void mcugdx_display_blit_affine(mcugdx_image_t *src, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height, const int32_t matrix[6], uint32_t flags, uint16_t color_key) {
+	int64_t det = (int64_t) matrix[0] * matrix[4] - (int64_t) matrix[1] * matrix[3];
+	if (det == 0 || src_width <= 0 || src_height <= 0) return;
+
+	// Bounding box of the transformed region
+	int64_t offset_x = matrix[2] + (int64_t) translate_x * 0x10000;
+	int64_t offset_y = matrix[5] + (int64_t) translate_y * 0x10000;
+	int64_t x_min = INT64_MAX, y_min = INT64_MAX, x_max = INT64_MIN, y_max = INT64_MIN;
+	for (int32_t i = 0; i < 4; i++) {
+		int64_t a = (int64_t) (i & 1 ? src_width : 0) << 16;
+		int64_t b = (int64_t) (i & 2 ? src_height : 0) << 16;
+		int64_t corner_x = ((matrix[0] * a + matrix[1] * b) >> 16) + offset_x;
+		int64_t corner_y = ((matrix[3] * a + matrix[4] * b) >> 16) + offset_y;
+		if (corner_x < x_min) x_min = corner_x;
+		if (corner_x > x_max) x_max = corner_x;
+		if (corner_y < y_min) y_min = corner_y;
+		if (corner_y > y_max) y_max = corner_y;
+	}
+	int64_t x1 = x_min >> 16, y1 = y_min >> 16;
+	int64_t x2 = ((x_max + 0xffff) >> 16) - 1, y2 = ((y_max + 0xffff) >> 16) - 1;
+	render_target_t screen = draw_target();
+	if (x2 < screen.clip_x1 || y2 < screen.clip_y1 || x1 > screen.clip_x2 || y1 > screen.clip_y2) return;
+	if (x1 < screen.clip_x1) x1 = screen.clip_x1;
+	if (y1 < screen.clip_y1) y1 = screen.clip_y1;
+	if (x2 > screen.clip_x2) x2 = screen.clip_x2;
+	if (y2 > screen.clip_y2) y2 = screen.clip_y2;
+
+	// The inverse of the 2x2 part steps through the region, starting at the
+	// center of the top left destination pixel. Multiplied rather than shifted,
+	// the matrix may be negative.
+	int64_t du_dx = (int64_t) matrix[4] * 0x100000000 / det;
+	int64_t du_dy = -(int64_t) matrix[1] * 0x100000000 / det;
+	int64_t dv_dx = -(int64_t) matrix[3] * 0x100000000 / det;
+	int64_t dv_dy = (int64_t) matrix[0] * 0x100000000 / det;
+	int64_t dx = (x1 << 16) + 0x8000 - offset_x;
+	int64_t dy = (y1 << 16) + 0x8000 - offset_y;
+	transform_t t = {
+			.u = (int32_t) ((du_dx * dx + du_dy * dy) >> 16) + src_x * 0x10000,
+			.v = (int32_t) ((dv_dx * dx + dv_dy * dy) >> 16) + src_y * 0x10000,
+			.du_dx = (int32_t) du_dx,
+			.dv_dx = (int32_t) dv_dx,
+			.du_dy = (int32_t) du_dy,
+			.dv_dy = (int32_t) dv_dy,
+			.src_x1 = src_x,
+			.src_y1 = src_y,
+			.src_x2 = src_x + src_width,
+			.src_y2 = src_y + src_height};
+	transform(src, (int32_t) x1, (int32_t) y1, (int32_t) x2, (int32_t) y2, &t, flags & MCUGDX_BLIT_KEYED, color_key);
+}
+
+void mcugdx_display_blit_batch(mcugdx_blit_t *blits, uint32_t num_blits, uint32_t flags) {
+	// Room for all blits plus the scratch space for sorting, so there's no
+	// allocation while recording
+	if (!commands_reserve(num_blits * 2)) return;
+
+	// Clip everything first, then rasterize the survivors in one go, reusing
+	// the command buffer. In banded or list mode, they just stay recorded.
+	render_target_t screen = draw_target();
+	uint32_t start = num_commands;
+	for (uint32_t i = 0; i < num_blits; i++) {
+		mcugdx_blit_t *blit = &blits[i];
+		mcugdx_image_t *image = blit->image;
+		bool whole_image = blit->src_width == 0 || blit->src_height == 0;
+		int32_t dst_x = blit->x + translate_x, dst_y = blit->y + translate_y;
+		int32_t src_x = whole_image ? 0 : blit->src_x;
+		int32_t src_y = whole_image ? 0 : blit->src_y;
+		int32_t width = whole_image ? (int32_t) image->width : blit->src_width;
+		int32_t height = whole_image ? (int32_t) image->height : blit->src_height;
+		if (!clip_blit(&screen, image, &dst_x, &dst_y, &src_x, &src_y, &width, &height)) continue;
+		mark_dirty(dst_x, dst_y, dst_x + width - 1, dst_y + height - 1);
+		record(blit->flags & MCUGDX_BLIT_KEYED ? COMMAND_BLIT_KEYED : COMMAND_BLIT, blit->color_key, dst_x, dst_y, dst_x + width - 1, dst_y + height - 1, image, src_x, src_y);
+	}
+	if (flags & MCUGDX_BATCH_SORT) group_by_image(start, num_commands - start);
+	if (recording()) return;
+
+	if (flags & MCUGDX_BATCH_PARALLEL) {
+		batch_start = start;
+		mcugdx_display_parallel(execute_batch_part);
+	} else {
+		execute_commands(&screen, commands + start, num_commands - start);
+	}
+	num_commands = start;
 }
 
 int mcugdx_display_width(void) {
@@ -338,3 +1819,55 @@ int mcugdx_display_height(void) {
 uint16_t *mcugdx_display_frame_buffer(void) {
 	return display.frame_buffer;
 }
+
+uint8_t *mcugdx_display_indexed_frame_buffer(void) {
+	return display.indexed_frame_buffer;
+}
+
+void mcugdx_display_set_palette(const uint16_t *palette) {
+	if (memcmp(display.palette, palette, sizeof(display.palette)) == 0) return;
+	memcpy(display.palette, palette, sizeof(display.palette));
+	if (display.dirty_tracking) add_dirty_rect(0, 0, display.width - 1, display.height - 1);
+}
+
+mcugdx_image_t *mcugdx_display_capture(mcugdx_memory_type_t mem_type) {
+	mcugdx_image_t *image = mcugdx_mem_alloc(sizeof(mcugdx_image_t), mem_type);
+	if (!image) {
+		mcugdx_loge(TAG, "Could not allocate capture image");
+		return NULL;
+	}
+	memset(image, 0, sizeof(mcugdx_image_t));
+	image->width = display.width;
+	image->height = display.height;
+	image->mem_type = mem_type;
+	image->pixels = mcugdx_mem_alloc(display.width * display.height * sizeof(uint16_t), mem_type);
+	if (!image->pixels) {
+		mcugdx_loge(TAG, "Could not allocate capture pixels");
+		mcugdx_mem_free(image);
+		return NULL;
+	}
+
+	if (display.band_height > 0) {
+		mcugdx_display_render_band(image->pixels, 0, display.height);
+	} else if (display.indexed_frame_buffer) {
+		for (uint32_t i = 0; i < display.width * display.height; i++) {
+			image->pixels[i] = display.palette[display.indexed_frame_buffer[i]];
+		}
+	} else {
+		memcpy(image->pixels, display.frame_buffer, display.width * display.height * sizeof(uint16_t));
+	}
+	return image;
+}
+
+uint64_t mcugdx_display_hash(void) {
+	if (display.frame_buffer) {
+		mcugdx_image_t frame = {.width = display.width, .height = display.height, .pixels = display.frame_buffer};
+		return mcugdx_image_hash(&frame);
+	}
+
+	mcugdx_image_t *frame = mcugdx_display_capture(MCUGDX_MEM_EXTERNAL);
+	if (!frame) return 0;
+	uint64_t hash = mcugdx_image_hash(frame);
+	mcugdx_image_unload(frame);
+	return hash;
+}
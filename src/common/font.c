@@ -0,0 +1,348 @@
+#include "font.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "mcugdx_font"
+#define MAX_PATH 256
+
+static int compare_glyphs(const void *a, const void *b) {
+	uint32_t first = ((const mcugdx_glyph_t *) a)->codepoint;
+	uint32_t second = ((const mcugdx_glyph_t *) b)->codepoint;
+	return first < second ? -1 : first > second;
+}
+
+static int compare_kernings(const void *a, const void *b) {
+	const mcugdx_kerning_t *first = (const mcugdx_kerning_t *) a;
+	const mcugdx_kerning_t *second = (const mcugdx_kerning_t *) b;
+	if (first->first != second->first) return first->first < second->first ? -1 : 1;
+	return first->second < second->second ? -1 : first->second > second->second;
+}
+
+// Turns the atlas into glyph coverage: covered pixels are white, everything
+// else is black, which is the color key of the spans. Anti-aliased fonts keep
+// a 4 bit alpha plane for the edges.
+static bool make_coverage(mcugdx_image_t *atlas, bool antialiased) {
+	uint32_t num_pixels = atlas->width * atlas->height;
+	uint8_t *alpha = NULL;
+	if (antialiased && atlas->alpha_bits == 8) {
+		alpha = mcugdx_mem_alloc((num_pixels + 1) / 2, atlas->mem_type);
+		if (!alpha) {
+			mcugdx_loge(TAG, "Could not allocate coverage for %lix%li atlas", atlas->width, atlas->height);
+			return false;
+		}
+		memset(alpha, 0, (num_pixels + 1) / 2);
+	}
+
+	for (uint32_t i = 0; i < num_pixels; i++) {
+		uint32_t coverage = 255;
+		if (atlas->alpha_bits == 8) coverage = atlas->alpha[i];
+		if (atlas->alpha_bits == 4) coverage = ((atlas->alpha[i >> 1] >> ((i & 1) << 2)) & 0xf) * 17;
+		if (!atlas->alpha && atlas->pixels[i] == 0) coverage = 0;
+		if (!antialiased) coverage = coverage >= 128 ? 255 : 0;
+		if (alpha) alpha[i >> 1] |= ((coverage + 8) / 17) << ((i & 1) << 2);
+		atlas->pixels[i] = coverage >= 9 ? 0xffff : 0;
+	}
+
+	if (alpha) {
+		mcugdx_mem_free(atlas->alpha);
+		atlas->alpha = alpha;
+		atlas->alpha_bits = 4;
+	} else if (!antialiased && atlas->alpha) {
+		mcugdx_mem_free(atlas->alpha);
+		atlas->alpha = NULL;
+		atlas->alpha_bits = 0;
+	}
+	return mcugdx_image_make_sprite(atlas, 0);
+}
+
+mcugdx_font_t *mcugdx_font_create(mcugdx_image_t *atlas, uint32_t line_height, uint32_t base, const mcugdx_glyph_t *glyphs, uint32_t num_glyphs, const mcugdx_kerning_t *kernings, uint32_t num_kernings, bool antialiased, mcugdx_memory_type_t mem_type) {
+	for (uint32_t i = 0; i < num_glyphs; i++) {
+		if (glyphs[i].x + glyphs[i].width > atlas->width || glyphs[i].y + glyphs[i].height > atlas->height) {
+			mcugdx_loge(TAG, "Glyph %li is outside the %lix%li atlas", glyphs[i].codepoint, atlas->width, atlas->height);
+			return NULL;
+		}
+	}
+
+	mcugdx_font_t *font = mcugdx_mem_alloc(sizeof(mcugdx_font_t), mem_type);
+	if (!font) {
+		mcugdx_loge(TAG, "Could not allocate font");
+		return NULL;
+	}
+	memset(font, 0, sizeof(mcugdx_font_t));
+	font->glyphs = mcugdx_mem_alloc((num_glyphs ? num_glyphs : 1) * sizeof(mcugdx_glyph_t), mem_type);
+	font->kernings = mcugdx_mem_alloc((num_kernings ? num_kernings : 1) * sizeof(mcugdx_kerning_t), mem_type);
+	if (!font->glyphs || !font->kernings || !make_coverage(atlas, antialiased)) {
+		mcugdx_loge(TAG, "Could not set up font with %li glyphs", num_glyphs);
+		if (font->glyphs) mcugdx_mem_free(font->glyphs);
+		if (font->kernings) mcugdx_mem_free(font->kernings);
+		mcugdx_mem_free(font);
+		return NULL;
+	}
+	font->atlas = atlas;
+	font->line_height = line_height;
+	font->base = base;
+	font->num_glyphs = num_glyphs;
+	font->num_kernings = num_kernings;
+	font->mem_type = mem_type;
+	memcpy(font->glyphs, glyphs, num_glyphs * sizeof(mcugdx_glyph_t));
+	memcpy(font->kernings, kernings, num_kernings * sizeof(mcugdx_kerning_t));
+	qsort(font->glyphs, num_glyphs, sizeof(mcugdx_glyph_t), compare_glyphs);
+	qsort(font->kernings, num_kernings, sizeof(mcugdx_kerning_t), compare_kernings);
+
+	// Both arrays are sorted by the left codepoint, so each glyph's pairs are
+	// found in one pass
+	memset(font->ascii, 0xff, sizeof(font->ascii));
+	uint32_t kerning = 0;
+	int32_t min_kerning = 0;
+	for (uint32_t i = 0; i < num_glyphs; i++) {
+		mcugdx_glyph_t *glyph = &font->glyphs[i];
+		if (glyph->codepoint < 128) font->ascii[glyph->codepoint] = (int16_t) i;
+		if (i == 0 || glyph->offset_x < font->min_x) font->min_x = glyph->offset_x;
+		if (i == 0 || glyph->offset_y < font->min_y) font->min_y = glyph->offset_y;
+		if (i == 0 || glyph->offset_y + glyph->height > font->max_y) font->max_y = glyph->offset_y + glyph->height;
+
+		while (kerning < num_kernings && font->kernings[kerning].first < glyph->codepoint) kerning++;
+		glyph->first_kerning = kerning;
+		glyph->num_kernings = 0;
+		while (kerning < num_kernings && font->kernings[kerning].first == glyph->codepoint) {
+			glyph->num_kernings++;
+			kerning++;
+		}
+	}
+	for (uint32_t i = 0; i < num_kernings; i++) {
+		if (font->kernings[i].amount < min_kerning) min_kerning = font->kernings[i].amount;
+	}
+	font->min_x += min_kerning;
+	return font;
+}
+
+// Value of key=value in a line of a BMFont file, or 0 if it is missing
+static int32_t read_value(const char *line, const char *key) {
+	char pattern[32];
+	snprintf(pattern, sizeof(pattern), " %s=", key);
+	const char *value = strstr(line, pattern);
+	return value ? (int32_t) strtol(value + strlen(pattern), NULL, 10) : 0;
+}
+
+static bool starts_with(const char *line, const char *tag) {
+	size_t length = strlen(tag);
+	return !strncmp(line, tag, length) && line[length] == ' ';
+}
+
+// Path of the page file given in a page line, next to the font file and with
+// a .qoi extension
+static bool read_page_path(const char *font_path, const char *line, char *page_path) {
+	const char *file = strstr(line, " file=\"");
+	if (!file) return false;
+	file += 7;
+	const char *file_end = strchr(file, '"');
+	const char *dir_end = strrchr(font_path, '/');
+	size_t dir_length = dir_end ? (size_t) (dir_end - font_path + 1) : 0;
+	if (!file_end || dir_length + (file_end - file) + 5 > MAX_PATH) return false;
+
+	memcpy(page_path, font_path, dir_length);
+	memcpy(page_path + dir_length, file, file_end - file);
+	page_path[dir_length + (file_end - file)] = 0;
+	char *extension = strrchr(page_path + dir_length, '.');
+	strcpy(extension ? extension : page_path + strlen(page_path), ".qoi");
+	return true;
+}
+
+static mcugdx_font_t *parse_font(const char *path, char *text, mcugdx_file_system_t *fs, bool antialiased, mcugdx_memory_type_t mem_type) {
+	uint32_t num_glyphs = 0, num_kernings = 0;
+	for (char *line = text; line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+		if (starts_with(line, "char")) num_glyphs++;
+		if (starts_with(line, "kerning")) num_kernings++;
+	}
+	// Lines are parsed as separate strings from here on
+	char *end = text + strlen(text);
+	for (char *c = text; c < end; c++) {
+		if (*c == '\n' || *c == '\r') *c = 0;
+	}
+
+	mcugdx_glyph_t *glyphs = mcugdx_mem_alloc((num_glyphs ? num_glyphs : 1) * sizeof(mcugdx_glyph_t), MCUGDX_MEM_INTERNAL);
+	mcugdx_kerning_t *kernings = mcugdx_mem_alloc((num_kernings ? num_kernings : 1) * sizeof(mcugdx_kerning_t), MCUGDX_MEM_INTERNAL);
+	char page_path[MAX_PATH] = {0};
+	uint32_t line_height = 0, base = 0, num_pages = 0;
+	num_glyphs = 0;
+	num_kernings = 0;
+	for (char *line = text; glyphs && kernings && line < end; line += strlen(line) + 1) {
+		if (starts_with(line, "common")) {
+			line_height = read_value(line, "lineHeight");
+			base = read_value(line, "base");
+			num_pages = read_value(line, "pages");
+		} else if (starts_with(line, "page")) {
+			if (!read_page_path(path, line, page_path)) mcugdx_loge(TAG, "Invalid page in %s", path);
+		} else if (starts_with(line, "char")) {
+			mcugdx_glyph_t *glyph = &glyphs[num_glyphs++];
+			glyph->codepoint = read_value(line, "id");
+			glyph->x = read_value(line, "x");
+			glyph->y = read_value(line, "y");
+			glyph->width = read_value(line, "width");
+			glyph->height = read_value(line, "height");
+			glyph->offset_x = read_value(line, "xoffset");
+			glyph->offset_y = read_value(line, "yoffset");
+			glyph->advance = read_value(line, "xadvance");
+		} else if (starts_with(line, "kerning")) {
+			mcugdx_kerning_t *kerning = &kernings[num_kernings++];
+			kerning->first = read_value(line, "first");
+			kerning->second = read_value(line, "second");
+			kerning->amount = read_value(line, "amount");
+		}
+	}
+
+	mcugdx_font_t *font = NULL;
+	if (!glyphs || !kernings) {
+		mcugdx_loge(TAG, "Could not allocate glyphs for %s", path);
+	} else if (num_pages != 1 || !page_path[0]) {
+		mcugdx_loge(TAG, "%s must have exactly one page, has %li", path, num_pages);
+	} else {
+		mcugdx_image_t *atlas = mcugdx_image_load_alpha(page_path, fs, 8, mem_type);
+		if (atlas) {
+			font = mcugdx_font_create(atlas, line_height, base, glyphs, num_glyphs, kernings, num_kernings, antialiased, mem_type);
+			if (!font) mcugdx_image_unload(atlas);
+		} else {
+			mcugdx_loge(TAG, "Could not load page %s of %s", page_path, path);
+		}
+	}
+	if (glyphs) mcugdx_mem_free(glyphs);
+	if (kernings) mcugdx_mem_free(kernings);
+	return font;
+}
+
+mcugdx_font_t *mcugdx_font_load(const char *path, mcugdx_file_system_t *fs, bool antialiased, mcugdx_memory_type_t mem_type) {
+	uint32_t size;
+	uint8_t *data = fs->read_fully(path, &size, MCUGDX_MEM_INTERNAL);
+	if (!data) return NULL;
+
+	char *text = mcugdx_mem_alloc(size + 1, MCUGDX_MEM_INTERNAL);
+	if (!text) {
+		mcugdx_loge(TAG, "Could not allocate %li bytes for %s", size + 1, path);
+		mcugdx_mem_free(data);
+		return NULL;
+	}
+	memcpy(text, data, size);
+	text[size] = 0;
+	mcugdx_mem_free(data);
+
+	mcugdx_font_t *font = parse_font(path, text, fs, antialiased, mem_type);
+	mcugdx_mem_free(text);
+	return font;
+}
+
+void mcugdx_font_unload(mcugdx_font_t *font) {
+	mcugdx_image_unload(font->atlas);
+	mcugdx_mem_free(font->glyphs);
+	mcugdx_mem_free(font->kernings);
+	mcugdx_mem_free(font);
+}
+
+mcugdx_glyph_t *mcugdx_font_glyph(mcugdx_font_t *font, uint32_t codepoint) {
+	if (codepoint < 128) return font->ascii[codepoint] >= 0 ? &font->glyphs[font->ascii[codepoint]] : NULL;
+
+	int32_t low = 0, high = (int32_t) font->num_glyphs - 1;
+	while (low <= high) {
+		int32_t middle = (low + high) / 2;
+		uint32_t other = font->glyphs[middle].codepoint;
+		if (other == codepoint) return &font->glyphs[middle];
+		if (other < codepoint) {
+			low = middle + 1;
+		} else {
+			high = middle - 1;
+		}
+	}
+	return NULL;
+}
+
+int32_t mcugdx_font_kerning(mcugdx_font_t *font, mcugdx_glyph_t *first, uint32_t second) {
+	mcugdx_kerning_t *kernings = font->kernings + first->first_kerning;
+	for (uint32_t i = 0; i < first->num_kernings; i++) {
+		if (kernings[i].second == second) return kernings[i].amount;
+		if (kernings[i].second > second) break;
+	}
+	return 0;
+}
+
+// Decodes the next codepoint and advances text past it. Invalid sequences are
+// returned as U+FFFD one byte at a time.
+static uint32_t next_codepoint(const char **text) {
+	const uint8_t *c = (const uint8_t *) *text;
+	uint32_t length = c[0] < 0x80 ? 1 : (c[0] & 0xe0) == 0xc0 ? 2 : (c[0] & 0xf0) == 0xe0 ? 3 : (c[0] & 0xf8) == 0xf0 ? 4 : 0;
+	uint32_t codepoint = length == 1 ? c[0] : c[0] & (0x7f >> length);
+	for (uint32_t i = 1; i < length; i++) {
+		if ((c[i] & 0xc0) != 0x80) length = 0;
+		if (length == 0) break;
+		codepoint = (codepoint << 6) | (c[i] & 0x3f);
+	}
+	if (length == 0) {
+		*text += 1;
+		return 0xfffd;
+	}
+	*text += length;
+	return codepoint;
+}
+
+// Width of the line starting at text, which is advanced to the end of the line
+static int32_t measure_line(mcugdx_font_t *font, const char **text) {
+	int32_t width = 0, pen_x = 0;
+	mcugdx_glyph_t *last = NULL;
+	while (**text && **text != '\n') {
+		uint32_t codepoint = next_codepoint(text);
+		mcugdx_glyph_t *glyph = mcugdx_font_glyph(font, codepoint);
+		if (!glyph) continue;
+		if (last) pen_x += mcugdx_font_kerning(font, last, codepoint);
+		if (pen_x + glyph->offset_x + glyph->width > width) width = pen_x + glyph->offset_x + glyph->width;
+		pen_x += glyph->advance;
+		last = glyph;
+	}
+	return pen_x > width ? pen_x : width;
+}
+
+void mcugdx_font_measure(mcugdx_font_t *font, const char *text, int32_t *width, int32_t *height) {
+	int32_t lines = 1;
+	*width = 0;
+	while (true) {
+		int32_t line_width = measure_line(font, &text);
+		if (line_width > *width) *width = line_width;
+		if (!*text) break;
+		text++;
+		lines++;
+	}
+	*height = lines * (int32_t) font->line_height;
+}
+
+void mcugdx_font_measure_all(mcugdx_font_t *font, const char **texts, uint32_t count, int32_t *widths, int32_t *heights) {
+	for (uint32_t i = 0; i < count; i++) {
+		mcugdx_font_measure(font, texts[i], &widths[i], &heights[i]);
+	}
+}
+
+void mcugdx_display_text(mcugdx_font_t *font, const char *text, int32_t x, int32_t y, uint16_t color) {
+	mcugdx_rect_t clip;
+	mcugdx_display_get_clip(&clip);
+	for (int32_t line_y = y; *text; line_y += (int32_t) font->line_height) {
+		int32_t pen_x = x;
+		// Lines fully above or below the clip rect are skipped without decoding them
+		bool visible = line_y + font->max_y > clip.y && line_y + font->min_y < clip.y + clip.height;
+		mcugdx_glyph_t *last = NULL;
+		while (*text && *text != '\n') {
+			if (!visible || pen_x + font->min_x >= clip.x + clip.width) {
+				text++;
+				continue;
+			}
+			uint32_t codepoint = next_codepoint(&text);
+			mcugdx_glyph_t *glyph = mcugdx_font_glyph(font, codepoint);
+			if (!glyph) continue;
+			if (last) pen_x += mcugdx_font_kerning(font, last, codepoint);
+			if (glyph->width > 0 && glyph->height > 0) {
+				mcugdx_display_blit_region_mask(font->atlas, pen_x + glyph->offset_x, line_y + glyph->offset_y, glyph->x, glyph->y, glyph->width, glyph->height, color);
+			}
+			pen_x += glyph->advance;
+			last = glyph;
+		}
+		if (*text) text++;
+		if (!*text) break;
+	}
+}
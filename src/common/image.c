@@ -1,17 +1,28 @@
 #include "image.h"
+#include "log.h"
+#include <stdio.h>
+#include <string.h>
+
+#define TAG "mcugdx_image"
 
 #define reverse_color(color) (((color) >> 8) | ((color) << 8))
 
 #define QOI_IMPLEMENTATION
 #include "thirdparty/qoi.h"
 
-mcugdx_image_t *mcugdx_image_load(const char *path, mcugdx_file_system_t *fs, mcugdx_memory_type_t mem_type) {
+mcugdx_image_t *mcugdx_image_load_alpha(const char *path, mcugdx_file_system_t *fs, uint32_t alpha_bits, mcugdx_memory_type_t mem_type) {
+	if (alpha_bits != 0 && alpha_bits != 4 && alpha_bits != 8) {
+		mcugdx_loge(TAG, "Unsupported alpha bits %li for %s", alpha_bits, path);
+		return NULL;
+	}
+
 	uint32_t size;
 	uint8_t *raw_bytes = fs->read_fully(path, &size, mem_type);
 	if (!raw_bytes) return NULL;
 
 	qoi_desc desc;
-	void *pixels = qoi_decode(raw_bytes, size, &desc, 3, mem_type);
+	uint8_t *alpha = NULL;
+	void *pixels = qoi_decode(raw_bytes, size, &desc, 3, &alpha, alpha_bits, mem_type);
 	if (!pixels) {
 		mcugdx_mem_free(raw_bytes);
 		return NULL;
@@ -19,6 +30,7 @@ mcugdx_image_t *mcugdx_image_load(const char *path, mcugdx_file_system_t *fs, mc
 
 	mcugdx_image_t *image = (mcugdx_image_t *) mcugdx_mem_alloc(sizeof(mcugdx_image_t), mem_type);
 	if (!image) {
+		if (alpha) mcugdx_mem_free(alpha);
 		mcugdx_mem_free(pixels);
 		mcugdx_mem_free(raw_bytes);
 		return NULL;
@@ -27,13 +39,248 @@ mcugdx_image_t *mcugdx_image_load(const char *path, mcugdx_file_system_t *fs, mc
 	image->width = desc.width;
 	image->height = desc.height;
 	image->pixels = pixels;
+	image->mem_type = mem_type;
+	image->color_key = 0;
+	image->row_spans = NULL;
+	image->spans = NULL;
+	image->alpha_bits = alpha_bits;
+	image->alpha = alpha;
 
 	mcugdx_mem_free(raw_bytes);
 
 	return image;
 }
 
+mcugdx_image_t *mcugdx_image_create(uint32_t width, uint32_t height, mcugdx_memory_type_t mem_type) {
+	mcugdx_image_t *image = (mcugdx_image_t *) mcugdx_mem_alloc(sizeof(mcugdx_image_t), mem_type);
+	uint16_t *pixels = mcugdx_mem_alloc(width * height * sizeof(uint16_t), mem_type);
+	if (!image || !pixels) {
+		mcugdx_loge(TAG, "Could not allocate %lix%li image", width, height);
+		if (image) mcugdx_mem_free(image);
+		if (pixels) mcugdx_mem_free(pixels);
+		return NULL;
+	}
+	memset(image, 0, sizeof(mcugdx_image_t));
+	memset(pixels, 0, width * height * sizeof(uint16_t));
+	image->width = width;
+	image->height = height;
+	image->pixels = pixels;
+	image->mem_type = mem_type;
+	return image;
+}
+
+mcugdx_image_t *mcugdx_image_load(const char *path, mcugdx_file_system_t *fs, mcugdx_memory_type_t mem_type) {
+	return mcugdx_image_load_alpha(path, fs, 0, mem_type);
+}
+
 void mcugdx_image_unload(mcugdx_image_t *image) {
+	if (image->row_spans) mcugdx_mem_free(image->row_spans);
+	if (image->alpha) mcugdx_mem_free(image->alpha);
 	mcugdx_mem_free(image->pixels);
 	mcugdx_mem_free(image);
 }
+
+// Index of color in the palette, added if it isn't in there yet. slots maps
+// colors to indices + 1 via open addressing, 0 marks a free slot.
+static int32_t palette_index(uint16_t *palette, uint32_t *num_colors, uint32_t max_colors, uint16_t *slots, uint32_t num_slots, uint16_t color) {
+	uint32_t slot = (color * 0x9e37u) % num_slots;
+	while (slots[slot]) {
+		if (palette[slots[slot] - 1] == color) return slots[slot] - 1;
+		slot = (slot + 1) % num_slots;
+	}
+	if (*num_colors == max_colors) return -1;
+	palette[*num_colors] = color;
+	slots[slot] = (uint16_t) ++*num_colors;
+	return (int32_t) *num_colors - 1;
+}
+
+mcugdx_indexed_image_t *mcugdx_image_load_indexed(const char *path, mcugdx_file_system_t *fs, uint32_t bits_per_pixel, mcugdx_memory_type_t mem_type) {
+	if (bits_per_pixel != 4 && bits_per_pixel != 8) {
+		mcugdx_loge(TAG, "Unsupported bits per pixel %li for %s", bits_per_pixel, path);
+		return NULL;
+	}
+
+	// Decoded to 16 bits first, which only lives until the indices are done
+	mcugdx_image_t *decoded = mcugdx_image_load(path, fs, mem_type);
+	if (!decoded) return NULL;
+
+	uint32_t max_colors = 1 << bits_per_pixel;
+	uint32_t num_pixels = decoded->width * decoded->height;
+	mcugdx_indexed_image_t *image = mcugdx_mem_alloc(sizeof(mcugdx_indexed_image_t), mem_type);
+	uint8_t *indices = mcugdx_mem_alloc((num_pixels * bits_per_pixel + 7) / 8, mem_type);
+	uint16_t *palette = mcugdx_mem_alloc(max_colors * sizeof(uint16_t), mem_type);
+	if (!image || !indices || !palette) {
+		mcugdx_loge(TAG, "Could not allocate indexed image %s", path);
+		if (image) mcugdx_mem_free(image);
+		if (indices) mcugdx_mem_free(indices);
+		if (palette) mcugdx_mem_free(palette);
+		mcugdx_image_unload(decoded);
+		return NULL;
+	}
+	memset(indices, 0, (num_pixels * bits_per_pixel + 7) / 8);
+	memset(palette, 0, max_colors * sizeof(uint16_t));
+
+	uint16_t slots[512] = {0};
+	uint32_t num_colors = 0;
+	for (uint32_t i = 0; i < num_pixels; i++) {
+		int32_t index = palette_index(palette, &num_colors, max_colors, slots, 512, decoded->pixels[i]);
+		if (index < 0) {
+			mcugdx_loge(TAG, "%s has more than %li colors", path, max_colors);
+			mcugdx_mem_free(image);
+			mcugdx_mem_free(indices);
+			mcugdx_mem_free(palette);
+			mcugdx_image_unload(decoded);
+			return NULL;
+		}
+		if (bits_per_pixel == 8) {
+			indices[i] = (uint8_t) index;
+		} else {
+			indices[i >> 1] |= index << ((i & 1) << 2);
+		}
+	}
+
+	image->width = decoded->width;
+	image->height = decoded->height;
+	image->bits_per_pixel = bits_per_pixel;
+	image->indices = indices;
+	image->palette = palette;
+	image->mem_type = mem_type;
+	mcugdx_image_unload(decoded);
+	return image;
+}
+
+void mcugdx_indexed_image_unload(mcugdx_indexed_image_t *image) {
+	mcugdx_mem_free(image->indices);
+	mcugdx_mem_free(image->palette);
+	mcugdx_mem_free(image);
+}
+
+bool mcugdx_image_make_sprite(mcugdx_image_t *image, uint16_t color_key) {
+	if (image->width > UINT16_MAX) {
+		mcugdx_loge(TAG, "Sprites can be at most %i pixels wide", UINT16_MAX);
+		return false;
+	}
+
+	uint32_t num_spans = 0;
+	for (uint32_t y = 0; y < image->height; y++) {
+		uint16_t *row = image->pixels + y * image->width;
+		for (uint32_t x = 0; x < image->width; x++) {
+			if (row[x] != color_key && (x == 0 || row[x - 1] == color_key)) num_spans++;
+		}
+	}
+
+	// Row offsets and spans share one allocation, freed via row_spans
+	uint32_t row_spans_size = (image->height + 1) * sizeof(uint32_t);
+	uint8_t *data = mcugdx_mem_alloc(row_spans_size + num_spans * sizeof(mcugdx_image_span_t), image->mem_type);
+	if (!data) {
+		mcugdx_loge(TAG, "Could not allocate %li sprite spans", num_spans);
+		return false;
+	}
+	uint32_t *row_spans = (uint32_t *) data;
+	mcugdx_image_span_t *spans = (mcugdx_image_span_t *) (data + row_spans_size);
+
+	uint32_t span = 0;
+	for (uint32_t y = 0; y < image->height; y++) {
+		uint16_t *row = image->pixels + y * image->width;
+		row_spans[y] = span;
+		uint32_t x = 0;
+		while (x < image->width) {
+			while (x < image->width && row[x] == color_key) x++;
+			if (x == image->width) break;
+			uint32_t start = x;
+			while (x < image->width && row[x] != color_key) x++;
+			spans[span++] = (mcugdx_image_span_t){(uint16_t) start, (uint16_t) (x - start)};
+		}
+	}
+	row_spans[image->height] = span;
+
+	if (image->row_spans) mcugdx_mem_free(image->row_spans);
+	image->color_key = color_key;
+	image->row_spans = row_spans;
+	image->spans = spans;
+	return true;
+}
+
+uint64_t mcugdx_image_hash(mcugdx_image_t *image) {
+	uint64_t hash = 0x9e3779b97f4a7c15ull ^ ((uint64_t) image->width << 32 | image->height);
+	uint32_t num_pixels = image->width * image->height;
+	uint16_t *pixels = image->pixels;
+	uint32_t i = 0;
+	for (; i + 4 <= num_pixels; i += 4) {
+		uint64_t word = (uint64_t) pixels[i] | (uint64_t) pixels[i + 1] << 16 | (uint64_t) pixels[i + 2] << 32 | (uint64_t) pixels[i + 3] << 48;
+		word *= 0xff51afd7ed558ccdull;
+		word ^= word >> 32;
+		hash = (hash ^ word) * 0x100000001b3ull;
+	}
+	for (; i < num_pixels; i++) {
+		hash = (hash ^ pixels[i]) * 0x100000001b3ull;
+	}
+
+	// Final avalanche, so every input bit affects all output bits
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+static uint8_t *image_to_rgb(mcugdx_image_t *image) {
+	uint32_t num_pixels = image->width * image->height;
+	uint8_t *rgb = mcugdx_mem_alloc(num_pixels * 3, MCUGDX_MEM_EXTERNAL);
+	if (!rgb) return NULL;
+	for (uint32_t i = 0; i < num_pixels; i++) {
+		uint16_t pixel = reverse_color(image->pixels[i]);
+		uint8_t r = (pixel >> 11) & 0x1f;
+		uint8_t g = (pixel >> 5) & 0x3f;
+		uint8_t b = pixel & 0x1f;
+		rgb[i * 3] = (r << 3) | (r >> 2);
+		rgb[i * 3 + 1] = (g << 2) | (g >> 4);
+		rgb[i * 3 + 2] = (b << 3) | (b >> 2);
+	}
+	return rgb;
+}
+
+static bool write_file(const char *path, const void *header, size_t header_size, const void *data, size_t size) {
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		mcugdx_loge(TAG, "Could not open %s for writing", path);
+		return false;
+	}
+	bool success = fwrite(header, 1, header_size, file) == header_size && fwrite(data, 1, size, file) == size;
+	fclose(file);
+	if (!success) mcugdx_loge(TAG, "Could not write %s", path);
+	return success;
+}
+
+bool mcugdx_image_write_ppm(mcugdx_image_t *image, const char *path) {
+	uint8_t *rgb = image_to_rgb(image);
+	if (!rgb) {
+		mcugdx_loge(TAG, "Could not allocate PPM pixels for %s", path);
+		return false;
+	}
+	char header[32];
+	int header_size = snprintf(header, sizeof(header), "P6\n%i %i\n255\n", (int) image->width, (int) image->height);
+	bool success = write_file(path, header, header_size, rgb, image->width * image->height * 3);
+	mcugdx_mem_free(rgb);
+	return success;
+}
+
+bool mcugdx_image_write_qoi(mcugdx_image_t *image, const char *path) {
+	uint8_t *rgb = image_to_rgb(image);
+	if (!rgb) {
+		mcugdx_loge(TAG, "Could not allocate QOI pixels for %s", path);
+		return false;
+	}
+	qoi_desc desc = {.width = image->width, .height = image->height, .channels = 3, .colorspace = QOI_SRGB};
+	int size;
+	void *encoded = qoi_encode(rgb, &desc, &size);
+	mcugdx_mem_free(rgb);
+	if (!encoded) {
+		mcugdx_loge(TAG, "Could not encode %s", path);
+		return false;
+	}
+	bool success = write_file(path, "", 0, encoded, size);
+	QOI_FREE(encoded);
+	return success;
+}
@@ -0,0 +1,347 @@
+#include "synth.h"
+#include "log.h"
+#include "mem.h"
+#include <math.h>
+#include <string.h>
+
+#define TAG "mcugdx_synth"
+
+// Envelope, pitch and vibrato are updated once per control block, the
+// oscillator itself runs per frame on a 32-bit phase accumulator.
+#define CONTROL_BLOCK_FRAMES 32
+#define RENDER_CHUNK_FRAMES 256
+#define SINE_TABLE_SIZE 256
+#define PI 3.14159265358979323846f
+
+_Static_assert(sizeof(mcugdx_synth_params_t) == 64, "mcugdx_synth_params_t must be 64 bytes");
+
+typedef struct {
+	const mcugdx_synth_params_t *params;
+	float sample_rate;
+	uint32_t frame;
+	uint32_t total_frames;
+	uint32_t phase;
+	uint32_t phase_increment;
+	uint32_t duty_threshold;
+	int32_t amplitude;
+	uint32_t control_frames_left;
+	uint32_t noise_state;
+	int32_t noise_sample;
+	float frequency;
+	float slide;
+	float duty;
+	bool arp_done;
+	bool finished;
+} synth_voice_t;
+
+static int16_t sine_table[SINE_TABLE_SIZE];
+static bool sine_table_initialized = false;
+
+static void init_sine_table(void) {
+	if (sine_table_initialized) return;
+	for (int i = 0; i < SINE_TABLE_SIZE; i++) {
+		sine_table[i] = (int16_t) (sinf(2 * PI * i / SINE_TABLE_SIZE) * INT16_MAX);
+	}
+	sine_table_initialized = true;
+}
+
+void mcugdx_synth_params_init(mcugdx_synth_params_t *params) {
+	memset(params, 0, sizeof(mcugdx_synth_params_t));
+	params->magic = MCUGDX_SYNTH_MAGIC;
+	params->wave = MCUGDX_SYNTH_SQUARE;
+	params->volume = 128;
+	params->duty = 128;
+	params->attack = 0.0f;
+	params->decay = 0.05f;
+	params->sustain = 0.1f;
+	params->sustain_level = 0.5f;
+	params->release = 0.1f;
+	params->frequency = 440.0f;
+	params->arp_mod = 1.0f;
+}
+
+// First time from start on at which the pitch, slide * t + delta_slide * t^2 / 2
+// octaves off the start frequency, drops below target octaves.
+static double slide_end_time(const mcugdx_synth_params_t *params, double start, double target) {
+	double a = params->delta_slide / 2.0;
+	double b = params->slide;
+	if (a * start * start + b * start < target) return start;
+	if (a == 0) return b < 0 ? target / b : INFINITY;
+	double discriminant = b * b + 4 * a * target;
+	if (discriminant < 0) return INFINITY;
+	// The lower root for an upward parabola, the upper one for a downward one
+	double root = (-b - sqrt(discriminant)) / (2 * a);
+	return root >= start ? root : INFINITY;
+}
+
+double mcugdx_synth_duration(const mcugdx_synth_params_t *params) {
+	if (!(params->frequency > 0) || params->frequency < params->min_frequency) return 0;
+	double duration = params->attack + params->decay + params->sustain + params->release;
+	if (!(params->min_frequency > 0)) return duration;
+
+	// The sound also ends once the pitch slides below min_frequency
+	double target = log2(params->min_frequency / params->frequency);
+	double end = slide_end_time(params, 0, target);
+	if (params->arp_time > 0 && end >= params->arp_time) {
+		if (params->arp_mod <= 0) end = params->arp_time;
+		else end = slide_end_time(params, params->arp_time, target - log2(params->arp_mod));
+	}
+	return end < duration ? end : duration;
+}
+
+// Rejects parameters the voice can't produce a single frame from, e.g. a zero
+// length envelope or a frequency at or below zero or min_frequency.
+static bool params_valid(const mcugdx_synth_params_t *params) {
+	return params->attack >= 0 && params->decay >= 0 && params->sustain >= 0 && params->release >= 0 &&
+		   mcugdx_synth_duration(params) > 0;
+}
+
+bool mcugdx_synth_params_load(const char *path, mcugdx_file_system_t *fs, mcugdx_synth_params_t *params) {
+	uint32_t size;
+	uint8_t *bytes = fs->read_fully(path, &size, MCUGDX_MEM_INTERNAL);
+	if (!bytes) {
+		mcugdx_loge(TAG, "Could not read synth parameters %s", path);
+		return false;
+	}
+
+	if (size != sizeof(mcugdx_synth_params_t) || ((mcugdx_synth_params_t *) bytes)->magic != MCUGDX_SYNTH_MAGIC) {
+		mcugdx_loge(TAG, "Invalid synth parameters %s", path);
+		mcugdx_mem_free(bytes);
+		return false;
+	}
+
+	if (!params_valid((mcugdx_synth_params_t *) bytes)) {
+		mcugdx_loge(TAG, "Synth parameters %s produce no sound", path);
+		mcugdx_mem_free(bytes);
+		return false;
+	}
+
+	memcpy(params, bytes, sizeof(mcugdx_synth_params_t));
+	mcugdx_mem_free(bytes);
+	return true;
+}
+
+static float envelope(const mcugdx_synth_params_t *params, float t) {
+	if (t < params->attack) return t / params->attack;
+	t -= params->attack;
+	if (t < params->decay) return 1.0f - (1.0f - params->sustain_level) * t / params->decay;
+	t -= params->decay;
+	if (t < params->sustain) return params->sustain_level;
+	t -= params->sustain;
+	if (t < params->release) return params->sustain_level * (1.0f - t / params->release);
+	return 0;
+}
+
+static void voice_reset(synth_voice_t *voice) {
+	const mcugdx_synth_params_t *params = voice->params;
+	voice->frame = 0;
+	voice->total_frames = (uint32_t) (mcugdx_synth_duration(params) * voice->sample_rate);
+	voice->phase = 0;
+	voice->control_frames_left = 0;
+	voice->noise_state = 0x12345678;
+	voice->noise_sample = 0;
+	voice->frequency = params->frequency;
+	voice->slide = params->slide;
+	voice->duty = params->duty / 510.0f;
+	voice->arp_done = params->arp_time <= 0;
+	voice->finished = false;
+}
+
+static void voice_update_control(synth_voice_t *voice) {
+	const mcugdx_synth_params_t *params = voice->params;
+	float t = voice->frame / voice->sample_rate;
+	float dt = CONTROL_BLOCK_FRAMES / voice->sample_rate;
+
+	if (!voice->arp_done && t >= params->arp_time) {
+		voice->frequency *= params->arp_mod;
+		voice->arp_done = true;
+	}
+
+	if (voice->slide != 0) voice->frequency *= exp2f(voice->slide * dt);
+	voice->slide += params->delta_slide * dt;
+	if (voice->frequency < params->min_frequency || voice->frequency <= 0) {
+		voice->finished = true;
+		return;
+	}
+
+	float frequency = voice->frequency;
+	if (params->vibrato_depth != 0) {
+		float vibrato = sinf(2 * PI * params->vibrato_speed * t);
+		frequency *= exp2f(params->vibrato_depth * vibrato / 12.0f);
+	}
+	if (frequency > voice->sample_rate / 2) frequency = voice->sample_rate / 2;
+	voice->phase_increment = (uint32_t) (frequency / voice->sample_rate * 4294967296.0f);
+
+	voice->duty += params->duty_sweep * 0.5f * dt;
+	if (voice->duty < 0) voice->duty = 0;
+	if (voice->duty > 0.5f) voice->duty = 0.5f;
+	voice->duty_threshold = (uint32_t) (voice->duty * 4294967296.0f);
+
+	voice->amplitude = (int32_t) (envelope(params, t) * params->volume * (INT16_MAX / 255.0f));
+	voice->control_frames_left = CONTROL_BLOCK_FRAMES;
+}
+
+static inline int32_t voice_oscillate(synth_voice_t *voice) {
+	uint32_t phase = voice->phase;
+	uint32_t next_phase = phase + voice->phase_increment;
+	voice->phase = next_phase;
+
+	switch (voice->params->wave) {
+		case MCUGDX_SYNTH_SQUARE:
+			return phase < voice->duty_threshold ? INT16_MAX : -INT16_MAX;
+		case MCUGDX_SYNTH_SAW:
+			return (int32_t) phase >> 16;
+		case MCUGDX_SYNTH_SINE:
+			return sine_table[phase >> 24];
+		case MCUGDX_SYNTH_NOISE:
+			// New random value 16 times per period, so pitch still affects the noise color
+			if ((phase ^ next_phase) & 0xf0000000) {
+				uint32_t x = voice->noise_state;
+				x ^= x << 13;
+				x ^= x >> 17;
+				x ^= x << 5;
+				voice->noise_state = x;
+				voice->noise_sample = (int32_t) x >> 16;
+			}
+			return voice->noise_sample;
+		default:
+			return 0;
+	}
+}
+
+static uint32_t voice_generate(synth_voice_t *voice, int32_t *output, uint32_t num_frames,
+							   mcugdx_audio_channels_t channels, int32_t pan_left_gain,
+							   int32_t pan_right_gain, int32_t final_gain) {
+	uint32_t frames_generated = 0;
+	while (frames_generated < num_frames && !voice->finished && voice->frame < voice->total_frames) {
+		if (voice->control_frames_left == 0) {
+			voice_update_control(voice);
+			if (voice->finished) break;
+		}
+
+		uint32_t frames = num_frames - frames_generated;
+		if (frames > voice->control_frames_left) frames = voice->control_frames_left;
+		if (frames > voice->total_frames - voice->frame) frames = voice->total_frames - voice->frame;
+
+		int32_t amplitude = voice->amplitude;
+		for (uint32_t i = 0; i < frames; i++) {
+			int32_t sample = (voice_oscillate(voice) * amplitude) >> 15;
+			output = mcugdx_audio_mix_frame(output, channels, sample, sample, pan_left_gain, pan_right_gain, final_gain);
+		}
+
+		voice->control_frames_left -= frames;
+		voice->frame += frames;
+		frames_generated += frames;
+	}
+	return frames_generated;
+}
+
+// Runs the first control block at the mixer sample rate, which also catches
+// sounds shorter than a frame or sliding below min_frequency right away.
+static bool voice_produces_frames(const mcugdx_synth_params_t *params) {
+	if (!params_valid(params)) return false;
+	synth_voice_t voice = {
+			.params = params,
+			.sample_rate = (float) mcugdx_audio_get_sample_rate()};
+	voice_reset(&voice);
+	if (voice.total_frames == 0) return false;
+	voice_update_control(&voice);
+	return !voice.finished;
+}
+
+static bool synth_init(void *user_data, void **voice_state) {
+	synth_voice_t *voice = mcugdx_mem_alloc(sizeof(synth_voice_t), MCUGDX_MEM_INTERNAL);
+	if (!voice) return false;
+	voice->params = (const mcugdx_synth_params_t *) user_data;
+	voice->sample_rate = (float) mcugdx_audio_get_sample_rate();
+	voice_reset(voice);
+	*voice_state = voice;
+	return true;
+}
+
+static uint32_t synth_generate(void *voice_state, int32_t *output, uint32_t num_frames,
+							   mcugdx_audio_channels_t channels, int32_t pan_left_gain,
+							   int32_t pan_right_gain, int32_t final_gain) {
+	return voice_generate((synth_voice_t *) voice_state, output, num_frames, channels, pan_left_gain, pan_right_gain, final_gain);
+}
+
+static void synth_reset(void *voice_state) {
+	voice_reset((synth_voice_t *) voice_state);
+}
+
+static void synth_free(void *voice_state) {
+	mcugdx_mem_free(voice_state);
+}
+
+static void synth_destroy(void *user_data) {
+	mcugdx_mem_free(user_data);
+}
+
+static const mcugdx_audio_generator_t synth_generator = {
+		.init = synth_init,
+		.generate = synth_generate,
+		.reset = synth_reset,
+		.free = synth_free,
+		.destroy = synth_destroy};
+
+mcugdx_sound_t *mcugdx_synth_create(const mcugdx_synth_params_t *params, mcugdx_memory_type_t mem_type) {
+	init_sine_table();
+
+	// A looping voice that never produces a frame would keep the mixer resetting it
+	if (!voice_produces_frames(params)) {
+		mcugdx_loge(TAG, "Synth parameters produce no sound");
+		return NULL;
+	}
+
+	mcugdx_synth_params_t *params_copy = mcugdx_mem_alloc(sizeof(mcugdx_synth_params_t), mem_type);
+	if (!params_copy) {
+		mcugdx_loge(TAG, "Failed to allocate synth parameters");
+		return NULL;
+	}
+	memcpy(params_copy, params, sizeof(mcugdx_synth_params_t));
+
+	mcugdx_sound_t *sound = mcugdx_sound_create_generator(&synth_generator, params_copy, MCUGDX_MONO, mem_type);
+	if (!sound) {
+		mcugdx_mem_free(params_copy);
+		return NULL;
+	}
+	sound->num_frames = (uint32_t) (mcugdx_synth_duration(params) * sound->sample_rate);
+	return sound;
+}
+
+mcugdx_sound_t *mcugdx_synth_render(const mcugdx_synth_params_t *params, mcugdx_memory_type_t mem_type) {
+	init_sine_table();
+
+	synth_voice_t voice = {
+			.params = params,
+			.sample_rate = (float) mcugdx_audio_get_sample_rate()};
+	if (!voice_produces_frames(params)) {
+		mcugdx_loge(TAG, "Synth parameters produce no sound");
+		return NULL;
+	}
+	voice_reset(&voice);
+
+	int16_t *frames = mcugdx_mem_alloc(voice.total_frames * sizeof(int16_t), mem_type);
+	if (!frames) {
+		mcugdx_loge(TAG, "Failed to allocate %li synth frames", voice.total_frames);
+		return NULL;
+	}
+
+	// Unity gains, so the mixer's pan/volume stages leave the samples untouched
+	int32_t chunk[RENDER_CHUNK_FRAMES];
+	uint32_t num_frames = 0;
+	while (num_frames < voice.total_frames) {
+		memset(chunk, 0, sizeof(chunk));
+		uint32_t generated = voice_generate(&voice, chunk, RENDER_CHUNK_FRAMES, MCUGDX_MONO, 256, 256, 256);
+		if (generated == 0) break;
+		for (uint32_t i = 0; i < generated; i++) {
+			int32_t sample = chunk[i];
+			frames[num_frames + i] = (int16_t) (sample > INT16_MAX ? INT16_MAX : (sample < INT16_MIN ? INT16_MIN : sample));
+		}
+		num_frames += generated;
+	}
+
+	mcugdx_sound_t *sound = mcugdx_sound_load_raw(frames, num_frames, MCUGDX_MONO, (uint32_t) voice.sample_rate, mem_type);
+	if (!sound) mcugdx_mem_free(frames);
+	return sound;
+}
@@ -290,7 +290,9 @@ is filled with the description from the file header.
 
 The returned pixel data should be free()d after use. */
 
-void *qoi_decode(const void *data, int size, qoi_desc *desc, int channels, mcugdx_memory_type_t mem_type);
+// mcugdx: decodes to byte swapped RGB565. If alpha_bits is 4 or 8, *alpha is set
+// to a newly allocated alpha plane with that many bits per pixel.
+void *qoi_decode(const void *data, int size, qoi_desc *desc, int channels, uint8_t **alpha, int alpha_bits, mcugdx_memory_type_t mem_type);
 
 
 #ifdef __cplusplus
@@ -492,10 +494,11 @@ void *qoi_encode(const void *data, const qoi_desc *desc, int *out_len) {
 #error "Unsupported compiler"
 #endif
 
-void *qoi_decode(const void *data, int size, qoi_desc *desc, int channels, mcugdx_memory_type_t mem_type) {
+void *qoi_decode(const void *data, int size, qoi_desc *desc, int channels, uint8_t **alpha, int alpha_bits, mcugdx_memory_type_t mem_type) {
 	const unsigned char *bytes;
 	unsigned int header_magic;
 	uint16_t *pixels;
+	uint8_t *alpha_plane = NULL;
 	qoi_rgba_t index[64];
 	qoi_rgba_t px;
 	int px_len, chunks_len, px_pos;
@@ -534,6 +537,14 @@ void *qoi_decode(const void *data, int size, qoi_desc *desc, int channels, mcugd
 	if (!pixels) {
 		return NULL;
 	}
+	if (alpha_bits == 4 || alpha_bits == 8) {
+		alpha_plane = (uint8_t *) mcugdx_mem_alloc((px_len * alpha_bits + 7) / 8, mem_type);
+		if (!alpha_plane) {
+			mcugdx_mem_free(pixels);
+			return NULL;
+		}
+		*alpha = alpha_plane;
+	}
 
 	QOI_ZEROARR(index);
 	px.rgba.r = 0;
@@ -583,6 +594,13 @@ void *qoi_decode(const void *data, int size, qoi_desc *desc, int channels, mcugd
 			uint8_t b = px.rgba.b >> 3;
 			pixels[px_pos] = swap_bytes((r << 11) | (g << 5) | b);
 		}
+		if (alpha_bits == 8) {
+			alpha_plane[px_pos] = px.rgba.a;
+		} else if (alpha_bits == 4) {
+			// Two pixels per byte, the even one in the low nibble
+			if (px_pos & 1) alpha_plane[px_pos >> 1] |= (px.rgba.a >> 4) << 4;
+			else alpha_plane[px_pos >> 1] = px.rgba.a >> 4;
+		}
 	}
 
 	return pixels;
@@ -639,7 +657,7 @@ void *qoi_read(const char *filename, qoi_desc *desc, int channels) {
 
 	bytes_read = fread(data, 1, size, f);
 	fclose(f);
-	pixels = (bytes_read != size) ? NULL : qoi_decode(data, bytes_read, desc, channels);
+	pixels = (bytes_read != size) ? NULL : qoi_decode(data, bytes_read, desc, channels, NULL, 0, MCUGDX_MEM_EXTERNAL);
 	QOI_FREE(data);
 	return pixels;
 }
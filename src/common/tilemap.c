@@ -0,0 +1,256 @@
+#include "tilemap.h"
+#include "log.h"
+#include <math.h>
+#include <string.h>
+
+#define TAG "mcugdx_tilemap"
+#define HEADER_SIZE 12
+#define LAYER_HEADER_SIZE 14
+
+typedef enum {
+	TILE_OPAQUE,
+	TILE_MIXED,
+	TILE_EMPTY
+} tile_kind_t;
+
+static inline uint32_t read_u16(const uint8_t *data) {
+	return data[0] | (data[1] << 8);
+}
+
+mcugdx_tilemap_t *mcugdx_tilemap_create(mcugdx_image_t *tileset, uint32_t tile_width, uint32_t tile_height, uint16_t color_key, mcugdx_memory_type_t mem_type) {
+	if (tile_width == 0 || tile_height == 0 || tile_width > tileset->width || tile_height > tileset->height) {
+		mcugdx_loge(TAG, "Invalid tile size %lix%li for a %lix%li tileset", tile_width, tile_height, tileset->width, tileset->height);
+		return NULL;
+	}
+
+	mcugdx_tilemap_t *map = mcugdx_mem_alloc(sizeof(mcugdx_tilemap_t), mem_type);
+	if (!map) {
+		mcugdx_loge(TAG, "Could not allocate tilemap");
+		return NULL;
+	}
+	memset(map, 0, sizeof(mcugdx_tilemap_t));
+	map->tileset = tileset;
+	map->tile_width = tile_width;
+	map->tile_height = tile_height;
+	map->color_key = color_key;
+	map->mem_type = mem_type;
+
+	uint32_t columns = tileset->width / tile_width;
+	map->num_tiles = columns * (tileset->height / tile_height);
+	map->bytes_per_tile = map->num_tiles < 256 ? 1 : 2;
+	map->tile_kinds = mcugdx_mem_alloc(map->num_tiles, mem_type);
+	if (!map->tile_kinds) {
+		mcugdx_loge(TAG, "Could not allocate tile kinds");
+		mcugdx_mem_free(map);
+		return NULL;
+	}
+
+	// Classify the tiles once, so drawing can skip empty tiles and copy opaque
+	// ones without looking at the color key
+	bool any_mixed = false;
+	for (uint32_t i = 0; i < map->num_tiles; i++) {
+		uint16_t *pixels = tileset->pixels + (i / columns) * tile_height * tileset->width + (i % columns) * tile_width;
+		uint32_t num_keyed = 0;
+		for (uint32_t y = 0; y < tile_height; y++) {
+			for (uint32_t x = 0; x < tile_width; x++) {
+				if (pixels[y * tileset->width + x] == color_key) num_keyed++;
+			}
+		}
+		map->tile_kinds[i] = num_keyed == 0 ? TILE_OPAQUE : num_keyed == tile_width * tile_height ? TILE_EMPTY : TILE_MIXED;
+		any_mixed |= map->tile_kinds[i] == TILE_MIXED;
+	}
+	if (any_mixed && (!tileset->spans || tileset->color_key != color_key)) mcugdx_image_make_sprite(tileset, color_key);
+	return map;
+}
+
+mcugdx_tilemap_layer_t *mcugdx_tilemap_add_layer(mcugdx_tilemap_t *map, uint32_t width, uint32_t height, uint32_t flags) {
+	mcugdx_tilemap_layer_t *layers = mcugdx_mem_alloc((map->num_layers + 1) * sizeof(mcugdx_tilemap_layer_t), map->mem_type);
+	uint8_t *tiles = mcugdx_mem_alloc(width * height * map->bytes_per_tile, map->mem_type);
+	if (!layers || !tiles) {
+		mcugdx_loge(TAG, "Could not allocate %lix%li layer", width, height);
+		if (layers) mcugdx_mem_free(layers);
+		if (tiles) mcugdx_mem_free(tiles);
+		return NULL;
+	}
+	if (map->layers) {
+		memcpy(layers, map->layers, map->num_layers * sizeof(mcugdx_tilemap_layer_t));
+		mcugdx_mem_free(map->layers);
+	}
+	map->layers = layers;
+
+	mcugdx_tilemap_layer_t *layer = &map->layers[map->num_layers++];
+	memset(tiles, 0, width * height * map->bytes_per_tile);
+	layer->width = width;
+	layer->height = height;
+	layer->tiles = tiles;
+	layer->offset_x = 0;
+	layer->offset_y = 0;
+	layer->parallax_x = 1;
+	layer->parallax_y = 1;
+	layer->flags = flags;
+	return layer;
+}
+
+static bool load_layers(mcugdx_tilemap_t *map, const char *path, uint8_t *data, uint32_t size) {
+	uint32_t num_layers = read_u16(data + 10);
+	uint32_t offset = HEADER_SIZE;
+	for (uint32_t i = 0; i < num_layers; i++) {
+		uint8_t *header = data + offset;
+		uint32_t width = offset + LAYER_HEADER_SIZE <= size ? read_u16(header) : 0;
+		uint32_t height = offset + LAYER_HEADER_SIZE <= size ? read_u16(header + 2) : 0;
+		uint32_t tiles_size = width * height * map->bytes_per_tile;
+		offset += LAYER_HEADER_SIZE;
+		if (offset + tiles_size > size) {
+			mcugdx_loge(TAG, "Tilemap %s is truncated", path);
+			return false;
+		}
+
+		mcugdx_tilemap_layer_t *layer = mcugdx_tilemap_add_layer(map, width, height, read_u16(header + 12));
+		if (!layer) return false;
+		layer->offset_x = (int16_t) read_u16(header + 4);
+		layer->offset_y = (int16_t) read_u16(header + 6);
+		layer->parallax_x = read_u16(header + 8) / 256.0f;
+		layer->parallax_y = read_u16(header + 10) / 256.0f;
+		memcpy(layer->tiles, data + offset, tiles_size);
+		offset += tiles_size;
+		// Tiles index into the tileset when drawn, so they must exist
+		for (uint32_t y = 0; y < height; y++) {
+			for (uint32_t x = 0; x < width; x++) {
+				uint32_t tile = mcugdx_tilemap_get_tile(map, layer, x, y);
+				if (tile > map->num_tiles) {
+					mcugdx_loge(TAG, "Tilemap %s has tile %li, but the tileset only has %li tiles", path, tile, map->num_tiles);
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+mcugdx_tilemap_t *mcugdx_tilemap_load(const char *path, mcugdx_file_system_t *fs, mcugdx_image_t *tileset, mcugdx_memory_type_t mem_type) {
+	uint32_t size;
+	uint8_t *data = fs->read_fully(path, &size, mem_type);
+	if (!data) return NULL;
+
+	if (size < HEADER_SIZE || memcmp(data, "TMAP", 4)) {
+		mcugdx_loge(TAG, "%s is not a tilemap", path);
+		mcugdx_mem_free(data);
+		return NULL;
+	}
+
+	mcugdx_tilemap_t *map = mcugdx_tilemap_create(tileset, read_u16(data + 4), read_u16(data + 6), (uint16_t) read_u16(data + 8), mem_type);
+	if (map && !load_layers(map, path, data, size)) {
+		mcugdx_tilemap_unload(map);
+		map = NULL;
+	}
+	mcugdx_mem_free(data);
+	return map;
+}
+
+void mcugdx_tilemap_unload(mcugdx_tilemap_t *map) {
+	for (uint32_t i = 0; i < map->num_layers; i++) {
+		mcugdx_mem_free(map->layers[i].tiles);
+	}
+	if (map->layers) mcugdx_mem_free(map->layers);
+	if (map->blits) mcugdx_mem_free(map->blits);
+	mcugdx_mem_free(map->tile_kinds);
+	mcugdx_mem_free(map);
+}
+
+uint32_t mcugdx_tilemap_get_tile(mcugdx_tilemap_t *map, mcugdx_tilemap_layer_t *layer, uint32_t x, uint32_t y) {
+	if (x >= layer->width || y >= layer->height) return 0;
+	uint32_t index = y * layer->width + x;
+	if (map->bytes_per_tile == 1) return layer->tiles[index];
+	return read_u16(layer->tiles + index * 2);
+}
+
+void mcugdx_tilemap_set_tile(mcugdx_tilemap_t *map, mcugdx_tilemap_layer_t *layer, uint32_t x, uint32_t y, uint32_t tile) {
+	if (x >= layer->width || y >= layer->height || tile > map->num_tiles) return;
+	uint32_t index = y * layer->width + x;
+	if (map->bytes_per_tile == 1) {
+		layer->tiles[index] = (uint8_t) tile;
+	} else {
+		layer->tiles[index * 2] = (uint8_t) tile;
+		layer->tiles[index * 2 + 1] = (uint8_t) (tile >> 8);
+	}
+}
+
+// Tile coordinate of the pixel, wrapped if the layer repeats. Returns false
+// if the coordinate is outside a non-repeating layer.
+static inline bool tile_coordinate(int32_t pixel, uint32_t tile_size, uint32_t num_tiles, bool repeat, uint32_t *tile) {
+	int32_t t = pixel >= 0 ? pixel / (int32_t) tile_size : -((-pixel + (int32_t) tile_size - 1) / (int32_t) tile_size);
+	if (repeat) {
+		t %= (int32_t) num_tiles;
+		if (t < 0) t += num_tiles;
+	} else if (t < 0 || t >= (int32_t) num_tiles) {
+		return false;
+	}
+	*tile = (uint32_t) t;
+	return true;
+}
+
+void mcugdx_tilemap_draw_layer(mcugdx_tilemap_t *map, uint32_t layer_index, int32_t scroll_x, int32_t scroll_y) {
+	if (layer_index >= map->num_layers) return;
+	mcugdx_tilemap_layer_t *layer = &map->layers[layer_index];
+	if (layer->width == 0 || layer->height == 0) return;
+
+	mcugdx_rect_t clip;
+	mcugdx_display_get_clip(&clip);
+	int32_t tile_width = (int32_t) map->tile_width;
+	int32_t tile_height = (int32_t) map->tile_height;
+
+	// Enough blits to cover the clip rect, which may be a target image larger
+	// than the screen
+	uint32_t capacity = (uint32_t) ((clip.width / tile_width + 2) * (clip.height / tile_height + 2));
+	if (map->blit_capacity < capacity) {
+		if (map->blits) mcugdx_mem_free(map->blits);
+		map->blits = mcugdx_mem_alloc(capacity * sizeof(mcugdx_blit_t), MCUGDX_MEM_INTERNAL);
+		map->blit_capacity = map->blits ? capacity : 0;
+		if (!map->blits) {
+			mcugdx_loge(TAG, "Could not allocate %li tile blits", capacity);
+			return;
+		}
+	}
+
+	// Layer pixel at the top left screen corner, and the screen position of
+	// the tile containing the top left corner of the clip rect
+	int32_t layer_x = (int32_t) floorf(scroll_x * layer->parallax_x) - layer->offset_x;
+	int32_t layer_y = (int32_t) floorf(scroll_y * layer->parallax_y) - layer->offset_y;
+	int32_t start_x = clip.x - ((((layer_x + clip.x) % tile_width) + tile_width) % tile_width);
+	int32_t start_y = clip.y - ((((layer_y + clip.y) % tile_height) + tile_height) % tile_height);
+
+	uint32_t columns = map->tileset->width / map->tile_width;
+	bool keyed = layer->flags & MCUGDX_TILEMAP_KEYED;
+	uint32_t num_blits = 0;
+	for (int32_t y = start_y; y < clip.y + clip.height; y += tile_height) {
+		uint32_t tile_y;
+		if (!tile_coordinate(layer_y + y, map->tile_height, layer->height, layer->flags & MCUGDX_TILEMAP_REPEAT_Y, &tile_y)) continue;
+		for (int32_t x = start_x; x < clip.x + clip.width; x += tile_width) {
+			uint32_t tile_x;
+			if (!tile_coordinate(layer_x + x, map->tile_width, layer->width, layer->flags & MCUGDX_TILEMAP_REPEAT_X, &tile_x)) continue;
+			uint32_t tile = mcugdx_tilemap_get_tile(map, layer, tile_x, tile_y);
+			if (tile == 0) continue;
+
+			tile--;
+			uint8_t kind = keyed ? map->tile_kinds[tile] : TILE_OPAQUE;
+			if (kind == TILE_EMPTY) continue;
+			mcugdx_blit_t *blit = &map->blits[num_blits++];
+			blit->image = map->tileset;
+			blit->x = x;
+			blit->y = y;
+			blit->src_x = (int32_t) (tile % columns) * tile_width;
+			blit->src_y = (int32_t) (tile / columns) * tile_height;
+			blit->src_width = tile_width;
+			blit->src_height = tile_height;
+			blit->color_key = map->color_key;
+			blit->flags = kind == TILE_MIXED ? MCUGDX_BLIT_KEYED : 0;
+		}
+	}
+	mcugdx_display_blit_batch(map->blits, num_blits, 0);
+}
+
+void mcugdx_tilemap_draw(mcugdx_tilemap_t *map, int32_t scroll_x, int32_t scroll_y) {
+	for (uint32_t i = 0; i < map->num_layers; i++) {
+		mcugdx_tilemap_draw_layer(map, i, scroll_x, scroll_y);
+	}
+}
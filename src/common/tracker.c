@@ -0,0 +1,582 @@
+#include "tracker.h"
+#include "log.h"
+#include "mem.h"
+#include <string.h>
+
+#define TAG "mcugdx_tracker"
+
+#define NUM_SAMPLES 31
+#define NUM_ORDERS 128
+#define NUM_ROWS 64
+#define MAX_CHANNELS 32
+#define HEADER_SIZE 1084
+#define SAMPLE_HEADER_OFFSET 20
+#define SAMPLE_HEADER_SIZE 30
+#define SONG_LENGTH_OFFSET 950
+#define ORDERS_OFFSET 952
+#define SIGNATURE_OFFSET 1080
+
+// PAL Paula clock divided by 2, period p plays a sample frame at PAULA_CLOCK / p Hz
+#define PAULA_CLOCK 3546895
+#define MIN_PERIOD 113
+#define MAX_PERIOD 856
+
+// Stereo separation of the hard left/right Amiga channels, 256 = full
+#define PAN_MAIN 192
+#define PAN_OTHER (256 - PAN_MAIN)
+
+typedef struct {
+	int8_t *data;
+	uint32_t length;
+	uint32_t loop_start;
+	uint32_t loop_length;
+	int8_t finetune;
+	uint8_t volume;
+} tracker_sample_t;
+
+typedef struct {
+	mcugdx_file_system_t *fs;
+	const char *path;
+	uint32_t sample_rate;
+	uint32_t num_channels;
+	uint32_t song_length;
+	uint32_t pattern_size;
+	uint8_t orders[NUM_ORDERS];
+	tracker_sample_t samples[NUM_SAMPLES];
+	int8_t *sample_data;
+} tracker_song_t;
+
+typedef struct {
+	tracker_sample_t *sample;
+	// Selected by the last sample number, played from the next note on. Rows
+	// with only a sample number just take over its volume, like in ProTracker.
+	tracker_sample_t *instrument;
+	uint32_t index;
+	uint32_t frac;
+	uint32_t step;
+	bool active;
+	int32_t period;
+	int32_t target_period;
+	int32_t volume;
+	int32_t pan_left;
+	int32_t pan_right;
+	uint8_t effect;
+	uint8_t param;
+	uint8_t porta_speed;
+	uint8_t vibrato_speed;
+	uint8_t vibrato_depth;
+	uint8_t vibrato_pos;
+	// Last non-zero 9xx parameter, reused by 900
+	uint8_t sample_offset;
+	int32_t delayed_period;
+} tracker_channel_t;
+
+typedef struct {
+	tracker_song_t *song;
+	mcugdx_file_handle_t file;
+	uint8_t *pattern;
+	int32_t loaded_pattern;
+	uint32_t order;
+	uint32_t row;
+	uint32_t tick;
+	uint32_t speed;
+	uint32_t frames_per_tick;
+	uint32_t tick_frames_left;
+	int32_t jump_order;
+	int32_t jump_row;
+	bool finished;
+	tracker_channel_t channels[MAX_CHANNELS];
+} tracker_voice_t;
+
+// ProTracker vibrato half sine
+static const uint8_t vibrato_table[32] = {
+		0, 24, 49, 74, 97, 120, 141, 161, 180, 197, 212, 224, 235, 244, 250, 253,
+		255, 253, 250, 244, 235, 224, 212, 197, 180, 161, 141, 120, 97, 74, 49, 24};
+
+// 2^(n/12) in 16.16 fixed point, used by the arpeggio effect
+static const uint32_t semitone_table[16] = {
+		65536, 69433, 73562, 77936, 82570, 87480, 92682, 98193,
+		104032, 110218, 116772, 123715, 131072, 138866, 147123, 155872};
+
+// 2^(-finetune/96) in 16.16 fixed point for finetune -8 to 7
+static const uint32_t finetune_table[16] = {
+		69433, 68933, 68437, 67945, 67456, 66971, 66489, 66011,
+		65536, 65065, 64596, 64132, 63670, 63212, 62757, 62306};
+
+static uint32_t read_u16_be(const uint8_t *bytes) {
+	return (bytes[0] << 8) | bytes[1];
+}
+
+static uint32_t parse_num_channels(const uint8_t *sig) {
+	if (!memcmp(sig, "M.K.", 4) || !memcmp(sig, "M!K!", 4) || !memcmp(sig, "FLT4", 4) || !memcmp(sig, "4CHN", 4)) return 4;
+	if (!memcmp(sig, "FLT8", 4) || !memcmp(sig, "OCTA", 4) || !memcmp(sig, "CD81", 4)) return 8;
+	if (sig[0] >= '1' && sig[0] <= '9' && !memcmp(sig + 1, "CHN", 3)) return sig[0] - '0';
+	if (sig[0] >= '0' && sig[0] <= '9' && sig[1] >= '0' && sig[1] <= '9' && !memcmp(sig + 2, "CH", 2)) {
+		return (sig[0] - '0') * 10 + (sig[1] - '0');
+	}
+	return 0;
+}
+
+static void channel_update_step(tracker_voice_t *voice, tracker_channel_t *channel, int32_t period, uint32_t semitones) {
+	if (period < MIN_PERIOD / 2) period = MIN_PERIOD / 2;
+	uint64_t step = ((uint64_t) PAULA_CLOCK << 16) / ((uint64_t) period * voice->song->sample_rate);
+	channel->step = (uint32_t) ((step * semitone_table[semitones & 0xf]) >> 16);
+}
+
+static void channel_trigger(tracker_channel_t *channel, int32_t period) {
+	channel->period = period;
+	channel->index = 0;
+	channel->frac = 0;
+	channel->vibrato_pos = 0;
+	channel->sample = channel->instrument;
+	channel->active = channel->sample && channel->sample->length > 0;
+}
+
+static void channel_volume_slide(tracker_channel_t *channel, uint8_t param) {
+	if (param >> 4) channel->volume += param >> 4;
+	else channel->volume -= param & 0xf;
+	if (channel->volume < 0) channel->volume = 0;
+	if (channel->volume > 64) channel->volume = 64;
+}
+
+static void channel_tone_portamento(tracker_channel_t *channel) {
+	if (channel->target_period == 0) return;
+	if (channel->period < channel->target_period) {
+		channel->period += channel->porta_speed;
+		if (channel->period > channel->target_period) channel->period = channel->target_period;
+	} else if (channel->period > channel->target_period) {
+		channel->period -= channel->porta_speed;
+		if (channel->period < channel->target_period) channel->period = channel->target_period;
+	}
+}
+
+static int32_t channel_vibrato_period(tracker_channel_t *channel) {
+	int32_t delta = (vibrato_table[channel->vibrato_pos & 31] * channel->vibrato_depth) >> 7;
+	return channel->period + ((channel->vibrato_pos & 32) ? -delta : delta);
+}
+
+static bool voice_load_pattern(tracker_voice_t *voice, uint32_t pattern) {
+	if (voice->loaded_pattern == (int32_t) pattern) return true;
+	tracker_song_t *song = voice->song;
+	if (!song->fs->seek(voice->file, HEADER_SIZE + pattern * song->pattern_size)) return false;
+	if (song->fs->read(voice->file, voice->pattern, song->pattern_size) != song->pattern_size) return false;
+	voice->loaded_pattern = pattern;
+	return true;
+}
+
+static void voice_process_row(tracker_voice_t *voice) {
+	tracker_song_t *song = voice->song;
+	if (voice->order >= song->song_length || !voice_load_pattern(voice, song->orders[voice->order])) {
+		voice->finished = true;
+		return;
+	}
+
+	uint8_t *cell = voice->pattern + voice->row * song->num_channels * 4;
+	for (uint32_t i = 0; i < song->num_channels; i++, cell += 4) {
+		tracker_channel_t *channel = &voice->channels[i];
+		uint32_t sample_num = (cell[0] & 0xf0) | (cell[2] >> 4);
+		int32_t period = ((cell[0] & 0x0f) << 8) | cell[1];
+		uint8_t effect = cell[2] & 0x0f;
+		uint8_t param = cell[3];
+		channel->effect = effect;
+		channel->param = param;
+		channel->delayed_period = 0;
+
+		if (sample_num > 0 && sample_num <= NUM_SAMPLES) {
+			channel->instrument = &song->samples[sample_num - 1];
+			channel->volume = channel->instrument->volume;
+		}
+
+		if (period) {
+			if (channel->instrument) period = (int32_t) ((period * finetune_table[(channel->instrument->finetune + 8) & 0xf]) >> 16);
+			if (effect == 0x3 || effect == 0x5) {
+				channel->target_period = period;
+			} else if (effect == 0xe && (param >> 4) == 0xd && (param & 0xf)) {
+				channel->delayed_period = period;
+			} else {
+				channel_trigger(channel, period);
+			}
+		}
+
+		switch (effect) {
+			case 0x3:
+				if (param) channel->porta_speed = param;
+				break;
+			case 0x4:
+				if (param >> 4) channel->vibrato_speed = param >> 4;
+				if (param & 0xf) channel->vibrato_depth = param & 0xf;
+				break;
+			case 0x9:
+				if (param) channel->sample_offset = param;
+				if (period && channel->sample) {
+					channel->index = channel->sample_offset << 8;
+					if (channel->index >= channel->sample->length) channel->active = false;
+				}
+				break;
+			case 0xb:
+				voice->jump_order = param;
+				if (voice->jump_row < 0) voice->jump_row = 0;
+				break;
+			case 0xc:
+				channel->volume = param > 64 ? 64 : param;
+				break;
+			case 0xd:
+				if (voice->jump_order < 0) voice->jump_order = voice->order + 1;
+				voice->jump_row = (param >> 4) * 10 + (param & 0xf);
+				break;
+			case 0xe:
+				switch (param >> 4) {
+					case 0x1:
+						channel->period -= param & 0xf;
+						if (channel->period < MIN_PERIOD) channel->period = MIN_PERIOD;
+						break;
+					case 0x2:
+						channel->period += param & 0xf;
+						if (channel->period > MAX_PERIOD) channel->period = MAX_PERIOD;
+						break;
+					case 0xa:
+						channel->volume += param & 0xf;
+						if (channel->volume > 64) channel->volume = 64;
+						break;
+					case 0xb:
+						channel->volume -= param & 0xf;
+						if (channel->volume < 0) channel->volume = 0;
+						break;
+					case 0xc:
+						if ((param & 0xf) == 0) channel->volume = 0;
+						break;
+				}
+				break;
+			case 0xf:
+				if (param == 0) {
+					break;
+				} else if (param < 32) {
+					voice->speed = param;
+				} else {
+					// Tempo in BPM, one tick lasts 2.5 / BPM seconds
+					voice->frames_per_tick = song->sample_rate * 5 / (param * 2);
+				}
+				break;
+		}
+
+		if (channel->period) channel_update_step(voice, channel, channel->period, 0);
+	}
+}
+
+static void voice_process_tick(tracker_voice_t *voice) {
+	tracker_song_t *song = voice->song;
+	for (uint32_t i = 0; i < song->num_channels; i++) {
+		tracker_channel_t *channel = &voice->channels[i];
+		uint8_t param = channel->param;
+		uint32_t semitones = 0;
+		int32_t period = channel->period;
+
+		switch (channel->effect) {
+			case 0x0:
+				if (param) {
+					uint32_t arp_tick = voice->tick % 3;
+					semitones = arp_tick == 1 ? param >> 4 : (arp_tick == 2 ? param & 0xf : 0);
+				}
+				break;
+			case 0x1:
+				channel->period -= param;
+				if (channel->period < MIN_PERIOD) channel->period = MIN_PERIOD;
+				period = channel->period;
+				break;
+			case 0x2:
+				channel->period += param;
+				if (channel->period > MAX_PERIOD) channel->period = MAX_PERIOD;
+				period = channel->period;
+				break;
+			case 0x3:
+				channel_tone_portamento(channel);
+				period = channel->period;
+				break;
+			case 0x4:
+				channel->vibrato_pos += channel->vibrato_speed;
+				period = channel_vibrato_period(channel);
+				break;
+			case 0x5:
+				channel_tone_portamento(channel);
+				channel_volume_slide(channel, param);
+				period = channel->period;
+				break;
+			case 0x6:
+				channel->vibrato_pos += channel->vibrato_speed;
+				channel_volume_slide(channel, param);
+				period = channel_vibrato_period(channel);
+				break;
+			case 0xa:
+				channel_volume_slide(channel, param);
+				break;
+			case 0xe:
+				switch (param >> 4) {
+					case 0x9:
+						if ((param & 0xf) && voice->tick % (param & 0xf) == 0) channel_trigger(channel, channel->period);
+						break;
+					case 0xc:
+						if (voice->tick == (param & 0xfu)) channel->volume = 0;
+						break;
+					case 0xd:
+						if (voice->tick == (param & 0xfu) && channel->delayed_period) {
+							channel_trigger(channel, channel->delayed_period);
+							period = channel->period;
+						}
+						break;
+				}
+				break;
+		}
+
+		if (period) channel_update_step(voice, channel, period, semitones);
+	}
+}
+
+static void voice_advance_tick(tracker_voice_t *voice) {
+	if (voice->tick == 0) {
+		voice_process_row(voice);
+		if (voice->finished) return;
+	} else {
+		voice_process_tick(voice);
+	}
+	voice->tick_frames_left = voice->frames_per_tick;
+
+	if (++voice->tick >= voice->speed) {
+		voice->tick = 0;
+		if (voice->jump_order >= 0) {
+			voice->order = voice->jump_order;
+			voice->row = voice->jump_row >= NUM_ROWS ? 0 : voice->jump_row;
+			voice->jump_order = -1;
+			voice->jump_row = -1;
+		} else if (++voice->row >= NUM_ROWS) {
+			voice->row = 0;
+			voice->order++;
+		}
+	}
+}
+
+static void voice_reset(tracker_voice_t *voice) {
+	tracker_song_t *song = voice->song;
+	voice->order = 0;
+	voice->row = 0;
+	voice->tick = 0;
+	voice->speed = 6;
+	voice->frames_per_tick = song->sample_rate * 5 / (125 * 2);
+	voice->tick_frames_left = 0;
+	voice->jump_order = -1;
+	voice->jump_row = -1;
+	voice->finished = false;
+	memset(voice->channels, 0, sizeof(voice->channels));
+	for (uint32_t i = 0; i < song->num_channels; i++) {
+		// Amiga LRRL channel layout
+		bool left = (i & 3) == 0 || (i & 3) == 3;
+		voice->channels[i].pan_left = left ? PAN_MAIN : PAN_OTHER;
+		voice->channels[i].pan_right = left ? PAN_OTHER : PAN_MAIN;
+	}
+}
+
+static bool tracker_init(void *user_data, void **voice_state) {
+	tracker_song_t *song = (tracker_song_t *) user_data;
+	tracker_voice_t *voice = mcugdx_mem_alloc(sizeof(tracker_voice_t), MCUGDX_MEM_INTERNAL);
+	if (!voice) return false;
+
+	voice->song = song;
+	voice->pattern = mcugdx_mem_alloc(song->pattern_size, MCUGDX_MEM_INTERNAL);
+	voice->file = song->fs->open(song->path);
+	if (!voice->pattern || !voice->file) {
+		if (voice->file) song->fs->close(voice->file);
+		mcugdx_mem_free(voice->pattern);
+		mcugdx_mem_free(voice);
+		return false;
+	}
+	voice->loaded_pattern = -1;
+	voice_reset(voice);
+	*voice_state = voice;
+	return true;
+}
+
+static uint32_t tracker_generate(void *voice_state, int32_t *output, uint32_t num_frames,
+								 mcugdx_audio_channels_t channels, int32_t pan_left_gain,
+								 int32_t pan_right_gain, int32_t final_gain) {
+	tracker_voice_t *voice = (tracker_voice_t *) voice_state;
+	uint32_t num_channels = voice->song->num_channels;
+	uint32_t frames_generated = 0;
+
+	while (frames_generated < num_frames && !voice->finished) {
+		if (voice->tick_frames_left == 0) {
+			voice_advance_tick(voice);
+			if (voice->finished) break;
+		}
+
+		uint32_t frames = num_frames - frames_generated;
+		if (frames > voice->tick_frames_left) frames = voice->tick_frames_left;
+
+		for (uint32_t i = 0; i < frames; i++) {
+			int32_t left = 0, right = 0;
+			for (uint32_t c = 0; c < num_channels; c++) {
+				tracker_channel_t *channel = &voice->channels[c];
+				if (!channel->active) continue;
+				tracker_sample_t *sample = channel->sample;
+
+				// Linear interpolation between the current and next sample frame
+				uint32_t index = channel->index;
+				uint32_t end = sample->loop_length ? sample->loop_start + sample->loop_length : sample->length;
+				uint32_t next = index + 1 < end ? index + 1 : (sample->loop_length ? sample->loop_start : index);
+				int32_t s0 = sample->data[index];
+				int32_t s1 = sample->data[next];
+				int32_t value = (s0 * 256 + (((s1 - s0) * (int32_t) channel->frac) >> 8)) * channel->volume >> 7;
+				left += (value * channel->pan_left) >> 8;
+				right += (value * channel->pan_right) >> 8;
+
+				channel->frac += channel->step;
+				channel->index += channel->frac >> 16;
+				channel->frac &= 0xffff;
+				if (channel->index >= end) {
+					if (sample->loop_length) {
+						channel->index = sample->loop_start + (channel->index - end) % sample->loop_length;
+					} else {
+						channel->active = false;
+					}
+				}
+			}
+			output = mcugdx_audio_mix_frame(output, channels, left, right, pan_left_gain, pan_right_gain, final_gain);
+		}
+
+		voice->tick_frames_left -= frames;
+		frames_generated += frames;
+	}
+
+	return frames_generated;
+}
+
+static void tracker_reset(void *voice_state) {
+	voice_reset((tracker_voice_t *) voice_state);
+}
+
+static void tracker_free(void *voice_state) {
+	tracker_voice_t *voice = (tracker_voice_t *) voice_state;
+	voice->song->fs->close(voice->file);
+	mcugdx_mem_free(voice->pattern);
+	mcugdx_mem_free(voice);
+}
+
+static void tracker_destroy(void *user_data) {
+	tracker_song_t *song = (tracker_song_t *) user_data;
+	mcugdx_mem_free(song->sample_data);
+	mcugdx_mem_free((void *) song->path);
+	mcugdx_mem_free(song);
+}
+
+static const mcugdx_audio_generator_t tracker_generator = {
+		.init = tracker_init,
+		.generate = tracker_generate,
+		.reset = tracker_reset,
+		.free = tracker_free,
+		.destroy = tracker_destroy};
+
+static bool song_parse_header(tracker_song_t *song, const uint8_t *header, const char *path) {
+	song->num_channels = parse_num_channels(header + SIGNATURE_OFFSET);
+	if (song->num_channels == 0 || song->num_channels > MAX_CHANNELS) {
+		mcugdx_loge(TAG, "Unsupported module format in %s", path);
+		return false;
+	}
+	song->pattern_size = NUM_ROWS * song->num_channels * 4;
+	song->song_length = header[SONG_LENGTH_OFFSET];
+	if (song->song_length == 0 || song->song_length > NUM_ORDERS) {
+		mcugdx_loge(TAG, "Invalid song length %li in %s", song->song_length, path);
+		return false;
+	}
+	memcpy(song->orders, header + ORDERS_OFFSET, NUM_ORDERS);
+
+	for (int i = 0; i < NUM_SAMPLES; i++) {
+		const uint8_t *sample_header = header + SAMPLE_HEADER_OFFSET + i * SAMPLE_HEADER_SIZE;
+		tracker_sample_t *sample = &song->samples[i];
+		sample->length = read_u16_be(sample_header + 22) * 2;
+		sample->finetune = (int8_t) ((sample_header[24] & 0xf) << 4) >> 4;
+		sample->volume = sample_header[25] > 64 ? 64 : sample_header[25];
+		sample->loop_start = read_u16_be(sample_header + 26) * 2;
+		sample->loop_length = read_u16_be(sample_header + 28) * 2;
+		if (sample->loop_start > sample->length) sample->loop_start = sample->length;
+		if (sample->loop_start + sample->loop_length > sample->length) sample->loop_length = sample->length - sample->loop_start;
+		if (sample->loop_length <= 2) sample->loop_length = 0;
+	}
+	return true;
+}
+
+static bool song_load(tracker_song_t *song, mcugdx_file_handle_t file, mcugdx_file_system_t *fs, const char *path, mcugdx_memory_type_t mem_type) {
+	uint8_t *header = mcugdx_mem_alloc(HEADER_SIZE, MCUGDX_MEM_INTERNAL);
+	if (!header) {
+		mcugdx_loge(TAG, "Failed to allocate header");
+		return false;
+	}
+	bool result = fs->read(file, header, HEADER_SIZE) == HEADER_SIZE && song_parse_header(song, header, path);
+	mcugdx_mem_free(header);
+	if (!result) return false;
+
+	// Like ProTracker, count all patterns referenced by the order table, used or not
+	uint32_t num_patterns = 0;
+	for (int i = 0; i < NUM_ORDERS; i++) {
+		if (song->orders[i] + 1u > num_patterns) num_patterns = song->orders[i] + 1;
+	}
+
+	uint32_t sample_data_size = 0;
+	for (int i = 0; i < NUM_SAMPLES; i++) {
+		sample_data_size += song->samples[i].length;
+	}
+
+	song->sample_data = mcugdx_mem_alloc(sample_data_size ? sample_data_size : 1, mem_type);
+	if (!song->sample_data) {
+		mcugdx_loge(TAG, "Failed to allocate %li bytes of sample data", sample_data_size);
+		return false;
+	}
+
+	// Truncated files are common, missing sample data is played back as silence
+	memset(song->sample_data, 0, sample_data_size);
+	fs->seek(file, HEADER_SIZE + num_patterns * song->pattern_size);
+	fs->read(file, (uint8_t *) song->sample_data, sample_data_size);
+	int8_t *sample_data = song->sample_data;
+	for (int i = 0; i < NUM_SAMPLES; i++) {
+		song->samples[i].data = sample_data;
+		sample_data += song->samples[i].length;
+	}
+	return true;
+}
+
+mcugdx_sound_t *mcugdx_tracker_load(const char *path, mcugdx_file_system_t *fs, mcugdx_memory_type_t mem_type) {
+	if (!path || !fs) {
+		mcugdx_loge(TAG, "Invalid parameters");
+		return NULL;
+	}
+
+	tracker_song_t *song = mcugdx_mem_alloc(sizeof(tracker_song_t), mem_type);
+	if (!song) {
+		mcugdx_loge(TAG, "Failed to allocate song");
+		return NULL;
+	}
+	memset(song, 0, sizeof(tracker_song_t));
+
+	mcugdx_file_handle_t file = fs->open(path);
+	if (!file) {
+		mcugdx_loge(TAG, "Could not open %s", path);
+		mcugdx_mem_free(song);
+		return NULL;
+	}
+
+	bool loaded = song_load(song, file, fs, path, mem_type);
+	fs->close(file);
+	if (!loaded) {
+		mcugdx_mem_free(song->sample_data);
+		mcugdx_mem_free(song);
+		return NULL;
+	}
+
+	song->fs = fs;
+	song->path = mcugdx_mem_strdup(path, mem_type);
+	song->sample_rate = mcugdx_audio_get_sample_rate();
+
+	mcugdx_sound_t *sound = mcugdx_sound_create_generator(&tracker_generator, song, MCUGDX_STEREO, mem_type);
+	if (!sound) {
+		tracker_destroy(song);
+		return NULL;
+	}
+	return sound;
+}
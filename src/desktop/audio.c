@@ -53,6 +53,7 @@ bool mcugdx_audio_init(mcugdx_audio_config_t *config) {
 		mcugdx_loge(TAG, "Could not create audio lock");
 		return false;
 	}
+	if (config->no_output) return true;
 
 	saudio_setup(&(saudio_desc){
 			.num_channels = config->channels,
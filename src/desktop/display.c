@@ -4,9 +4,25 @@
 #include <string.h>
 #include <SDL.h>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define USE_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define USE_NEON
+#endif
+
 #define TAG "mcugdx_display"
+#define SPI_BITS_PER_SECOND 80000000
 
-static uint32_t *frame_buffer_32;
+// Converted pixels waiting to be uploaded, in the texture's format. That's
+// RGB565 in native byte order if the renderer supports it, ARGB8888 otherwise.
+static uint8_t *texture_pixels;
+static uint32_t texture_bpp;
+static uint16_t *band_buffer;
+// One row of the indexed frame buffer looked up in the palette
+static uint16_t *palette_row;
+static uint16_t *back_buffer;
 static SDL_Window *window;
 static SDL_Renderer *renderer;
 static SDL_Texture *texture;
@@ -15,13 +31,64 @@ mcugdx_display_t display;
 extern size_t internal_mem;
 
 extern void mcugdx_desktop_update_button(SDL_KeyboardEvent *event);
+extern uint32_t mcugdx_display_take_dirty_rects(mcugdx_rect_t *rects);
+extern void mcugdx_display_render_band(uint16_t *pixels, int32_t y, int32_t height);
+extern void mcugdx_display_end_bands(void);
+extern void mcugdx_display_count_window(int32_t width, int32_t height);
+
+// Async presents are converted on a separate thread, which also takes as long
+// as sending the same bytes via SPI at 80 MHz would, so pipelining behaves like
+// on a device. Uploading to the texture stays on the main thread, as SDL
+// rendering isn't thread safe.
+static SDL_Thread *present_thread;
+static SDL_mutex *present_mutex;
+static SDL_cond *present_cond;
+static bool present_thread_quit;
+static bool present_failed;
+static mcugdx_display_fence_t submitted_fence;
+static mcugdx_display_fence_t completed_fence;
+static uint16_t *present_pixels;
+static mcugdx_rect_t present_rects[MCUGDX_DISPLAY_MAX_DIRTY_RECTS];
+static uint32_t num_present_rects;
+static bool upload_pending;
+
+// Runs part 1 of mcugdx_display_parallel() work, started on first use
+static SDL_Thread *worker_thread;
+static SDL_mutex *worker_mutex;
+static SDL_cond *worker_cond;
+static bool worker_thread_quit;
+static void (*worker_work)(uint32_t part);
+static uint32_t worker_started;
+static uint32_t worker_finished;
+static bool worker_failed;
 
 bool mcugdx_display_init(mcugdx_display_config_t *display_cfg) {
-	display.native_width = display.width = display_cfg->native_width;
-	display.native_height = display.height = display_cfg->native_height;
+	display.scale = display_cfg->scale > 1 ? display_cfg->scale : 1;
+	if ((display.scale != 2 && display.scale != 4 && display.scale != 1) || display_cfg->native_width % display.scale || display_cfg->native_height % display.scale) {
+		mcugdx_loge(TAG, "Scale %li must be 2 or 4 and divide the native size", display.scale);
+		return false;
+	}
+	display.native_width = display_cfg->native_width;
+	display.native_height = display_cfg->native_height;
+	display.width = display.native_width / display.scale;
+	display.height = display.native_height / display.scale;
 	display.orientation = MCUGDX_PORTRAIT;
-	display.frame_buffer = calloc(display.width * display.height, sizeof(uint16_t));
-	frame_buffer_32 = calloc(display.width * display.height, sizeof(uint32_t));
+	display.band_height = display_cfg->band_height;
+	if (display_cfg->indexed && display.band_height > 0) {
+		mcugdx_loge(TAG, "Indexed mode can't be combined with bands");
+		return false;
+	}
+	uint32_t max_width = display.width > display.height ? display.width : display.height;
+	if (display.band_height > 0) {
+		band_buffer = calloc(max_width * display.band_height, sizeof(uint16_t));
+	} else if (display_cfg->indexed) {
+		display.indexed_frame_buffer = calloc(display.width * display.height, sizeof(uint8_t));
+		palette_row = calloc(max_width, sizeof(uint16_t));
+	} else {
+		display.frame_buffer = calloc(display.width * display.height, sizeof(uint16_t));
+		if (display_cfg->double_buffer) back_buffer = calloc(display.width * display.height, sizeof(uint16_t));
+	}
+	texture_pixels = calloc(display.width * display.height, sizeof(uint32_t));
 
 	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
 		mcugdx_loge(TAG, "SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
@@ -33,12 +100,13 @@ bool mcugdx_display_init(mcugdx_display_config_t *display_cfg) {
 }
 
 void mcugdx_display_set_orientation(mcugdx_display_orientation_t orientation) {
+	mcugdx_display_wait(submitted_fence);
 	if (orientation == MCUGDX_LANDSCAPE) {
-		display.width = display.native_height;
-		display.height = display.native_width;
+		display.width = display.native_height / display.scale;
+		display.height = display.native_width / display.scale;
 	} else {
-		display.width = display.native_width;
-		display.height = display.native_height;
+		display.width = display.native_width / display.scale;
+		display.height = display.native_height / display.scale;
 	}
 
 	if (window) {
@@ -47,8 +115,10 @@ void mcugdx_display_set_orientation(mcugdx_display_orientation_t orientation) {
 		SDL_DestroyWindow(window);
 	}
 
+	// The texture holds the frame buffer at its scaled down size, the renderer
+	// scales it up to the native size times 2
 	window = SDL_CreateWindow("mcugdx", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-							  display.width * 2, display.height * 2, SDL_WINDOW_SHOWN);
+							  display.width * display.scale * 2, display.height * display.scale * 2, SDL_WINDOW_SHOWN);
 	if (!window) {
 		mcugdx_loge(TAG, "Window could not be created! SDL_Error: %s\n", SDL_GetError());
 		return;
@@ -60,20 +130,80 @@ void mcugdx_display_set_orientation(mcugdx_display_orientation_t orientation) {
 		return;
 	}
 
-	texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+	// Scaled frame buffer pixels become blocks, like on the panel
+	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+	texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB565, SDL_TEXTUREACCESS_STREAMING,
 								display.width, display.height);
+	texture_bpp = sizeof(uint16_t);
+	if (!texture) {
+		mcugdx_log(TAG, "RGB565 textures not supported, converting to ARGB8888");
+		texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+									display.width, display.height);
+		texture_bpp = sizeof(uint32_t);
+	}
 	if (!texture) {
 		mcugdx_loge(TAG, "Texture could not be created! SDL_Error: %s\n", SDL_GetError());
 		return;
 	}
+	mcugdx_display_mark_dirty(0, 0, display.width, display.height);
 }
 
-void mcugdx_display_show(void) {
-	uint32_t *dst = frame_buffer_32;
-	uint16_t *src = display.frame_buffer;
-	int num_pixels = display.width * display.height;
+// The frame buffer holds RGB565 in display (big endian) byte order
+static void swap_pixels(uint16_t *dst, uint16_t *src, int32_t num_pixels) {
+	int32_t i = 0;
+#if defined(USE_SSE2)
+	for (; i + 8 <= num_pixels; i += 8) {
+		__m128i pixels = _mm_loadu_si128((const __m128i *) (src + i));
+		pixels = _mm_or_si128(_mm_srli_epi16(pixels, 8), _mm_slli_epi16(pixels, 8));
+		_mm_storeu_si128((__m128i *) (dst + i), pixels);
+	}
+#elif defined(USE_NEON)
+	for (; i + 8 <= num_pixels; i += 8) {
+		uint8x16_t pixels = vld1q_u8((const uint8_t *) (src + i));
+		vst1q_u8((uint8_t *) (dst + i), vrev16q_u8(pixels));
+	}
+#endif
+	for (; i < num_pixels; i++) {
+		dst[i] = SDL_Swap16(src[i]);
+	}
+}
 
-	for (int i = 0; i < num_pixels; i++) {
+static void expand_pixels(uint32_t *dst, uint16_t *src, int32_t num_pixels) {
+	int32_t i = 0;
+#if defined(USE_SSE2)
+	const __m128i mask_5 = _mm_set1_epi16(0x1f);
+	const __m128i mask_6 = _mm_set1_epi16(0x3f);
+	const __m128i alpha = _mm_set1_epi16((int16_t) 0xff00);
+	for (; i + 8 <= num_pixels; i += 8) {
+		__m128i pixels = _mm_loadu_si128((const __m128i *) (src + i));
+		pixels = _mm_or_si128(_mm_srli_epi16(pixels, 8), _mm_slli_epi16(pixels, 8));
+		__m128i r = _mm_srli_epi16(pixels, 11);
+		__m128i g = _mm_and_si128(_mm_srli_epi16(pixels, 5), mask_6);
+		__m128i b = _mm_and_si128(pixels, mask_5);
+		r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+		g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+		b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+		// Little endian ARGB8888 is the 16-bit pairs (g << 8 | b, a << 8 | r)
+		__m128i gb = _mm_or_si128(_mm_slli_epi16(g, 8), b);
+		__m128i ar = _mm_or_si128(alpha, r);
+		_mm_storeu_si128((__m128i *) (dst + i), _mm_unpacklo_epi16(gb, ar));
+		_mm_storeu_si128((__m128i *) (dst + i + 4), _mm_unpackhi_epi16(gb, ar));
+	}
+#elif defined(USE_NEON)
+	for (; i + 8 <= num_pixels; i += 8) {
+		uint16x8_t pixels = vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8((const uint8_t *) (src + i))));
+		uint8x8_t r = vand_u8(vshrn_n_u16(pixels, 8), vdup_n_u8(0xf8));
+		uint8x8_t g = vand_u8(vshrn_n_u16(pixels, 3), vdup_n_u8(0xfc));
+		uint8x8_t b = vmovn_u16(vshlq_n_u16(pixels, 3));
+		uint8x8x4_t bgra;
+		bgra.val[0] = vorr_u8(b, vshr_n_u8(b, 5));
+		bgra.val[1] = vorr_u8(g, vshr_n_u8(g, 6));
+		bgra.val[2] = vorr_u8(r, vshr_n_u8(r, 5));
+		bgra.val[3] = vdup_n_u8(0xff);
+		vst4_u8((uint8_t *) (dst + i), bgra);
+	}
+#endif
+	for (; i < num_pixels; i++) {
 		uint16_t pixel = SDL_Swap16(src[i]);
 
 		uint8_t r = (pixel >> 11) & 0x1F;
@@ -84,14 +214,56 @@ void mcugdx_display_show(void) {
 		uint8_t g8 = (g << 2) | (g >> 4);
 		uint8_t b8 = (b << 3) | (b >> 2);
 
-		dst[i] = (0xFF << 24) | (r8 << 16) | (g8 << 8) | b8;
+		dst[i] = (0xFFu << 24) | (r8 << 16) | (g8 << 8) | b8;
 	}
+}
 
-	SDL_UpdateTexture(texture, NULL, frame_buffer_32, display.width * sizeof(uint32_t));
-	SDL_RenderClear(renderer);
-	SDL_RenderCopy(renderer, texture, NULL, NULL);
-	SDL_RenderPresent(renderer);
+static void convert_pixels(int32_t offset, uint16_t *src, int32_t num_pixels) {
+	if (texture_bpp == sizeof(uint16_t)) {
+		swap_pixels((uint16_t *) texture_pixels + offset, src, num_pixels);
+	} else {
+		expand_pixels((uint32_t *) texture_pixels + offset, src, num_pixels);
+	}
+}
+
+static void show_bands(void) {
+	for (int32_t y = 0; y < (int32_t) display.height; y += display.band_height) {
+		int32_t height = (int32_t) display.height - y;
+		if (height > (int32_t) display.band_height) height = (int32_t) display.band_height;
+		mcugdx_display_render_band(band_buffer, y, height);
+		convert_pixels(y * display.width, band_buffer, display.width * height);
+	}
+	mcugdx_display_end_bands();
+	SDL_UpdateTexture(texture, NULL, texture_pixels, display.width * texture_bpp);
+}
+
+static uint32_t convert_rects(uint16_t *pixels, mcugdx_rect_t *rects, uint32_t num_rects) {
+	uint32_t num_bytes = 0;
+	for (uint32_t i = 0; i < num_rects; i++) {
+		mcugdx_rect_t *rect = &rects[i];
+		for (int32_t y = rect->y; y < rect->y + rect->height; y++) {
+			if (display.indexed_frame_buffer) {
+				uint8_t *indices = display.indexed_frame_buffer + y * display.width + rect->x;
+				for (int32_t x = 0; x < rect->width; x++) palette_row[x] = display.palette[indices[x]];
+				convert_pixels(y * display.width + rect->x, palette_row, rect->width);
+			} else {
+				convert_pixels(y * display.width + rect->x, pixels + y * display.width + rect->x, rect->width);
+			}
+		}
+		num_bytes += rect->width * rect->height * sizeof(uint16_t);
+	}
+	return num_bytes;
+}
+
+static void upload_rects(mcugdx_rect_t *rects, uint32_t num_rects) {
+	for (uint32_t i = 0; i < num_rects; i++) {
+		mcugdx_rect_t *rect = &rects[i];
+		SDL_Rect texture_rect = {rect->x, rect->y, rect->width, rect->height};
+		SDL_UpdateTexture(texture, &texture_rect, texture_pixels + (rect->y * display.width + rect->x) * texture_bpp, display.width * texture_bpp);
+	}
+}
 
+static void poll_events(void) {
 	SDL_Event event;
 	while (SDL_PollEvent(&event)) {
 		if (event.type == SDL_QUIT) {
@@ -102,9 +274,201 @@ void mcugdx_display_show(void) {
 	}
 }
 
+static void present(void) {
+	SDL_RenderClear(renderer);
+	SDL_RenderCopy(renderer, texture, NULL, NULL);
+	SDL_RenderPresent(renderer);
+	poll_events();
+}
+
+static int present_thread_main(void *data) {
+	mcugdx_display_fence_t fence = 0;
+	SDL_LockMutex(present_mutex);
+	while (true) {
+		while (submitted_fence == fence && !present_thread_quit) SDL_CondWait(present_cond, present_mutex);
+		if (present_thread_quit) break;
+		fence = submitted_fence;
+		SDL_UnlockMutex(present_mutex);
+
+		uint64_t start = SDL_GetPerformanceCounter();
+		uint32_t num_bytes = convert_rects(present_pixels, present_rects, num_present_rects);
+		double transfer_time = num_bytes * 8.0 / SPI_BITS_PER_SECOND;
+		double elapsed = (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+		if (elapsed < transfer_time) SDL_Delay((uint32_t) ((transfer_time - elapsed) * 1000));
+
+		SDL_LockMutex(present_mutex);
+		completed_fence = fence;
+		SDL_CondBroadcast(present_cond);
+	}
+	SDL_UnlockMutex(present_mutex);
+	return 0;
+}
+
+static inline bool fence_done(mcugdx_display_fence_t fence) {
+	return (int32_t) (completed_fence - fence) >= 0;
+}
+
+bool mcugdx_display_is_done(mcugdx_display_fence_t fence) {
+	if (!present_thread) return true;
+	SDL_LockMutex(present_mutex);
+	bool done = fence_done(fence);
+	SDL_UnlockMutex(present_mutex);
+	if (done && upload_pending) {
+		upload_rects(present_rects, num_present_rects);
+		upload_pending = false;
+		present();
+	}
+	return done;
+}
+
+void mcugdx_display_wait(mcugdx_display_fence_t fence) {
+	if (!present_thread) return;
+	SDL_LockMutex(present_mutex);
+	while (!fence_done(fence)) SDL_CondWait(present_cond, present_mutex);
+	SDL_UnlockMutex(present_mutex);
+	mcugdx_display_is_done(fence);
+}
+
+mcugdx_display_fence_t mcugdx_display_show_async(void) {
+	// Bands are already pipelined with rendering, scaled and indexed frames are
+	// expanded while sending on a device, which mcugdx_display_show() does
+	if (display.band_height > 0 || display.scale > 1 || display.indexed_frame_buffer) {
+		mcugdx_display_show();
+		return submitted_fence;
+	}
+
+	mcugdx_display_wait(submitted_fence);
+	if (!present_thread && !present_failed) {
+		present_mutex = SDL_CreateMutex();
+		present_cond = SDL_CreateCond();
+		if (present_mutex && present_cond) present_thread = SDL_CreateThread(present_thread_main, "mcugdx_present", NULL);
+		if (!present_thread) {
+			mcugdx_loge(TAG, "Could not start present thread, presenting synchronously: %s", SDL_GetError());
+			if (present_cond) SDL_DestroyCond(present_cond);
+			if (present_mutex) SDL_DestroyMutex(present_mutex);
+			present_failed = true;
+		}
+	}
+	if (present_failed) {
+		mcugdx_display_show();
+		return submitted_fence;
+	}
+
+	num_present_rects = mcugdx_display_take_dirty_rects(present_rects);
+	for (uint32_t i = 0; i < num_present_rects; i++) {
+		mcugdx_display_count_window(present_rects[i].width, present_rects[i].height);
+	}
+	present_pixels = display.frame_buffer;
+	upload_pending = true;
+
+	SDL_LockMutex(present_mutex);
+	submitted_fence++;
+	SDL_CondBroadcast(present_cond);
+	SDL_UnlockMutex(present_mutex);
+
+	if (back_buffer) {
+		uint16_t *front_buffer = display.frame_buffer;
+		display.frame_buffer = back_buffer;
+		back_buffer = front_buffer;
+	}
+	poll_events();
+	return submitted_fence;
+}
+
+static int worker_thread_main(void *data) {
+	uint32_t started = 0;
+	SDL_LockMutex(worker_mutex);
+	while (true) {
+		while (worker_started == started && !worker_thread_quit) SDL_CondWait(worker_cond, worker_mutex);
+		if (worker_thread_quit) break;
+		started = worker_started;
+		SDL_UnlockMutex(worker_mutex);
+
+		worker_work(1);
+
+		SDL_LockMutex(worker_mutex);
+		worker_finished = started;
+		SDL_CondBroadcast(worker_cond);
+	}
+	SDL_UnlockMutex(worker_mutex);
+	return 0;
+}
+
+// Runs work(0) on the calling thread and work(1) on the worker thread, and
+// returns once both are done. Both parts run here if the thread can't be started.
+void mcugdx_display_parallel(void (*work)(uint32_t part)) {
+	if (!worker_thread && !worker_failed) {
+		worker_mutex = SDL_CreateMutex();
+		worker_cond = SDL_CreateCond();
+		if (worker_mutex && worker_cond) worker_thread = SDL_CreateThread(worker_thread_main, "mcugdx_blit_worker", NULL);
+		if (!worker_thread) {
+			mcugdx_loge(TAG, "Could not start blit worker, rendering on one thread: %s", SDL_GetError());
+			if (worker_cond) SDL_DestroyCond(worker_cond);
+			if (worker_mutex) SDL_DestroyMutex(worker_mutex);
+			worker_failed = true;
+		}
+	}
+	if (worker_failed) {
+		work(0);
+		work(1);
+		return;
+	}
+
+	SDL_LockMutex(worker_mutex);
+	worker_work = work;
+	worker_started++;
+	SDL_CondBroadcast(worker_cond);
+	SDL_UnlockMutex(worker_mutex);
+
+	work(0);
+
+	SDL_LockMutex(worker_mutex);
+	while (worker_finished != worker_started) SDL_CondWait(worker_cond, worker_mutex);
+	SDL_UnlockMutex(worker_mutex);
+}
+
+void mcugdx_display_show(void) {
+	mcugdx_display_wait(submitted_fence);
+
+	if (display.band_height > 0) {
+		show_bands();
+	} else {
+		mcugdx_rect_t rects[MCUGDX_DISPLAY_MAX_DIRTY_RECTS];
+		uint32_t num_rects = mcugdx_display_take_dirty_rects(rects);
+		for (uint32_t i = 0; i < num_rects; i++) {
+			mcugdx_display_count_window(rects[i].width, rects[i].height);
+		}
+		convert_rects(display.frame_buffer, rects, num_rects);
+		upload_rects(rects, num_rects);
+	}
+	present();
+}
+
 void mcugdx_display_cleanup(void) {
+	if (present_thread) {
+		SDL_LockMutex(present_mutex);
+		present_thread_quit = true;
+		SDL_CondBroadcast(present_cond);
+		SDL_UnlockMutex(present_mutex);
+		SDL_WaitThread(present_thread, NULL);
+		SDL_DestroyCond(present_cond);
+		SDL_DestroyMutex(present_mutex);
+	}
+	if (worker_thread) {
+		SDL_LockMutex(worker_mutex);
+		worker_thread_quit = true;
+		SDL_CondBroadcast(worker_cond);
+		SDL_UnlockMutex(worker_mutex);
+		SDL_WaitThread(worker_thread, NULL);
+		SDL_DestroyCond(worker_cond);
+		SDL_DestroyMutex(worker_mutex);
+	}
 	free(display.frame_buffer);
-	free(frame_buffer_32);
+	free(display.indexed_frame_buffer);
+	free(palette_row);
+	free(back_buffer);
+	free(band_buffer);
+	free(texture_pixels);
 	SDL_DestroyTexture(texture);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
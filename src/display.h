@@ -22,6 +22,9 @@ extern "C" {
 #define MCUGDX_WHITE 0xffff
 #define MCUGDX_PINK 0b1111100000011111
 
+#define MCUGDX_DISPLAY_MAX_DIRTY_RECTS 16
+#define MCUGDX_DISPLAY_MAX_CLIPS 16
+
 typedef enum {
 	MCUGDX_ST7789,
 	MCUGDX_ST7796,
@@ -42,21 +45,148 @@ typedef struct {
 	int dc;
 	int cs;
 	int reset;
+	// If > 0, no frame buffer is allocated. Draw calls are recorded instead and
+	// replayed by mcugdx_display_show() into two band_height rows high buffers,
+	// one being rendered while the other is sent to the display. Images must
+	// stay alive until the next show, and mcugdx_display_frame_buffer() is NULL.
+	// On ESP-IDF, band_height rows of the longer display side must fit in 32 KB.
+	uint32_t band_height;
+	// Allocates a second frame buffer. mcugdx_display_show_async() then swaps
+	// them, so the next frame can be drawn while the last one is still being
+	// sent. The new frame buffer holds the frame before last, so apps must redraw
+	// everything and re-fetch mcugdx_display_frame_buffer() after every show.
+	bool double_buffer;
+	// 2 or 4 to render at half or a quarter of the native resolution. Every
+	// pixel is sent as a scale x scale block, so the panel is still filled,
+	// while fill cost and frame buffer size shrink by scale * scale. 0 or 1
+	// renders at native resolution.
+	uint32_t scale;
+	// Allocates an 8-bit frame buffer of palette indices instead of the RGB565
+	// one, see mcugdx_display_indexed_frame_buffer(). Indices are looked up in
+	// the palette while sending, so there is no conversion pass over the frame.
+	// Draw calls only draw into target images, mcugdx_display_frame_buffer() is
+	// NULL. Can't be combined with band_height, double_buffer is ignored.
+	bool indexed;
 } mcugdx_display_config_t;
 
+typedef uint32_t mcugdx_display_fence_t;
+
+typedef enum {
+	// src * alpha + dst * (1 - alpha)
+	MCUGDX_BLEND_ALPHA,
+	// dst + src * alpha, saturating
+	MCUGDX_BLEND_ADD,
+	// dst * src * alpha + dst * (1 - alpha), darkens
+	MCUGDX_BLEND_MULTIPLY
+} mcugdx_blend_mode_t;
+
+// Post-processing filters applied to what is already drawn, see
+// mcugdx_display_filter(). amount is in [0, 255].
+typedef enum {
+	// Moves colors towards color by amount, e.g. black for a fade out or red
+	// for a damage flash
+	MCUGDX_FILTER_FADE,
+	// Scales colors by amount / 128, saturating, so 128 keeps them, 0 is black
+	// and 255 almost doubles them
+	MCUGDX_FILTER_BRIGHTNESS,
+	// Moves colors towards their gray by amount
+	MCUGDX_FILTER_GRAYSCALE,
+	// Multiplies colors by color like MCUGDX_BLEND_MULTIPLY, blended by amount,
+	// e.g. dark blue for night
+	MCUGDX_FILTER_TINT
+} mcugdx_filter_t;
+
+typedef struct {
+	int32_t x;
+	int32_t y;
+	int32_t width;
+	int32_t height;
+} mcugdx_rect_t;
+
+// 1.0 in the 16.16 fixed point numbers used for scales and matrices
+#define MCUGDX_FIXED_ONE 0x10000
+
+// Flips are applied first, then the clockwise rotation. Only mcugdx_display_blit_ex()
+// supports flips and rotations.
+typedef enum {
+	MCUGDX_BLIT_KEYED = 1,
+	MCUGDX_BLIT_FLIP_X = 2,
+	MCUGDX_BLIT_FLIP_Y = 4,
+	MCUGDX_BLIT_ROTATE_90 = 8,
+	MCUGDX_BLIT_ROTATE_180 = MCUGDX_BLIT_FLIP_X | MCUGDX_BLIT_FLIP_Y,
+	MCUGDX_BLIT_ROTATE_270 = MCUGDX_BLIT_ROTATE_90 | MCUGDX_BLIT_ROTATE_180
+} mcugdx_blit_flags_t;
+
+typedef enum {
+	// Draws blits of the same image one after the other, in the order the
+	// images first appear. Only use this if the order of overlapping blits
+	// of different images doesn't matter.
+	MCUGDX_BATCH_SORT = 1,
+	// Splits rasterization between the calling core and a worker on the other
+	// core, each drawing one half of the screen. Ignored in list and banded mode.
+	MCUGDX_BATCH_PARALLEL = 2
+} mcugdx_batch_flags_t;
+
+// One blit of a batch. If src_width or src_height are 0, the whole image is
+// drawn. With MCUGDX_BLIT_KEYED in flags, pixels equal to color_key are skipped.
+typedef struct {
+	mcugdx_image_t *image;
+	int32_t x, y;
+	int32_t src_x, src_y, src_width, src_height;
+	uint16_t color_key;
+	uint16_t flags;
+} mcugdx_blit_t;
+
 typedef struct {
 	uint32_t native_width;
 	uint32_t native_height;
 	mcugdx_display_orientation_t orientation;
+	// Size of the frame buffer and everything drawn, the native size in the
+	// current orientation divided by scale
+	uint32_t scale;
 	uint32_t width;
 	uint32_t height;
 	uint16_t *frame_buffer;
+	uint8_t *indexed_frame_buffer;
+	// RGB565 in display byte order, like image pixels
+	uint16_t palette[256];
+	uint32_t band_height;
+	bool dirty_tracking;
+	uint32_t num_dirty_rects;
+	mcugdx_rect_t dirty_rects[MCUGDX_DISPLAY_MAX_DIRTY_RECTS];
+	uint64_t bytes_sent;
 } mcugdx_display_t;
 
 bool mcugdx_display_init(mcugdx_display_config_t *display_cfg);
 
 void mcugdx_display_set_orientation(mcugdx_display_orientation_t orientation);
 
+// Makes all draw calls draw into the image instead of the screen, or back to
+// the screen if NULL. Images can be in any memory type. Drawing into an image
+// happens right away, also in list and banded mode, and doesn't mark anything
+// dirty. Its alpha plane and spans are not updated, and an image must not be
+// drawn into itself. Clip rects and translation apply to images as well.
+void mcugdx_display_set_target(mcugdx_image_t *image);
+
+mcugdx_image_t *mcugdx_display_get_target(void);
+
+// Restricts all drawing to the intersection of the current clip rect and
+// x, y, width, height, until the matching pop. Coordinates are translated like
+// those of draw calls. Clears only fill the clip rect, and only the clip rect
+// is marked dirty. Returns false if MCUGDX_DISPLAY_MAX_CLIPS are pushed already.
+bool mcugdx_display_push_clip(int32_t x, int32_t y, int32_t width, int32_t height);
+
+// Restores the clip rect and translation from before the last push
+void mcugdx_display_pop_clip(void);
+
+// Moves everything drawn afterwards by x, y. Dirty rects, the frame buffer and
+// mcugdx_display_mark_dirty() stay in screen coordinates.
+void mcugdx_display_translate(int32_t x, int32_t y);
+
+// The current clip rect in translated coordinates, e.g. to skip drawing what
+// is outside of it
+void mcugdx_display_get_clip(mcugdx_rect_t *clip);
+
 void mcugdx_display_clear(void);
 
 void mcugdx_display_clear_color(uint16_t color);
@@ -67,6 +197,45 @@ void mcugdx_display_hline(int32_t x1, int32_t x2, int32_t y, uint16_t color);
 
 void mcugdx_display_rect(int32_t x1, int32_t y1, int32_t width, int32_t height, uint16_t color);
 
+// Lines include both end points. The anti-aliased variants blend the pixels
+// along the edges with what is already on screen.
+void mcugdx_display_line(int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t color);
+
+void mcugdx_display_line_aa(int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t color);
+
+// Ellipses and circles are centered on pixel cx, cy and cover the pixels whose
+// centers are within the radii plus half a pixel. Outlines are the pixels of
+// the filled shape on its border.
+void mcugdx_display_ellipse(int32_t cx, int32_t cy, int32_t rx, int32_t ry, uint16_t color);
+
+void mcugdx_display_fill_ellipse(int32_t cx, int32_t cy, int32_t rx, int32_t ry, uint16_t color);
+
+void mcugdx_display_ellipse_aa(int32_t cx, int32_t cy, int32_t rx, int32_t ry, uint16_t color);
+
+void mcugdx_display_fill_ellipse_aa(int32_t cx, int32_t cy, int32_t rx, int32_t ry, uint16_t color);
+
+void mcugdx_display_circle(int32_t cx, int32_t cy, int32_t radius, uint16_t color);
+
+void mcugdx_display_fill_circle(int32_t cx, int32_t cy, int32_t radius, uint16_t color);
+
+void mcugdx_display_triangle(int32_t x1, int32_t y1, int32_t x2, int32_t y2, int32_t x3, int32_t y3, uint16_t color);
+
+void mcugdx_display_fill_triangle(int32_t x1, int32_t y1, int32_t x2, int32_t y2, int32_t x3, int32_t y3, uint16_t color);
+
+// points holds num_points x, y pairs, the last point connects to the first
+void mcugdx_display_polygon(const int32_t *points, uint32_t num_points, uint16_t color);
+
+// Fills the pixels whose centers are inside or on the edges of a convex
+// polygon, one span per row
+void mcugdx_display_fill_polygon(const int32_t *points, uint32_t num_points, uint16_t color);
+
+// Applies the filter in place to the pixels in the rect, clipped like any
+// draw call. Pass 0, 0 and the display size for the whole screen. In list and
+// banded mode the filter is recorded in order with the other draw calls and
+// applied to each band as it is rendered. Rows are processed two pixels per
+// 32-bit word, or 8 at a time with SSE2 or NEON.
+void mcugdx_display_filter(int32_t x, int32_t y, int32_t width, int32_t height, mcugdx_filter_t filter, uint16_t color, uint8_t amount);
+
 void mcugdx_display_blit(mcugdx_image_t *src, int32_t x, int32_t y);
 
 void mcugdx_display_blit_keyed(mcugdx_image_t *src, int32_t x, int32_t y, uint16_t color_key);
@@ -75,14 +244,106 @@ void mcugdx_display_blit_region(mcugdx_image_t *src, int32_t dst_x, int32_t dst_
 
 void mcugdx_display_blit_region_keyed(mcugdx_image_t *src, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height, uint16_t color_key);
 
+// Blended blits. The per pixel alpha comes from the image's alpha plane, see
+// mcugdx_image_load_alpha(), and is scaled by opacity. Images without an alpha
+// plane are opaque, except for the color key of sprites made with
+// mcugdx_image_make_sprite(). Blending is done at 5 bit alpha precision.
+void mcugdx_display_blit_blend(mcugdx_image_t *src, int32_t x, int32_t y, mcugdx_blend_mode_t mode, uint8_t opacity);
+
+void mcugdx_display_blit_region_blend(mcugdx_image_t *src, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height, mcugdx_blend_mode_t mode, uint8_t opacity);
+
+// Alpha blends the image with its colors moved towards color by amount, e.g.
+// white with 255 for a hit flash
+void mcugdx_display_blit_tint(mcugdx_image_t *src, int32_t x, int32_t y, uint16_t color, uint8_t amount);
+
+void mcugdx_display_blit_region_tint(mcugdx_image_t *src, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height, uint16_t color, uint8_t amount);
+
+// Draws an indexed image through palette, or the image's own palette if NULL.
+// Swapping or cycling palettes recolors the image without touching its pixels.
+// Palettes must have 1 << bits_per_pixel entries, stored like image pixels. With
+// MCUGDX_BLIT_KEYED in flags, pixels whose color in the image's own palette is
+// color_key are skipped, whatever palette is used.
+void mcugdx_display_blit_indexed(mcugdx_indexed_image_t *src, int32_t x, int32_t y, const uint16_t *palette, uint32_t flags, uint16_t color_key);
+
+void mcugdx_display_blit_region_indexed(mcugdx_indexed_image_t *src, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height, const uint16_t *palette, uint32_t flags, uint16_t color_key);
+
+// Draws the region as a mask in a single color, e.g. for text. Only pixels
+// covered by the image's spans are drawn, see mcugdx_image_make_sprite(), with
+// the alpha plane as their coverage. Without an alpha plane they are filled.
+void mcugdx_display_blit_region_mask(mcugdx_image_t *src, int32_t dst_x, int32_t dst_y, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height, uint16_t color);
+
+// Draws the flipped and rotated region with its top left corner at x, y, scaled by
+// the 16.16 factors, see mcugdx_blit_flags_t. Pixels are sampled at their centers,
+// without filtering. Flips and integer scales of unrotated blits are fastest.
+void mcugdx_display_blit_ex(mcugdx_image_t *src, int32_t x, int32_t y, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height, int32_t scale_x, int32_t scale_y, uint32_t flags, uint16_t color_key);
+
+// Draws the region transformed by the 16.16 matrix {a, b, tx, c, d, ty}, which
+// maps x, y in the region to a * x + b * y + tx, c * x + d * y + ty on screen.
+// Only MCUGDX_BLIT_KEYED is supported in flags.
+void mcugdx_display_blit_affine(mcugdx_image_t *src, int32_t src_x, int32_t src_y, int32_t src_width, int32_t src_height, const int32_t matrix[6], uint32_t flags, uint16_t color_key);
+
+// Draws the blits like the equivalent blit calls would. All blits are clipped
+// first, then rasterized in one pass, see mcugdx_batch_flags_t for the options.
+void mcugdx_display_blit_batch(mcugdx_blit_t *blits, uint32_t num_blits, uint32_t flags);
+
 void mcugdx_display_show(void);
 
+// Starts sending the frame buffer and returns right away with a fence that
+// completes once the transfer is done. Without a double buffer, the frame
+// buffer must not be drawn to before mcugdx_display_wait() returned for the
+// fence. A show while a transfer is in flight waits for it first. On ESP-IDF,
+// windows larger than 320x480 only return once their first rows are sent. In banded,
+// scaled or indexed mode, this is the same as mcugdx_display_show().
+mcugdx_display_fence_t mcugdx_display_show_async(void);
+
+void mcugdx_display_wait(mcugdx_display_fence_t fence);
+
+bool mcugdx_display_is_done(mcugdx_display_fence_t fence);
+
+// Draw calls between begin and end are recorded instead of executed right
+// away. end_list drops everything that is completely covered by later opaque
+// draws and then rasterizes the rest. Images must stay alive until end_list.
+// In banded mode, draw calls are always recorded and culled the same way.
+void mcugdx_display_begin_list(void);
+
+void mcugdx_display_end_list(void);
+
+// With dirty tracking enabled, every draw call records the region it touched
+// and mcugdx_display_show() only uploads those regions, or nothing at all if
+// nothing was drawn. Code writing to mcugdx_display_frame_buffer() directly
+// must report its changes via mcugdx_display_mark_dirty(). Disabled by default,
+// and without effect in banded mode, where every show sends the full frame.
+void mcugdx_display_set_dirty_tracking(bool enabled);
+
+void mcugdx_display_mark_dirty(int32_t x, int32_t y, int32_t width, int32_t height);
+
+// Total bytes sent to the display, including window commands. On desktop
+// these are the bytes that would have been sent to a real display.
+uint64_t mcugdx_display_bytes_sent(void);
+
 int mcugdx_display_width(void);
 
 int mcugdx_display_height(void);
 
 uint16_t *mcugdx_display_frame_buffer(void);
 
+// The width x height palette indices of the frame in indexed mode, NULL otherwise.
+// Changes must be reported via mcugdx_display_mark_dirty() like for the RGB565
+// frame buffer.
+uint8_t *mcugdx_display_indexed_frame_buffer(void);
+
+// Sets the 256 colors of the indexed frame buffer, byte swapped like image
+// pixels. Marks the whole screen dirty if any color changed.
+void mcugdx_display_set_palette(const uint16_t *palette);
+
+// Copies the current frame into a new image. In banded mode, the draw calls
+// recorded since the last show are rendered into it and still shown by the next.
+mcugdx_image_t *mcugdx_display_capture(mcugdx_memory_type_t mem_type);
+
+// Hash of the current frame as computed by mcugdx_image_hash(), to compare
+// rendering against known good frames.
+uint64_t mcugdx_display_hash(void);
+
 #ifdef __cplusplus
 }
 #endif
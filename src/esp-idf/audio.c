@@ -41,6 +41,7 @@ bool mcugdx_audio_init(mcugdx_audio_config_t *config) {
 		mcugdx_loge(TAG, "Could not create audio lock");
 		return false;
 	}
+	if (config->no_output) return true;
 
 	i2s_chan_config_t channel_config = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_AUTO, I2S_ROLE_MASTER);
 	if (i2s_new_channel(&channel_config, &channel, NULL) != ESP_OK) {
@@ -46,6 +46,7 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 
 #include <driver/spi_master.h>
 #include <driver/gpio.h>
@@ -55,6 +56,10 @@
 #define TAG "mcugdx_display"
 
 #define BUFFER_SIZE 32768
+#define EXPAND_BUFFER_SIZE 8192
+// Enough BUFFER_SIZE chunks for a 320x480 frame, larger ones wait for the
+// oldest chunks to be sent
+#define MAX_ASYNC_TRANSACTIONS 10
 
 #define MADCTL_MY 0x80 ///< Bottom to top
 #define MADCTL_MX 0x40 ///< Right to left
@@ -66,12 +71,32 @@
 #define MADCTL 0x36
 
 extern size_t internal_mem;
+extern uint32_t mcugdx_display_take_dirty_rects(mcugdx_rect_t *rects);
+extern void mcugdx_display_render_band(uint16_t *pixels, int32_t y, int32_t height);
+extern void mcugdx_display_end_bands(void);
+extern void mcugdx_display_count_window(int32_t width, int32_t height);
 
 mcugdx_display_t display;
 static mcugdx_display_driver_t driver;
 static int dc;
 static spi_device_handle_t spi_handle;
 static uint8_t pixel_order = MADCTL_RGB;
+static uint16_t *band_buffers[2];
+// Scaled up rows waiting to be sent, filled while the other one is in flight
+static uint16_t *expand_buffers[2];
+static uint32_t expand_buffer;
+static uint32_t expand_buffer_pixels;
+static uint32_t num_expand_pending;
+static spi_transaction_t expand_transactions[2];
+static uint16_t *back_buffer;
+static spi_transaction_t async_transactions[MAX_ASYNC_TRANSACTIONS];
+static uint32_t num_async_pending;
+static mcugdx_display_fence_t submitted_fence;
+static mcugdx_display_fence_t completed_fence;
+static SemaphoreHandle_t worker_start;
+static SemaphoreHandle_t worker_done;
+static void (*worker_work)(uint32_t part);
+static bool worker_failed;
 
 void pin_mode(int pin, gpio_mode_t mode, int level) {
 	gpio_reset_pin(pin);
@@ -287,7 +312,7 @@ bool mcugdx_display_init(mcugdx_display_config_t *display_cfg) {
 			mcugdx_loge(TAG, "Unknown display driver %i\n", display_cfg->driver);
 			return false;
 	}
-	device_config.queue_size = 7;
+	device_config.queue_size = MAX_ASYNC_TRANSACTIONS;
 	device_config.mode = 3;
 	device_config.flags = SPI_DEVICE_NO_DUMMY;
 	device_config.spics_io_num = display_cfg->cs >= 0 ? display_cfg->cs : -1;
@@ -297,17 +322,76 @@ bool mcugdx_display_init(mcugdx_display_config_t *display_cfg) {
 
 	// Setup internal display struct
 	driver = display_cfg->driver;
-	display.native_width = display.width = display_cfg->native_width;
-	display.native_height = display.height = display_cfg->native_height;
+	display.scale = display_cfg->scale > 1 ? display_cfg->scale : 1;
+	if ((display.scale != 2 && display.scale != 4 && display.scale != 1) || display_cfg->native_width % display.scale || display_cfg->native_height % display.scale) {
+		mcugdx_loge(TAG, "Scale %li must be 2 or 4 and divide the native size", display.scale);
+		return false;
+	}
+	display.native_width = display_cfg->native_width;
+	display.native_height = display_cfg->native_height;
+	display.width = display.native_width / display.scale;
+	display.height = display.native_height / display.scale;
 	display.orientation = MCUGDX_PORTRAIT;
 	dc = display_cfg->dc;
+	display.band_height = display_cfg->band_height;
+	if (display_cfg->indexed && display.band_height > 0) {
+		mcugdx_loge(TAG, "Indexed mode can't be combined with bands");
+		return false;
+	}
 	mcugdx_mem_print();
 	mcugdx_log(TAG, "Largest DMA block %li", heap_caps_get_largest_free_block(MALLOC_CAP_DMA));
-	size_t num_bytes = display.width * display.height * sizeof(uint16_t);
-	mcugdx_log(TAG, "Trying to allocate %li frame buffer bytes", num_bytes);
-	display.frame_buffer = heap_caps_calloc(num_bytes, 1, MALLOC_CAP_DMA);
-	mcugdx_log(TAG, "Frame buffer at %p\n", display.frame_buffer);
-	internal_mem += display.width * display.height * sizeof(uint16_t);
+	if (display.band_height > 0) {
+		// Bands are rendered along the longer side, so they fit either orientation
+		uint32_t max_width = display.width > display.height ? display.width : display.height;
+		size_t num_bytes = max_width * display.band_height * sizeof(uint16_t);
+		// Each band is sent as a single SPI transaction
+		if (num_bytes > BUFFER_SIZE) {
+			mcugdx_loge(TAG, "Band of %li bytes exceeds the maximum SPI transaction size of %li bytes", (uint32_t) num_bytes, (uint32_t) BUFFER_SIZE);
+			return false;
+		}
+		mcugdx_log(TAG, "Trying to allocate 2x %li band buffer bytes", num_bytes);
+		band_buffers[0] = heap_caps_malloc(num_bytes, MALLOC_CAP_DMA);
+		band_buffers[1] = heap_caps_malloc(num_bytes, MALLOC_CAP_DMA);
+		if (!band_buffers[0] || !band_buffers[1]) {
+			mcugdx_loge(TAG, "Could not allocate band buffers");
+			return false;
+		}
+		internal_mem += num_bytes * 2;
+	} else if (display_cfg->indexed) {
+		// Never sent as is, so it doesn't need to be DMA capable
+		size_t num_bytes = display.width * display.height * sizeof(uint8_t);
+		mcugdx_log(TAG, "Trying to allocate %li indexed frame buffer bytes", num_bytes);
+		display.indexed_frame_buffer = heap_caps_calloc(num_bytes, 1, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+		if (!display.indexed_frame_buffer) {
+			mcugdx_loge(TAG, "Could not allocate indexed frame buffer");
+			return false;
+		}
+		internal_mem += num_bytes;
+	} else {
+		size_t num_bytes = display.width * display.height * sizeof(uint16_t);
+		mcugdx_log(TAG, "Trying to allocate %li frame buffer bytes", num_bytes);
+		display.frame_buffer = heap_caps_calloc(num_bytes, 1, MALLOC_CAP_DMA);
+		mcugdx_log(TAG, "Frame buffer at %p\n", display.frame_buffer);
+		internal_mem += num_bytes;
+		if (display_cfg->double_buffer) {
+			back_buffer = heap_caps_calloc(num_bytes, 1, MALLOC_CAP_DMA);
+			if (!back_buffer) {
+				mcugdx_loge(TAG, "Could not allocate back buffer");
+				return false;
+			}
+			internal_mem += num_bytes;
+		}
+	}
+	if (display.scale > 1 || display.indexed_frame_buffer) {
+		mcugdx_log(TAG, "Trying to allocate 2x %li expand buffer bytes", (uint32_t) EXPAND_BUFFER_SIZE);
+		expand_buffers[0] = heap_caps_malloc(EXPAND_BUFFER_SIZE, MALLOC_CAP_DMA);
+		expand_buffers[1] = heap_caps_malloc(EXPAND_BUFFER_SIZE, MALLOC_CAP_DMA);
+		if (!expand_buffers[0] || !expand_buffers[1]) {
+			mcugdx_loge(TAG, "Could not allocate expand buffers");
+			return false;
+		}
+		internal_mem += EXPAND_BUFFER_SIZE * 2;
+	}
 
 	// Send init commands to display
 	switch (driver) {
@@ -328,19 +412,36 @@ bool mcugdx_display_init(mcugdx_display_config_t *display_cfg) {
 	return true;
 }
 
+static inline bool fence_done(mcugdx_display_fence_t fence) {
+	return (int32_t) (completed_fence - fence) >= 0;
+}
+
+// Polling transactions can't be mixed with queued ones, so everything sending
+// commands has to collect the queued transactions of an async show first.
+static bool collect_async(TickType_t timeout) {
+	while (num_async_pending > 0) {
+		spi_transaction_t *result;
+		if (spi_device_get_trans_result(spi_handle, &result, timeout) != ESP_OK) return false;
+		num_async_pending--;
+	}
+	completed_fence = submitted_fence;
+	return true;
+}
+
 void mcugdx_display_set_orientation(mcugdx_display_orientation_t orientation) {
+	collect_async(portMAX_DELAY);
 	uint8_t madctl = orientation = orientation % 4;
 
 	switch (orientation) {
 		case MCUGDX_PORTRAIT:
 			madctl = (MADCTL_MY | pixel_order);
-			display.width = display.native_width;
-			display.height = display.native_height;
+			display.width = display.native_width / display.scale;
+			display.height = display.native_height / display.scale;
 			break;
 		case MCUGDX_LANDSCAPE:
 			madctl = (MADCTL_MY | MADCTL_MV | pixel_order);
-			display.width = display.native_height;
-			display.height = display.native_width;
+			display.width = display.native_height / display.scale;
+			display.height = display.native_width / display.scale;
 			break;
 		default:
 			mcugdx_loge(TAG, "Unsupported display orientation %i\n", orientation);
@@ -349,22 +450,275 @@ void mcugdx_display_set_orientation(mcugdx_display_orientation_t orientation) {
 	spi_write_data_byte(spi_handle, dc, madctl);
 
 	display.orientation = orientation;
+	mcugdx_display_mark_dirty(0, 0, display.width, display.height);
 }
 
-void mcugdx_display_show() {
+// Takes a window in frame buffer pixels, which cover scale x scale panel pixels
+static void set_window(int32_t x, int32_t y, int32_t width, int32_t height) {
+	x *= display.scale;
+	y *= display.scale;
+	width *= display.scale;
+	height *= display.scale;
 	spi_write_command(spi_handle, dc, 0x2A);
-	spi_write_addr(spi_handle, dc, 0, display.width - 1);
+	spi_write_addr(spi_handle, dc, x, x + width - 1);
 	spi_write_command(spi_handle, dc, 0x2B);
-	spi_write_addr(spi_handle, dc, 0, display.height - 1);
+	spi_write_addr(spi_handle, dc, y, y + height - 1);
 	spi_write_command(spi_handle, dc, 0x2C);
-
-	uint32_t size = display.width * display.height * 2;
-	uint8_t *frame_buffer = (uint8_t *) display.frame_buffer;
 	gpio_set_level(dc, 1);
+}
+
+static void queue_expand_buffer(void) {
+	if (expand_buffer_pixels == 0) return;
+	spi_transaction_t *transaction = &expand_transactions[expand_buffer];
+	memset(transaction, 0, sizeof(spi_transaction_t));
+	transaction->length = expand_buffer_pixels * 16;
+	transaction->tx_buffer = expand_buffers[expand_buffer];
+	esp_err_t ret = spi_device_queue_trans(spi_handle, transaction, portMAX_DELAY);
+	assert(ret == ESP_OK);
+	num_expand_pending++;
+	expand_buffer ^= 1;
+	expand_buffer_pixels = 0;
+}
+
+// Expands the rows of RGB565 pixels, or of palette indices if indices isn't
+// NULL, to scale x scale blocks and queues them in the expand buffers, one
+// being filled while the other is sent. Call finish_expanded() after the last rows.
+static void queue_expanded(const uint16_t *pixels, const uint8_t *indices, int32_t stride, int32_t width, int32_t height) {
+	const uint16_t *palette = display.palette;
+	uint32_t scale = display.scale;
+	uint32_t row_pixels = width * scale;
+	for (int32_t y = 0; y < height; y++) {
+		if ((expand_buffer_pixels + row_pixels * scale) * sizeof(uint16_t) > EXPAND_BUFFER_SIZE) queue_expand_buffer();
+		// The oldest transaction in flight is the one that used this buffer
+		if (expand_buffer_pixels == 0 && num_expand_pending == 2) {
+			spi_transaction_t *result;
+			spi_device_get_trans_result(spi_handle, &result, portMAX_DELAY);
+			num_expand_pending--;
+		}
+
+		uint16_t *row = expand_buffers[expand_buffer] + expand_buffer_pixels;
+		if (indices && scale == 1) {
+			for (int32_t x = 0; x < width; x++) row[x] = palette[indices[x]];
+		} else if (scale == 2) {
+			uint32_t *pairs = (uint32_t *) row;
+			if (indices) {
+				for (int32_t x = 0; x < width; x++) {
+					uint32_t pixel = palette[indices[x]];
+					pairs[x] = pixel | pixel << 16;
+				}
+			} else {
+				for (int32_t x = 0; x < width; x++) pairs[x] = pixels[x] | (uint32_t) pixels[x] << 16;
+			}
+		} else {
+			for (int32_t x = 0; x < width; x++) {
+				uint16_t pixel = indices ? palette[indices[x]] : pixels[x];
+				for (uint32_t i = 0; i < scale; i++) row[x * scale + i] = pixel;
+			}
+		}
+		for (uint32_t i = 1; i < scale; i++) memcpy(row + i * row_pixels, row, row_pixels * sizeof(uint16_t));
+		expand_buffer_pixels += row_pixels * scale;
+		if (indices) {
+			indices += stride;
+		} else {
+			pixels += stride;
+		}
+	}
+}
+
+// Sends what is left in the expand buffers and waits for all of it
+static void finish_expanded(void) {
+	queue_expand_buffer();
+	while (num_expand_pending > 0) {
+		spi_transaction_t *result;
+		spi_device_get_trans_result(spi_handle, &result, portMAX_DELAY);
+		num_expand_pending--;
+	}
+}
+
+static void show_rect(mcugdx_rect_t *rect) {
+	set_window(rect->x, rect->y, rect->width, rect->height);
+	mcugdx_display_count_window(rect->width, rect->height);
+
+	if (display.indexed_frame_buffer) {
+		queue_expanded(NULL, display.indexed_frame_buffer + rect->y * display.width + rect->x, display.width, rect->width, rect->height);
+		finish_expanded();
+		return;
+	}
+	if (display.scale > 1) {
+		queue_expanded(display.frame_buffer + rect->y * display.width + rect->x, NULL, display.width, rect->width, rect->height);
+		finish_expanded();
+		return;
+	}
+
+	uint8_t *frame_buffer = (uint8_t *) (display.frame_buffer + rect->y * display.width + rect->x);
+	if (rect->width == (int32_t) display.width) {
+		// Full rows are contiguous in the frame buffer
+		uint32_t size = rect->width * rect->height * 2;
+		while (size > 0) {
+			uint16_t bs = (size > BUFFER_SIZE) ? BUFFER_SIZE : size;
+			spi_write_bytes(spi_handle, frame_buffer, bs);
+			size -= bs;
+			frame_buffer += bs;
+		}
+	} else {
+		for (int32_t y = 0; y < rect->height; y++) {
+			spi_write_bytes(spi_handle, frame_buffer, rect->width * 2);
+			frame_buffer += display.width * 2;
+		}
+	}
+}
+
+// Renders a band while the previous one is still being sent via DMA. Polling
+// transactions can't be mixed with queued ones, so the window is set up first
+// and all queued transactions are collected before returning.
+static void show_bands(void) {
+	set_window(0, 0, display.width, display.height);
+
+	spi_transaction_t transactions[2];
+	uint32_t num_queued = 0;
+	uint32_t band = 0;
+	for (int32_t y = 0; y < (int32_t) display.height; y += display.band_height, band ^= 1) {
+		int32_t height = (int32_t) display.height - y;
+		if (height > (int32_t) display.band_height) height = (int32_t) display.band_height;
+
+		// The oldest transaction in flight is the one that used this band's buffer
+		if (num_queued == 2) {
+			spi_transaction_t *result;
+			spi_device_get_trans_result(spi_handle, &result, portMAX_DELAY);
+			num_queued--;
+		}
+
+		mcugdx_display_render_band(band_buffers[band], y, height);
+		if (display.scale > 1) {
+			// Expanded into the expand buffers, which are sent instead
+			queue_expanded(band_buffers[band], NULL, display.width, display.width, height);
+			continue;
+		}
+
+		memset(&transactions[band], 0, sizeof(spi_transaction_t));
+		transactions[band].length = display.width * height * 16;
+		transactions[band].tx_buffer = band_buffers[band];
+		esp_err_t ret = spi_device_queue_trans(spi_handle, &transactions[band], portMAX_DELAY);
+		assert(ret == ESP_OK);
+		num_queued++;
+	}
+
+	while (num_queued > 0) {
+		spi_transaction_t *result;
+		spi_device_get_trans_result(spi_handle, &result, portMAX_DELAY);
+		num_queued--;
+	}
+	if (display.scale > 1) finish_expanded();
+	mcugdx_display_end_bands();
+}
+
+void mcugdx_display_show() {
+	collect_async(portMAX_DELAY);
+	if (display.band_height > 0) {
+		show_bands();
+		return;
+	}
+
+	mcugdx_rect_t rects[MCUGDX_DISPLAY_MAX_DIRTY_RECTS];
+	uint32_t num_rects = mcugdx_display_take_dirty_rects(rects);
+	for (uint32_t i = 0; i < num_rects; i++) {
+		show_rect(&rects[i]);
+	}
+}
+
+// Sends the rows spanned by all dirty rects as a single full width window, so
+// the whole transfer is contiguous and can be queued in a few large chunks.
+// Scaled and indexed frames have to be expanded first and are sent by
+// mcugdx_display_show().
+mcugdx_display_fence_t mcugdx_display_show_async(void) {
+	if (display.band_height > 0 || display.scale > 1 || display.indexed_frame_buffer) {
+		mcugdx_display_show();
+		return submitted_fence;
+	}
+	collect_async(portMAX_DELAY);
+
+	mcugdx_rect_t rects[MCUGDX_DISPLAY_MAX_DIRTY_RECTS];
+	uint32_t num_rects = mcugdx_display_take_dirty_rects(rects);
+	submitted_fence++;
+	if (num_rects == 0) {
+		completed_fence = submitted_fence;
+		return submitted_fence;
+	}
+
+	int32_t y1 = rects[0].y, y2 = rects[0].y + rects[0].height;
+	for (uint32_t i = 1; i < num_rects; i++) {
+		if (rects[i].y < y1) y1 = rects[i].y;
+		if (rects[i].y + rects[i].height > y2) y2 = rects[i].y + rects[i].height;
+	}
+	set_window(0, y1, display.width, y2 - y1);
+	mcugdx_display_count_window(display.width, y2 - y1);
+
+	// A single SPI transaction can send at most BUFFER_SIZE bytes
+	uint8_t *frame_buffer = (uint8_t *) (display.frame_buffer + y1 * display.width);
+	uint32_t size = display.width * (y2 - y1) * 2;
+	uint32_t num_queued = 0;
 	while (size > 0) {
-		uint16_t bs = (size > BUFFER_SIZE) ? BUFFER_SIZE : size;
-		spi_write_bytes(spi_handle, frame_buffer, bs);
+		uint32_t bs = (size > BUFFER_SIZE) ? BUFFER_SIZE : size;
+		if (num_async_pending == MAX_ASYNC_TRANSACTIONS) {
+			spi_transaction_t *result;
+			spi_device_get_trans_result(spi_handle, &result, portMAX_DELAY);
+			num_async_pending--;
+		}
+		// Results come back in order, so this is the slot of the oldest chunk
+		spi_transaction_t *transaction = &async_transactions[num_queued++ % MAX_ASYNC_TRANSACTIONS];
+		memset(transaction, 0, sizeof(spi_transaction_t));
+		transaction->length = bs * 8;
+		transaction->tx_buffer = frame_buffer;
+		esp_err_t ret = spi_device_queue_trans(spi_handle, transaction, portMAX_DELAY);
+		assert(ret == ESP_OK);
+		num_async_pending++;
 		size -= bs;
 		frame_buffer += bs;
 	}
-}
\ No newline at end of file
+
+	if (back_buffer) {
+		uint16_t *front_buffer = display.frame_buffer;
+		display.frame_buffer = back_buffer;
+		back_buffer = front_buffer;
+	}
+	return submitted_fence;
+}
+
+void mcugdx_display_wait(mcugdx_display_fence_t fence) {
+	if (!fence_done(fence)) collect_async(portMAX_DELAY);
+}
+
+bool mcugdx_display_is_done(mcugdx_display_fence_t fence) {
+	if (!fence_done(fence)) collect_async(0);
+	return fence_done(fence);
+}
+
+static void worker_task(void *args) {
+	while (true) {
+		xSemaphoreTake(worker_start, portMAX_DELAY);
+		worker_work(1);
+		xSemaphoreGive(worker_done);
+	}
+}
+
+// Runs work(0) on the calling core and work(1) on a task pinned to the other
+// core, and returns once both are done. Single core chips run both parts here.
+void mcugdx_display_parallel(void (*work)(uint32_t part)) {
+	if (portNUM_PROCESSORS > 1 && !worker_start && !worker_failed) {
+		worker_start = xSemaphoreCreateBinary();
+		worker_done = xSemaphoreCreateBinary();
+		worker_failed = !worker_start || !worker_done ||
+						xTaskCreatePinnedToCore(worker_task, "mcugdx_blit_worker", 4096, NULL, 5, NULL, !xPortGetCoreID()) != pdPASS;
+		if (worker_failed) mcugdx_loge(TAG, "Could not start blit worker, rendering on one core");
+	}
+	if (portNUM_PROCESSORS == 1 || worker_failed) {
+		work(0);
+		work(1);
+		return;
+	}
+
+	worker_work = work;
+	xSemaphoreGive(worker_start);
+	work(0);
+	xSemaphoreTake(worker_done, portMAX_DELAY);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "display.h"
+#include "image.h"
+#include "files.h"
+#include "mem.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A glyph's region in the atlas, drawn offset_x, offset_y from the pen position
+// at the top of the line. The pen then moves right by advance.
+typedef struct {
+	uint32_t codepoint;
+	uint16_t x, y, width, height;
+	int16_t offset_x, offset_y;
+	int16_t advance;
+	// Kerning pairs with this glyph on the left, see mcugdx_font_t
+	uint16_t num_kernings;
+	uint32_t first_kerning;
+} mcugdx_glyph_t;
+
+typedef struct {
+	uint32_t first, second;
+	int16_t amount;
+} mcugdx_kerning_t;
+
+typedef struct {
+	// Glyph coverage as spans and an optional 4 bit alpha plane for anti-aliased fonts
+	mcugdx_image_t *atlas;
+	uint32_t line_height;
+	// Distance from the top of the line to the baseline
+	uint32_t base;
+	// Sorted by codepoint, ASCII glyphs are also looked up through ascii
+	uint32_t num_glyphs;
+	mcugdx_glyph_t *glyphs;
+	int16_t ascii[128];
+	// Extent of all glyphs relative to the pen position, including the most
+	// negative kerning, to skip what is outside the screen
+	int32_t min_x, min_y, max_y;
+	// Sorted by first, then second codepoint
+	uint32_t num_kernings;
+	mcugdx_kerning_t *kernings;
+	mcugdx_memory_type_t mem_type;
+} mcugdx_font_t;
+
+// Creates a font from an atlas whose alpha plane, or pixels other than black if
+// it has none, are the glyph coverage. The font takes ownership of the atlas and
+// replaces its pixels. Anti-aliased fonts keep 4 bits of coverage per pixel, all
+// others are reduced to 1 bit. Glyphs and kernings are copied and sorted.
+mcugdx_font_t *mcugdx_font_create(mcugdx_image_t *atlas, uint32_t line_height, uint32_t base, const mcugdx_glyph_t *glyphs, uint32_t num_glyphs, const mcugdx_kerning_t *kernings, uint32_t num_kernings, bool antialiased, mcugdx_memory_type_t mem_type);
+
+// Loads an AngelCode BMFont text file, as written by BMFont, Hiero or fontbm,
+// with a single page. The page must be converted to QOI next to the file, e.g.
+// font.png to font.qoi, keeping its alpha channel.
+mcugdx_font_t *mcugdx_font_load(const char *path, mcugdx_file_system_t *fs, bool antialiased, mcugdx_memory_type_t mem_type);
+
+void mcugdx_font_unload(mcugdx_font_t *font);
+
+// Returns NULL if the font has no glyph for the codepoint
+mcugdx_glyph_t *mcugdx_font_glyph(mcugdx_font_t *font, uint32_t codepoint);
+
+// Kerning to add to the advance of first if second follows it
+int32_t mcugdx_font_kerning(mcugdx_font_t *font, mcugdx_glyph_t *first, uint32_t second);
+
+// Measures UTF-8 text without drawing it. The width is that of the widest line,
+// the height is the number of lines times the line height.
+void mcugdx_font_measure(mcugdx_font_t *font, const char *text, int32_t *width, int32_t *height);
+
+// Measures count texts in one call, e.g. the entries of a menu
+void mcugdx_font_measure_all(mcugdx_font_t *font, const char **texts, uint32_t count, int32_t *widths, int32_t *heights);
+
+// Draws UTF-8 text in color with the top left corner of the first line at x, y.
+// Lines are separated by \n. Lines and glyphs outside the screen are skipped,
+// the others are clipped.
+void mcugdx_display_text(mcugdx_font_t *font, const char *text, int32_t x, int32_t y, uint16_t color);
+
+#ifdef __cplusplus
+}
+#endif
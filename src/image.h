@@ -1,6 +1,7 @@
 #pragma once
 
 #include "mem.h"
+#include <stdbool.h>
 #include <stdint.h>
 #include "files.h"
 
@@ -8,16 +9,74 @@
 extern "C" {
 #endif
 
+// Run of opaque pixels in a row of a sprite
+typedef struct {
+	uint16_t x;
+	uint16_t width;
+} mcugdx_image_span_t;
+
 typedef struct {
 	uint32_t width, height;
 	uint16_t *pixels;
 	mcugdx_memory_type_t mem_type;
+	// Set up by mcugdx_image_make_sprite(), NULL otherwise. The spans of row y
+	// are spans[row_spans[y]] up to, excluding, spans[row_spans[y + 1]].
+	uint16_t color_key;
+	uint32_t *row_spans;
+	mcugdx_image_span_t *spans;
+	// Optional alpha plane with 4 or 8 bits per pixel, 0 and NULL otherwise.
+	// With 4 bits, pixel i is in alpha[i / 2], even pixels in the low nibble.
+	uint32_t alpha_bits;
+	uint8_t *alpha;
 } mcugdx_image_t;
 
+// Image with a palette of 16 or 256 colors and 4 or 8 bit indices per pixel,
+// at a quarter or half the memory of a regular image. With 4 bits, pixel i is
+// in indices[i / 2], even pixels in the low nibble. Palette entries are stored
+// like pixels of regular images.
+typedef struct {
+	uint32_t width, height;
+	uint32_t bits_per_pixel;
+	uint8_t *indices;
+	uint16_t *palette;
+	mcugdx_memory_type_t mem_type;
+} mcugdx_indexed_image_t;
+
+// Creates a black image, e.g. as a target for mcugdx_display_set_target()
+mcugdx_image_t *mcugdx_image_create(uint32_t width, uint32_t height, mcugdx_memory_type_t mem_type);
+
 mcugdx_image_t *mcugdx_image_load(const char *path, mcugdx_file_system_t *fs, mcugdx_memory_type_t mem_type);
 
+// Like mcugdx_image_load(), but keeps the alpha channel of the QOI file in an
+// alpha plane with alpha_bits (0, 4 or 8) bits per pixel, for blended blits.
+mcugdx_image_t *mcugdx_image_load_alpha(const char *path, mcugdx_file_system_t *fs, uint32_t alpha_bits, mcugdx_memory_type_t mem_type);
+
 void mcugdx_image_unload(mcugdx_image_t *image);
 
+// Loads a QOI file with at most 16 or 256 colors as an indexed image with 4 or
+// 8 bits per pixel. The palette lists the colors in the order they first appear
+// in the image, unused entries are black. Fails if there are too many colors.
+mcugdx_indexed_image_t *mcugdx_image_load_indexed(const char *path, mcugdx_file_system_t *fs, uint32_t bits_per_pixel, mcugdx_memory_type_t mem_type);
+
+void mcugdx_indexed_image_unload(mcugdx_indexed_image_t *image);
+
+// Precomputes the runs of pixels in each row that aren't color_key. Keyed
+// blits with the same color key then copy those runs and skip the transparent
+// pixels in between without looking at them. Worth it for sprites with large
+// transparent areas. The pixels must not change afterwards, or this has to be
+// called again.
+bool mcugdx_image_make_sprite(mcugdx_image_t *image, uint16_t color_key);
+
+// Fast 64-bit hash of the pixels and dimensions. Not cryptographic, but the
+// same on every platform, so golden hashes recorded on desktop hold on device.
+uint64_t mcugdx_image_hash(mcugdx_image_t *image);
+
+// Write the image as a binary PPM or a QOI file via stdio. Meant for desktop,
+// on a device the path has to be on a mounted file system like the SD card.
+bool mcugdx_image_write_ppm(mcugdx_image_t *image, const char *path);
+
+bool mcugdx_image_write_qoi(mcugdx_image_t *image, const char *path);
+
 #ifdef __cplusplus
 }
 #endif
@@ -16,7 +16,11 @@ extern "C" {
 #include "files.h"
 #include "image.h"
 #include "audio.h"
+#include "synth.h"
+#include "tracker.h"
 #include "display.h"
+#include "tilemap.h"
+#include "font.h"
 #include "ultrasonic.h"
 #include "neopixels.h"
 #include "buttons.h"
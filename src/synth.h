@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "audio.h"
+#include "files.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MCUGDX_SYNTH_MAGIC 0x30584653 // "SFX0"
+
+typedef enum {
+	MCUGDX_SYNTH_SQUARE,
+	MCUGDX_SYNTH_SAW,
+	MCUGDX_SYNTH_SINE,
+	MCUGDX_SYNTH_NOISE
+} mcugdx_synth_wave_t;
+
+// Parameters of a synthesized sound effect. The struct is exactly 64 bytes and
+// little endian, so it can be stored as is in a file, e.g. "jump.sfx" in rofs.
+typedef struct {
+	uint32_t magic;         // MCUGDX_SYNTH_MAGIC
+	uint8_t wave;           // mcugdx_synth_wave_t
+	uint8_t volume;         // 0-255
+	uint8_t duty;           // square wave duty cycle, 0-255 maps to 0-50%
+	uint8_t reserved;
+	float attack;           // seconds
+	float decay;            // seconds
+	float sustain;          // seconds
+	float sustain_level;    // 0-1
+	float release;          // seconds
+	float frequency;        // Hz
+	float min_frequency;    // Hz, the sound ends when sliding below this
+	float slide;            // octaves per second
+	float delta_slide;      // octaves per second^2
+	float vibrato_depth;    // semitones
+	float vibrato_speed;    // Hz
+	float duty_sweep;       // duty cycle change per second, 1 = 0-50% in one second
+	float arp_mod;          // frequency multiplier applied once after arp_time
+	float arp_time;         // seconds, 0 disables the arpeggio
+} mcugdx_synth_params_t;
+
+void mcugdx_synth_params_init(mcugdx_synth_params_t *params);
+
+bool mcugdx_synth_params_load(const char *path, mcugdx_file_system_t *fs, mcugdx_synth_params_t *params);
+
+// Length of the effect in seconds. Shorter than the envelope if the pitch slides
+// below min_frequency, 0 if the parameters produce no sound at all.
+double mcugdx_synth_duration(const mcugdx_synth_params_t *params);
+
+// Creates a sound that synthesizes the effect on the fly during mixing.
+mcugdx_sound_t *mcugdx_synth_create(const mcugdx_synth_params_t *params, mcugdx_memory_type_t mem_type);
+
+// Renders the effect once into a mono PCM buffer at the mixer sample rate.
+mcugdx_sound_t *mcugdx_synth_render(const mcugdx_synth_params_t *params, mcugdx_memory_type_t mem_type);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "display.h"
+#include "image.h"
+#include "files.h"
+#include "mem.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	// Tiles are drawn keyed with the map's color key
+	MCUGDX_TILEMAP_KEYED = 1,
+	// The layer repeats endlessly in x or y
+	MCUGDX_TILEMAP_REPEAT_X = 2,
+	MCUGDX_TILEMAP_REPEAT_Y = 4
+} mcugdx_tilemap_layer_flags_t;
+
+// A grid of tiles. Tile 0 is empty, tile n is the n-th tile of the tileset,
+// counting from 1, left to right, top to bottom. The layer's top left corner
+// is at offset_x, offset_y on screen when scrolled to 0, 0. Scrolling moves it
+// by the scroll position times the parallax factors.
+typedef struct {
+	uint32_t width, height;
+	uint8_t *tiles;
+	int32_t offset_x, offset_y;
+	float parallax_x, parallax_y;
+	uint32_t flags;
+} mcugdx_tilemap_layer_t;
+
+typedef struct {
+	mcugdx_image_t *tileset;
+	uint32_t tile_width, tile_height;
+	uint32_t num_tiles;
+	uint16_t color_key;
+	// 1 if the tileset has less than 256 tiles, 2 otherwise
+	uint32_t bytes_per_tile;
+	// Per tileset tile, whether it is empty, opaque or mixed with color_key
+	uint8_t *tile_kinds;
+	uint32_t num_layers;
+	mcugdx_tilemap_layer_t *layers;
+	mcugdx_blit_t *blits;
+	uint32_t blit_capacity;
+	mcugdx_memory_type_t mem_type;
+} mcugdx_tilemap_t;
+
+// Creates a map without layers for the tileset, which must stay alive as long
+// as the map. If any tile mixes color_key with other colors, the tileset is
+// turned into a sprite via mcugdx_image_make_sprite().
+mcugdx_tilemap_t *mcugdx_tilemap_create(mcugdx_image_t *tileset, uint32_t tile_width, uint32_t tile_height, uint16_t color_key, mcugdx_memory_type_t mem_type);
+
+// Loads a map file. All numbers are little endian:
+//   "TMAP", uint16 tile width, uint16 tile height, uint16 color key, uint16 number of layers
+// followed by each layer:
+//   uint16 width, uint16 height, int16 offset x, int16 offset y,
+//   uint16 parallax x, uint16 parallax y in 8.8 fixed point, uint16 flags,
+//   width * height tiles, one byte each for tilesets with less than 256 tiles, two otherwise
+mcugdx_tilemap_t *mcugdx_tilemap_load(const char *path, mcugdx_file_system_t *fs, mcugdx_image_t *tileset, mcugdx_memory_type_t mem_type);
+
+void mcugdx_tilemap_unload(mcugdx_tilemap_t *map);
+
+// Adds an empty layer on top of the existing ones, with no offset and a parallax
+// factor of 1. The returned pointer is valid until the next layer is added.
+mcugdx_tilemap_layer_t *mcugdx_tilemap_add_layer(mcugdx_tilemap_t *map, uint32_t width, uint32_t height, uint32_t flags);
+
+uint32_t mcugdx_tilemap_get_tile(mcugdx_tilemap_t *map, mcugdx_tilemap_layer_t *layer, uint32_t x, uint32_t y);
+
+void mcugdx_tilemap_set_tile(mcugdx_tilemap_t *map, mcugdx_tilemap_layer_t *layer, uint32_t x, uint32_t y, uint32_t tile);
+
+// Draws the tiles of a layer inside the clip rect as one blit batch. Opaque
+// tiles are plain copies, empty tiles of keyed layers are skipped. Draw layers
+// one by one to put sprites between them.
+void mcugdx_tilemap_draw_layer(mcugdx_tilemap_t *map, uint32_t layer_index, int32_t scroll_x, int32_t scroll_y);
+
+// Draws all layers, back to front
+void mcugdx_tilemap_draw(mcugdx_tilemap_t *map, int32_t scroll_x, int32_t scroll_y);
+
+#ifdef __cplusplus
+}
+#endif
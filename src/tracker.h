@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include "audio.h"
+#include "files.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Loads a ProTracker compatible MOD file (M.K., xCHN, xxCH, FLT4/8 with
+// 31 samples) as a sound that can be played via mcugdx_sound_play(). Sample
+// data is loaded into memory of the given type, pattern data is streamed from
+// the file system by each playing instance one pattern at a time.
+mcugdx_sound_t *mcugdx_tracker_load(const char *path, mcugdx_file_system_t *fs, mcugdx_memory_type_t mem_type);
+
+#ifdef __cplusplus
+}
+#endif